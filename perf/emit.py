@@ -0,0 +1,29 @@
+# Measures how fast seronc emits assembly for a large generated program
+import os, subprocess, sys, time
+
+procs = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+src = "/tmp/seron_emit.sn"
+out = "/tmp/seron_emit.s"
+
+with open(src, "w") as f:
+    for i in range(procs):
+        f.write(f"""
+proc f{i}(a: int, b: int, xs: *int) int {{
+    let acc: int = 0;
+    for i: int = 0, i < a, i=i+1 {{
+        if xs[i] > b && i != {i} {{
+            acc = acc + xs[i] * {i % 7 + 1};
+        }} else {{
+            acc = acc - (b / 2);
+        }}
+    }}
+    return acc;
+}}
+""")
+
+start = time.perf_counter()
+subprocess.run(["../seronc/seronc", "-t", "asm", src], check=True, stdout=subprocess.DEVNULL)
+elapsed = time.perf_counter() - start
+
+size = os.path.getsize(out)
+print(f"{procs} procs, {size / 1e6:.2f} MB of assembly in {elapsed:.3f}s ({size / 1e6 / elapsed:.2f} MB/s)")
@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+
+#include "ast.h"
+
+
+
+void symbolset_add(SymbolSet *set, Symbol *sym) {
+
+    if (symbolset_contains(set, sym)) return;
+
+    if (set->len == set->cap) {
+        set->cap = set->cap == 0 ? 16 : set->cap * 2;
+        set->items = NON_NULL(realloc(set->items, set->cap * sizeof(Symbol*)));
+    }
+
+    set->items[set->len++] = sym;
+}
+
+size_t symbolset_find(const SymbolSet *set, const Symbol *sym) {
+    for (size_t i=0; i < set->len; ++i)
+        if (set->items[i] == sym) return i;
+    return set->len;
+}
+
+bool symbolset_contains(const SymbolSet *set, const Symbol *sym) {
+    return symbolset_find(set, sym) != set->len;
+}
+
+
+
+bool ast_is_integer(TypeKind type) {
+    return type == TYPE_CHAR || type == TYPE_INT || type == TYPE_LONG;
+}
+
+bool ast_is_constant(const AstNode *node) {
+    return node->kind == ASTNODE_LITERAL
+        && node->expr_literal.kind == LITERAL_NUMBER
+        && ast_is_integer(node->type.kind);
+}
+
+int64_t ast_wrap(uint64_t value, TypeKind type) {
+    switch (type_primitive_size(type)) {
+        case 1:  return (int8_t)  value;
+        case 2:  return (int16_t) value;
+        case 4:  return (int32_t) value;
+        default: return (int64_t) value;
+    }
+}
+
+int64_t ast_constant(const AstNode *node) {
+    return ast_wrap(node->expr_literal.op.number, node->type.kind);
+}
+
+Symbol *ast_variable(const AstNode *node) {
+    if (node->kind != ASTNODE_LITERAL || node->expr_literal.kind != LITERAL_IDENT) return NULL;
+
+    Symbol *sym = node->expr_literal.sym;
+    if (sym == NULL || (sym->kind != SYMBOL_VARIABLE && sym->kind != SYMBOL_PARAMETER)) return NULL;
+
+    return sym;
+}
+
+static void count_node(UNUSED AstNode *node, UNUSED int _depth, void *args) {
+    int *size = args;
+    (*size)++;
+}
+
+int ast_size(AstNode *node) {
+    int size = 0;
+    parser_traverse_ast(node, count_node, NULL, &size);
+    return size;
+}
+
+
+
+AstNode *ast_new_node(Arena *arena, AstNodeKind kind, Type type) {
+    AstNode *node = arena_alloc(arena, sizeof(AstNode));
+    memset(node, 0, sizeof(AstNode));
+    node->kind = kind;
+    node->type = type;
+    return node;
+}
+
+AstNode *ast_new_ident(Arena *arena, Symbol *sym, Token op) {
+    AstNode *node = ast_new_node(arena, ASTNODE_LITERAL, sym->type);
+    node->expr_literal = (ExprLiteral) {
+        .op   = op,
+        .kind = LITERAL_IDENT,
+        .sym  = sym,
+    };
+    return node;
+}
+
+AstNode *ast_new_number(Arena *arena, int64_t value, Type type, Token op) {
+    op.kind        = TOK_LITERAL_NUMBER;
+    op.number      = ast_wrap(value, type.kind);
+    op.number_type = type.kind == TYPE_CHAR ? NUMBER_CHAR : type.kind == TYPE_LONG ? NUMBER_LONG : NUMBER_INT;
+    snprintf(op.value, ARRAY_LEN(op.value), "%ld", (int64_t) op.number);
+
+    AstNode *node = ast_new_node(arena, ASTNODE_LITERAL, type);
+    node->expr_literal = (ExprLiteral) {
+        .op   = op,
+        .kind = LITERAL_NUMBER,
+        .sym  = NULL,
+    };
+    return node;
+}
@@ -0,0 +1,44 @@
+#ifndef _AST_H
+#define _AST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <arena.h>
+#include <ver.h>
+
+#include "parser.h"
+#include "symboltable.h"
+
+// helpers shared by the passes that inspect and rewrite the tree after typecheck()
+
+typedef struct {
+    Symbol **items;
+    size_t len, cap;
+} SymbolSet;
+
+void symbolset_add(SymbolSet *set, Symbol *sym);
+// returns len if sym is not in the set
+NO_DISCARD size_t symbolset_find(const SymbolSet *set, const Symbol *sym);
+NO_DISCARD bool symbolset_contains(const SymbolSet *set, const Symbol *sym);
+
+NO_DISCARD bool ast_is_integer(TypeKind type);
+// whether the node is a number literal of an integer type
+NO_DISCARD bool ast_is_constant(const AstNode *node);
+// truncates value to the width of type, and sign extends it again
+NO_DISCARD int64_t ast_wrap(uint64_t value, TypeKind type);
+// value of a constant, at the width of its type
+NO_DISCARD int64_t ast_constant(const AstNode *node);
+// variable or parameter the node refers to, NULL if it is something else
+NO_DISCARD Symbol *ast_variable(const AstNode *node);
+// number of nodes in the tree
+NO_DISCARD int ast_size(AstNode *node);
+
+// new nodes are zeroed, apart from their kind and type
+NO_DISCARD AstNode *ast_new_node(Arena *arena, AstNodeKind kind, Type type);
+NO_DISCARD AstNode *ast_new_ident(Arena *arena, Symbol *sym, Token op);
+// value is wrapped to the width of type, op is the token it is reported at
+NO_DISCARD AstNode *ast_new_number(Arena *arena, int64_t value, Type type, Token op);
+
+#endif // _AST_H
@@ -11,114 +11,16 @@
 #include "lexer.h"
 #include "parser.h"
 #include "symboltable.h"
+#include "emitter.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "vector.h"
+#include "ir.h"
+#include "pass.h"
+#include "main.h"
 
 
 
-typedef enum {
-    REG_INVALID,
-
-    REG_RAX,
-    REG_RDI,
-    REG_RSI,
-    REG_RDX,
-    REG_RCX,
-    REG_R8,
-    REG_R9,
-} Register;
-
-
-
-
-NO_DISCARD static const char *size_op(TypeKind type) {
-    switch (type) {
-        case TYPE_POINTER:
-        case TYPE_LONG: return "qword";
-        case TYPE_INT:  return "dword";
-        case TYPE_CHAR: return "byte";
-        default: PANIC("invalid type");
-    }
-    UNREACHABLE();
-}
-
-NO_DISCARD static const char *subregister(Register reg, TypeKind type) {
-    switch (reg) {
-
-        case REG_RAX: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_LONG:
-            case TYPE_OBJECT:
-            case TYPE_POINTER: return "rax";
-            case TYPE_INT:     return "eax";
-            case TYPE_CHAR:    return "al";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_RDI: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_LONG:
-            case TYPE_OBJECT:
-            case TYPE_POINTER: return "rdi";
-            case TYPE_INT:     return "edi";
-            case TYPE_CHAR:    return "dil";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_RSI: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_LONG:
-            case TYPE_OBJECT:
-            case TYPE_POINTER: return "rsi";
-            case TYPE_INT:     return "esi";
-            case TYPE_CHAR:    return "sil";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_RDX: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_POINTER:
-            case TYPE_OBJECT:
-            case TYPE_LONG: return "rdx";
-            case TYPE_INT:  return "edx";
-            case TYPE_CHAR: return "dl";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_RCX: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_POINTER:
-            case TYPE_OBJECT:
-            case TYPE_LONG: return "rcx";
-            case TYPE_INT:  return "ecx";
-            case TYPE_CHAR: return "cl";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_R8: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_POINTER:
-            case TYPE_OBJECT:
-            case TYPE_LONG: return "r8";
-            case TYPE_INT:  return "r8d";
-            case TYPE_CHAR: return "r8b";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_R9: switch (type) {
-            case TYPE_PROCEDURE:
-            case TYPE_POINTER:
-            case TYPE_OBJECT:
-            case TYPE_LONG: return "r9";
-            case TYPE_INT:  return "r9d";
-            case TYPE_CHAR: return "r9b";
-            default: PANIC("invalid type");
-        } break;
-
-        case REG_INVALID: PANIC("invalid register");
-
-    }
-    UNREACHABLE();
-}
-
 // argnum starts at 1
 NO_DISCARD static Register abi_register(int argnum) {
     assert(argnum != 0);
@@ -141,46 +43,44 @@ NO_DISCARD static Register abi_register(int argnum) {
     return registers[argnum];
 }
 
-NO_DISCARD static const char *abi_register_str(int argnum, TypeKind type) {
-    Register reg = abi_register(argnum);
-    if (reg == REG_INVALID) return NULL;
-    return subregister(reg, type);
+// register operand holding a value of the given type
+NO_DISCARD static inline Operand reg(Register reg, TypeKind type) {
+    return operand_reg(reg, type_primitive_size(type));
 }
 
+NO_DISCARD static inline Operand reg64(Register reg) {
+    return operand_reg(reg, 8);
+}
 
-
-typedef struct {
-    size_t cap, len;
-    char *items;
-} Buffer;
-
-static void buffer_init(Buffer *buf) {
-    *buf = (Buffer) { 0 };
+NO_DISCARD static inline Operand imm(int64_t value, TypeKind type) {
+    return operand_imm(value, type_primitive_size(type));
 }
 
-static void buffer_append(Buffer *buf, char c) {
+NO_DISCARD static inline Operand label(LabelKind label, int id) {
+    return operand_label(label, id);
+}
 
-    if (buf->len >= buf->cap) {
-        if (buf->cap == 0)
-            buf->cap = 50;
-        else
-            buf->cap *= 2;
-        buf->items = NON_NULL(realloc(buf->items, buf->cap));
-        // zero out the newly allocated region
-        memset(buf->items + buf->len, 0, buf->cap - buf->len);
-    }
+NO_DISCARD static inline Operand shift_count(int count) {
+    return operand_imm(count, 1);
+}
 
-    buf->items[buf->len++] = c;
+NO_DISCARD static bool is_power_of_two(uint64_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
 }
 
-static void buffer_append_str(Buffer *buf, const char *str) {
-    for (const char *c=str; *c; c++)
-        buffer_append(buf, *c);
+NO_DISCARD static bool is_number(const AstNode *node) {
+    return node->kind == ASTNODE_LITERAL && node->expr_literal.kind == LITERAL_NUMBER;
 }
 
-static void buffer_destroy(Buffer *buf) {
-    free(buf->items);
-    buf->items = NULL;
+// value of a number literal, sign extended from the width of its type
+NO_DISCARD static int64_t number_value(const AstNode *node) {
+    uint64_t value = node->expr_literal.op.number;
+
+    switch (type_primitive_size(node->type.kind)) {
+        case 1:  return (int8_t)  value;
+        case 4:  return (int32_t) value;
+        default: return (int64_t) value;
+    }
 }
 
 
@@ -188,106 +88,563 @@ static void buffer_destroy(Buffer *buf) {
 struct {
     Buffer buf_data;
     Buffer buf_text;
+    InstructionList ins; // instructions of the current procedure
+    int *vars;           // stack offsets of the variables of the current procedure
+    int *var_sizes;
+    size_t vars_len, vars_cap;
     int label_count;
     int data_count;
-    Hashtable *scope;
+    int frame_base;      // offset of the frame of the body being inlined, 0 outside of inlined bodies
+    int frame_size;      // end of the part of the frame that is in use
+    int frame_extent;    // largest frame_size of the current procedure
+    int inline_label;    // continuation of the body being inlined, -1 outside of inlined bodies
+    const DeclProc *proc; // procedure being generated
+    bool escapes;        // the address of a slot of the current frame may be taken
+    bool tail_recursive; // a tail call of the current procedure has been turned into a jump
+    const IrProgram *ir; // set with -fssa, procedures are generated from it instead of the tree
+    const IrProc *ir_proc; // procedure of the IR being generated
+    int *ir_uses;        // number of uses of every value of ir_proc
+    int *ir_offsets;     // slot of every value of ir_proc, followed by the incoming slots of its phis
+    int ir_label;        // label of the first block of ir_proc
 } gen = { 0 };
 
+// stack slot at `[rbp-offset]`, relative to the frame of the body being generated
+NO_DISCARD static inline Operand slot(int offset, TypeKind type) {
+    return operand_mem(REG_RBP, -(gen.frame_base + offset), type_primitive_size(type));
+}
+
 static void gen_init(void) {
     buffer_init(&gen.buf_data);
     buffer_init(&gen.buf_text);
+    instructionlist_init(&gen.ins);
 }
 
 static void gen_destroy(void) {
     buffer_destroy(&gen.buf_data);
     buffer_destroy(&gen.buf_text);
+    instructionlist_destroy(&gen.ins);
+    free(gen.vars);
+    free(gen.var_sizes);
 }
 
-static void gen_write_to_file(const char *path) {
+// records the slot of a variable, which may be kept in a register instead
+static void gen_var(int offset, TypeKind type) {
 
-    FILE *f = fopen(path, "w");
-    if (f == NULL) {
-        diagnostic(DIAG_ERROR, "Failed to open output file %s", path);
-        exit(EXIT_FAILURE);
+    int size = type_primitive_size(type);
+    offset += gen.frame_base;
+
+    // variables of disjoint blocks may share a slot
+    for (size_t i=0; i < gen.vars_len; ++i) {
+        if (gen.vars[i] != offset) continue;
+        if (size > gen.var_sizes[i]) gen.var_sizes[i] = size;
+        return;
     }
 
-    if (gen.buf_data.len)
-        fprintf(f, "section .data\n%s", gen.buf_data.items);
+    if (gen.vars_len == gen.vars_cap) {
+        gen.vars_cap = gen.vars_cap == 0 ? 16 : gen.vars_cap * 2;
+        gen.vars = NON_NULL(realloc(gen.vars, gen.vars_cap * sizeof(int)));
+        gen.var_sizes = NON_NULL(realloc(gen.var_sizes, gen.vars_cap * sizeof(int)));
+    }
+
+    gen.vars[gen.vars_len] = offset;
+    gen.var_sizes[gen.vars_len++] = size;
+}
+
+// `comment` may be NULL
+static void gen_ins(Opcode op, Operand dst, Operand src, const char *comment) {
+    instructionlist_append(&gen.ins, (Instruction) {
+        .op      = op,
+        .dst     = dst,
+        .src     = src,
+        .comment = comment,
+    });
+}
+
+static inline void gen_ins2(Opcode op, Operand dst, Operand src) {
+    gen_ins(op, dst, src, NULL);
+}
 
-    if (gen.buf_text.len)
-        fprintf(f, "section .text\n%s", gen.buf_text.items);
+static inline void gen_ins1(Opcode op, Operand dst) {
+    gen_ins(op, dst, operand_none(), NULL);
+}
 
-    fclose(f);
+static inline void gen_ins0(Opcode op) {
+    gen_ins(op, operand_none(), operand_none(), NULL);
 }
 
-static void gen_write(const char *fmt, ...) {
-    va_list va;
-    va_start(va, fmt);
-    char buf[1024] = { 0 };
-    vsnprintf(buf, ARRAY_LEN(buf), fmt, va);
-    strcat(buf, "\n");
-    buffer_append_str(&gen.buf_text, buf);
-    va_end(va);
+static inline void gen_label(LabelKind label, int id) {
+    gen_ins1(OP_LABEL, operand_label(label, id));
 }
 
-static void gen_write_data(const char *fmt, ...) {
-    va_list va;
-    va_start(va, fmt);
-    char buf[1024] = { 0 };
-    vsnprintf(buf, ARRAY_LEN(buf), fmt, va);
-    strcat(buf, "\n");
-    buffer_append_str(&gen.buf_data, buf);
-    va_end(va);
+// types have already been checked and annotated by typecheck(), codegen only
+// looks at the annotations, and never has to report errors itself
+
+static void emit_addr(AstNode *node);
+static void emit(AstNode *node);
+
+// number literals and procedures can not change while the other arguments are
+// evaluated, so they are loaded straight into their register at the very end
+NO_DISCARD static bool constant_operand(const AstNode *node, Operand *op) {
+
+    if (is_number(node)) {
+        *op = imm(node->expr_literal.op.number, node->type.kind);
+        return true;
+    }
+
+    if (node->kind != ASTNODE_LITERAL || node->expr_literal.kind != LITERAL_IDENT
+        || node->expr_literal.sym->kind != SYMBOL_PROCEDURE)
+        return false;
+
+    *op = operand_symbol(node->expr_literal.op.value);
+    return true;
 }
 
-static Type emit_addr(AstNode *node);
-static Type emit(AstNode *node);
+// evaluates the arguments right to left, onto the stack, apart from constant ones
+static void push_args(const AstNodeList *list) {
+    for (size_t i=list->size; i-- > 0;) {
+        Operand op;
+        if (constant_operand(list->items[i], &op))
+            continue;
 
-static Type call(const ExprCall *call) {
+        emit(list->items[i]);
+        gen_ins1(OP_PUSH, reg64(REG_RAX));
+    }
+}
 
-    Type ty = emit(call->callee);
-    gen_write("push rax");
-    ProcSignature *sig = ty.signature;
+// pops the next argument pushed by push_args() into dst, or loads it if it is constant
+static void pop_arg(const AstNode *arg, Register dst, TypeKind type) {
+    Operand op;
+    if (!constant_operand(arg, &op))
+        gen_ins1(OP_POP, reg64(dst));
+    else if (op.kind == OPERAND_SYMBOL)
+        gen_ins2(OP_MOV, reg64(dst), op);
+    else
+        gen_ins2(OP_MOV, reg(dst, type), op);
+}
 
+// named procedures are called directly, anything else is a function pointer
+NO_DISCARD static bool is_direct_call(const AstNode *callee) {
+    return callee->kind == ASTNODE_LITERAL && callee->expr_literal.kind == LITERAL_IDENT
+        && callee->expr_literal.sym->kind == SYMBOL_PROCEDURE;
+}
+
+// the body of the callee is generated in place of the call, with its frame
+// right below the part of the frame the caller has in use, so that its locals
+// can not overlap with any of the caller. the arguments are evaluated like for
+// calls, by push_args(), and popped into the parameter slots. returns jump to the end of the body
+static void inline_call(const ExprCall *call) {
+
+    const DeclProc *callee = &call->inlined->stmt_proc;
+    const ProcSignature *sig = callee->type.signature;
     const AstNodeList *list = &call->args;
+
+    push_args(list);
+
+    int base = gen.frame_base;
+    int size = gen.frame_size;
+    int lbl  = gen.inline_label;
+
+    gen.frame_base   = size;
+    gen.frame_size   = size + callee->stack_size;
+    gen.frame_extent = gen.frame_size > gen.frame_extent ? gen.frame_size : gen.frame_extent;
+    gen.inline_label = gen.label_count++;
+
     for (size_t i=0; i < list->size; ++i) {
+        const Param *param = &sig->params[i];
+        TypeKind type = param->type.kind;
+
+        gen_var(param->offset, type);
+        pop_arg(list->items[i], REG_RAX, type);
+        gen_ins(OP_MOV, slot(param->offset, type), reg(REG_RAX, type), param->ident);
+    }
+
+    emit(callee->body);
+    gen_label(LABEL_INLINE, gen.inline_label);
 
+    gen.frame_base   = base;
+    gen.frame_size   = size;
+    gen.inline_label = lbl;
+}
+
+// arguments are evaluated right to left, onto the stack, so that nested calls
+// and the rdi scratch register of binops can not clobber arguments that are
+// already in place. once everything is evaluated, the first six are popped into
+// their registers and the rest is stored to the outgoing argument area at the
+// bottom of the stack, while constant arguments are only loaded at the very end.
+// none of these final moves read a register that another one writes, so the
+// parallel move into the argument registers can be done in any order
+//
+// the call is wrapped in `sub rsp, <size of stack arguments>` and a matching
+// `add rsp`, which are resolved by align_calls() once the push depth is known.
+// stack arguments are stored relative to rsp at the call, also fixed up there
+//
+// tail calls only have register arguments, and jump to the callee instead,
+// the frame is released right before the jump by epilogue()
+static void call(const ExprCall *call, bool tail) {
+
+    if (call->inlined != NULL) {
+        inline_call(call);
+        return;
+    }
+
+    ProcSignature *sig = call->callee->type.signature;
+    const AstNodeList *list = &call->args;
+
+    int area = list->size > 6 ? 8 * (list->size - 6) : 0;
+    if (!tail)
+        gen_ins2(OP_SUB, reg64(REG_RSP), operand_imm(area, 8));
+
+    push_args(list);
+
+    bool direct = is_direct_call(call->callee);
+    if (!direct)
+        emit(call->callee);
+
+    for (size_t i=0; i < list->size; ++i) {
         TypeKind type = sig->params[i].type.kind;
-        const char *reg = abi_register_str(i+1, type);
+        Register abi = abi_register(i+1);
 
-        emit(list->items[i]);
+        // stack arguments go through r11, which is neither an argument register nor the callee
+        Register dst = abi == REG_INVALID ? REG_R11 : abi;
 
-        if (reg == NULL) {
-            gen_write("push rax");
+        pop_arg(list->items[i], dst, type);
+        if (abi == REG_INVALID)
+            gen_ins2(OP_MOV, operand_mem(REG_RSP, 8 * (i - 6), 8), reg64(REG_R11));
+    }
 
-        } else {
-            const char *rax = subregister(REG_RAX, type);
-            gen_write("mov %s, %s", reg, rax);
+    if (tail) {
+        gen_ins1(OP_JMP, operand_symbol(call->callee->expr_literal.op.value));
+        return;
+    }
+
+    if (direct)
+        gen_ins1(OP_CALL, operand_symbol(call->callee->expr_literal.op.value));
+    else
+        gen_ins1(OP_CALL, reg64(REG_RAX));
+
+    gen_ins2(OP_ADD, reg64(REG_RSP), operand_imm(area, 8));
+}
+
+// every call site has to be 16 byte aligned, but values that are pushed while
+// an expression is evaluated move rsp, and only the register allocator decides
+// which of these pushes remain.
+// calls made while nothing is pushed use the outgoing argument area that is
+// reserved at the bottom of the frame, so the `sub rsp` and `add rsp` around
+// them are dropped. otherwise the stack arguments go below the pushed values,
+// and rsp is moved down far enough to realign it.
+// returns the size of the outgoing argument area
+static int align_calls(InstructionList *list) {
+
+    int outgoing = 0;
+    int depth = 0;
+
+    // indices of the `sub rsp` of calls that are still being set up,
+    // and the depth their arguments are relative to
+    size_t *open = NON_NULL(malloc((list->len + 1) * sizeof(size_t)));
+    int *open_depth = NON_NULL(malloc((list->len + 1) * sizeof(int)));
+    size_t open_count = 0;
+
+    for (size_t i=0; i < list->len; ++i) {
+        Instruction *ins = &list->items[i];
 
+        bool is_rsp = ins->dst.kind == OPERAND_REG && ins->dst.reg == REG_RSP;
+
+        if (ins->op == OP_PUSH) {
+            depth += 8;
+
+        } else if (ins->op == OP_POP) {
+            depth -= 8;
+
+        } else if (ins->op == OP_SUB && is_rsp) {
+            int area = ins->src.imm;
+
+            if (depth == 0 && area > outgoing)
+                outgoing = area;
+
+            ins->src.imm = depth == 0 ? 0 : ((depth + area + 15) & ~15) - depth;
+            depth += ins->src.imm;
+            open_depth[open_count] = depth;
+            open[open_count++] = i;
+
+        } else if (ins->op == OP_ADD && is_rsp) {
+            assert(open_count > 0);
+            ins->src.imm = list->items[open[--open_count]].src.imm;
+            depth -= ins->src.imm;
+
+        } else if (ins->op == OP_MOV && ins->dst.kind == OPERAND_MEM && ins->dst.reg == REG_RSP) {
+            // arguments that are still pushed lie between rsp and the argument area
+            assert(open_count > 0);
+            ins->dst.imm += depth - open_depth[open_count - 1];
         }
+    }
+
+    free(open);
+    free(open_depth);
 
+    for (size_t i=list->len; i-- > 0;) {
+        const Instruction *ins = &list->items[i];
+
+        if ((ins->op == OP_SUB || ins->op == OP_ADD) && ins->dst.kind == OPERAND_REG
+            && ins->dst.reg == REG_RSP && ins->src.imm == 0)
+            instructionlist_remove(list, i, 1);
     }
 
-    // this weird stuff has to be done in order for function pointers to work
-    gen_write("pop rax");
-    gen_write("call rax");
-    return sig->returntype;
+    return outgoing;
 }
 
-static void proc(const DeclProc *proc) {
-    const char *ident  = proc->ident.value;
-    const ProcSignature *sig = proc->type.signature;
+// index of the variable whose slot `op` refers to, -1 if it is no slot or not a variable
+NO_DISCARD static int slot_var(const Operand *op) {
+    for (size_t i=0; i < gen.vars_len; ++i) {
+        if (op->imm == -gen.vars[i])
+            return i;
+    }
+    return -1;
+}
 
-    if (proc->body == NULL) {
-        gen_write("extern %s", ident);
-        return;
+NO_DISCARD static bool is_frame_slot(const Operand *op) {
+    return op->kind == OPERAND_MEM && op->reg == REG_RBP && op->imm < 0;
+}
+
+// variables that have been moved into registers leave their slots unused,
+// so the remaining ones are packed again, largest first, like symboltable_build()
+// laid them out. frames holding anything but plain variables are left alone.
+// returns the new size of the slots
+static int compact_frame(InstructionList *list, int stack_size) {
+
+    bool *used = NON_NULL(calloc(gen.vars_len + 1, sizeof(bool)));
+    int *offsets = NON_NULL(calloc(gen.vars_len + 1, sizeof(int)));
+
+    for (size_t i=0; i < list->len; ++i) {
+        const Instruction *ins = &list->items[i];
+        const Operand *operands[] = { &ins->dst, &ins->src };
+
+        for (size_t j=0; j < ARRAY_LEN(operands); ++j) {
+            if (!is_frame_slot(operands[j])) continue;
+
+            int var = slot_var(operands[j]);
+            if (var == -1 || operands[j]->index != REG_INVALID) {
+                free(used);
+                free(offsets);
+                return stack_size;
+            }
+
+            used[var] = true;
+        }
+    }
+
+    int size = 0;
+
+    for (int align=8; align > 0; align /= 2) {
+        for (size_t i=0; i < gen.vars_len; ++i) {
+            if (!used[i] || gen.var_sizes[i] != align) continue;
+            size += align;
+            offsets[i] = size;
+        }
+    }
+
+    for (size_t i=0; i < list->len; ++i) {
+        Instruction *ins = &list->items[i];
+        Operand *operands[] = { &ins->dst, &ins->src };
+
+        for (size_t j=0; j < ARRAY_LEN(operands); ++j) {
+            if (is_frame_slot(operands[j]))
+                operands[j]->imm = -offsets[slot_var(operands[j])];
+        }
     }
 
-    gen_write("global %s", ident);
-    gen_write("%s:", ident);
-    gen_write("push rbp");
-    gen_write("mov rbp, rsp");
-    gen_write("sub rsp, %d", proc->stack_size);
+    free(used);
+    free(offsets);
+    return (size + 7) & ~7;
+}
+
+// procedures that neither call nor push anything keep their frame in the
+// 128 byte red zone below rsp, which signal handlers leave alone
+#define RED_ZONE_SIZE 128
+
+NO_DISCARD static bool is_leaf(const InstructionList *list) {
+    for (size_t i=0; i < list->len; ++i) {
+        if (list->items[i].op == OP_CALL || list->items[i].op == OP_PUSH)
+            return false;
+    }
+    return true;
+}
+
+// size of the `sub rsp` of the prologue
+// without a frame pointer, the slots start right below the return address, so
+// the frame has to cover the 8 bytes where rbp would have been saved as well
+NO_DISCARD static int frame_size(int stack_size, RegisterSet saved, int outgoing, bool leaf) {
+    int locals = stack_size + 8 * __builtin_popcount(saved);
+    int base   = compiler_ctx.omit_frame_pointer ? 8 : 0;
+
+    if (leaf && base + locals <= RED_ZONE_SIZE)
+        return 0;
+
+    // keeps rsp 16 byte aligned, as the return address and the old rbp realigned it after the call
+    return ((locals + outgoing + 15) & ~15) + base;
+}
+
+// callee-saved registers are preserved in slots below the locals, and the
+// outgoing arguments are below those, at the bottom of the frame
+static void prologue(int stack_size, RegisterSet saved, int frame) {
+    size_t i = 0;
+
+    if (!compiler_ctx.omit_frame_pointer) {
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_PUSH, .dst = reg64(REG_RBP) });
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_MOV, .dst = reg64(REG_RBP), .src = reg64(REG_RSP) });
+    }
+
+    if (frame > 0)
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_SUB, .dst = reg64(REG_RSP), .src = operand_imm(frame, 8) });
+
+    for (Register r=0; r < REG_COUNT; ++r) {
+        if (!(saved & (1u << r))) continue;
+        stack_size += 8;
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_MOV, .dst = slot(stack_size, TYPE_LONG), .src = reg64(r) });
+    }
+}
+
+// restores the callee-saved registers and releases the frame, inserted before
+// the instruction at index i. returns the index of that instruction afterwards
+static size_t teardown(size_t i, int stack_size, RegisterSet saved, int frame) {
+
+    for (Register r=0; r < REG_COUNT; ++r) {
+        if (!(saved & (1u << r))) continue;
+        stack_size += 8;
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_MOV, .dst = reg64(r), .src = slot(stack_size, TYPE_LONG) });
+    }
+
+    if (compiler_ctx.omit_frame_pointer) {
+        if (frame > 0)
+            instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_ADD, .dst = reg64(REG_RSP), .src = operand_imm(frame, 8) });
+    } else {
+        if (frame > 0)
+            instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_MOV, .dst = reg64(REG_RSP), .src = reg64(REG_RBP) });
+        instructionlist_insert(&gen.ins, i++, (Instruction) { .op = OP_POP, .dst = reg64(REG_RBP) });
+    }
+
+    return i;
+}
+
+// tail calls jump to another procedure, and leave the frame right before that
+static void epilogue(int stack_size, RegisterSet saved, int frame) {
+
+    for (size_t i=0; i < gen.ins.len; ++i) {
+        const Instruction *ins = &gen.ins.items[i];
+        if (ins->op == OP_JMP && ins->dst.kind == OPERAND_SYMBOL)
+            i = teardown(i, stack_size, saved, frame);
+    }
+
+    teardown(gen.ins.len, stack_size, saved, frame);
+    gen_ins0(OP_RET);
+}
+
+// rebases the slots from rbp onto rsp, for -fomit-frame-pointer
+// rbp would have pointed 8 bytes below the rsp at the entry of the procedure,
+// everything pushed or reserved since then lies in between.
+// code after a tail call is only reached by jumps from within the body, where
+// the whole frame is still reserved
+static void omit_frame_pointer(InstructionList *list, int frame) {
+
+    int below = 0;
+
+    for (size_t i=0; i < list->len; ++i) {
+        Instruction *ins = &list->items[i];
+        Operand *operands[] = { &ins->dst, &ins->src };
+
+        for (size_t j=0; j < ARRAY_LEN(operands); ++j) {
+            Operand *op = operands[j];
+            if (op->kind != OPERAND_MEM || op->reg != REG_RBP) continue;
+
+            op->reg  = REG_RSP;
+            op->imm += below - 8;
+        }
+
+        bool is_rsp = ins->dst.kind == OPERAND_REG && ins->dst.reg == REG_RSP;
+
+        switch (ins->op) {
+            case OP_PUSH: below += 8; break;
+            case OP_POP:  below -= 8; break;
+            case OP_SUB:  if (is_rsp) below += ins->src.imm; break;
+            case OP_ADD:  if (is_rsp) below -= ins->src.imm; break;
+            case OP_JMP:  if (ins->dst.kind == OPERAND_SYMBOL) below = frame; break;
+            default: NOP() break;
+        }
+    }
+
+}
+
+static void escaping_node(AstNode *node, UNUSED int _depth, void *args);
+
+// whether the body may take the address of a slot of the frame, either in
+// itself, or in one of the bodies inlined into it
+NO_DISCARD static bool escapes(AstNode *body) {
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_UNARYOP, escaping_node, NULL },
+        { ASTNODE_ARRAY,   escaping_node, NULL },
+        { ASTNODE_CALL,    escaping_node, NULL },
+    };
+
+    bool escaping = false;
+    parser_dispatch_ast(body, table, ARRAY_LEN(table), &escaping);
+    return escaping;
+}
+
+static void escaping_node(AstNode *node, UNUSED int _depth, void *args) {
+    bool *escaping = args;
+
+    switch (node->kind) {
+        case ASTNODE_UNARYOP: *escaping |= node->expr_unaryop.kind == UNARYOP_ADDROF; break;
+        case ASTNODE_ARRAY:   *escaping = true; break;
+        case ASTNODE_CALL:
+            if (node->expr_call.inlined != NULL)
+                *escaping |= escapes(node->expr_call.inlined->stmt_proc.body);
+            break;
+        default: NOP() break;
+    }
+}
+
+// `return f(...)` at -O1 does not need the frame of the caller anymore.
+// self-recursive calls store their arguments to the parameter slots, and jump
+// back to the start of the body. calls of other procedures jump to them, if all
+// of their arguments are passed in registers and the result is returned as is.
+// neither happens if a pointer into the frame may be among the arguments, or
+// if the return is part of an inlined body
+NO_DISCARD static bool tail_call(AstNode *expr) {
+
+    if (!pass_enabled(PASS_TAIL_CALLS) || gen.inline_label != -1 || gen.escapes) return false;
+    if (expr->kind != ASTNODE_CALL) return false;
+
+    const ExprCall *tail = &expr->expr_call;
+    if (tail->inlined != NULL || !is_direct_call(tail->callee)) return false;
+
+    const ProcSignature *sig = tail->callee->type.signature;
+    const AstNodeList *list = &tail->args;
+
+    if (!strcmp(tail->callee->expr_literal.op.value, gen.proc->ident.value)) {
+
+        push_args(list);
+
+        for (size_t i=0; i < list->size; ++i) {
+            const Param *param = &sig->params[i];
+            pop_arg(list->items[i], REG_RAX, param->type.kind);
+            gen_ins(OP_MOV, slot(param->offset, param->type.kind), reg(REG_RAX, param->type.kind), param->ident);
+        }
+
+        gen_ins1(OP_JMP, label(LABEL_ENTRY, -1));
+        gen.tail_recursive = true;
+        return true;
+    }
+
+    if (list->size > 6 || sig->returntype.kind != gen.proc->type.signature->returntype.kind)
+        return false;
+
+    call(tail, true);
+    return true;
+}
+
+// stores the parameters to their slots
+static void params(const ProcSignature *sig) {
 
     // offset starts at 16 because the old rbp and return address are
     // already on the stack
@@ -296,275 +653,747 @@ static void proc(const DeclProc *proc) {
     for (size_t i=0; i < sig->params_count; ++i) {
 
         const Param *param = &sig->params[i];
-        const char *reg = abi_register_str(i+1, param->type.kind);
+        TypeKind type = param->type.kind;
+        Register abi = abi_register(i+1);
+        gen_var(param->offset, type);
 
-        if (reg == NULL) {
-            const char *rax = subregister(REG_RAX, param->type.kind);
-            gen_write("mov %s, [rbp+%d]", rax, offset);
-            gen_write("mov [rbp-%d], %s", param->offset, rax);
+        if (abi == REG_INVALID) {
+            gen_ins2(OP_MOV, reg(REG_RAX, type), operand_mem(REG_RBP, offset, type_primitive_size(type)));
+            gen_ins2(OP_MOV, slot(param->offset, type), reg(REG_RAX, type));
             offset += 8;
         } else {
-            gen_write("mov [rbp-%d], %s", param->offset, reg);
+            gen_ins2(OP_MOV, slot(param->offset, type), reg(abi, type));
         }
 
     }
 
-    emit(proc->body);
+}
+
+static const IrProc *ssa_proc(const DeclProc *proc);
+static void ssa_body(const IrProc *ir);
+
+static void proc(const DeclProc *proc) {
+    const char *ident  = proc->ident.value;
+    const ProcSignature *sig = proc->type.signature;
+
+    if (proc->body == NULL) {
+        emitter_extern(&gen.buf_text, ident);
+        return;
+    }
+
+    emitter_global(&gen.buf_text, ident);
+    emitter_proc_label(&gen.buf_text, ident);
+    gen.vars_len     = 0;
+    gen.frame_base   = 0;
+    gen.frame_size   = proc->stack_size;
+    gen.frame_extent = proc->stack_size;
+    gen.inline_label = -1;
+    gen.proc           = proc;
+    gen.escapes        = escapes(proc->body);
+    gen.tail_recursive = false;
+
+    size_t entry = 0;
+
+    if (gen.ir != NULL) {
+        // the IR reads the parameters it needs by itself
+        ssa_body(ssa_proc(proc));
+    } else {
+        params(sig);
+        entry = gen.ins.len;
+        emit(proc->body);
+    }
+
+    gen_label(LABEL_RETURN, -1);
 
-    gen_write(".return:");
-    gen_write("mov rsp, rbp");
-    gen_write("pop rbp");
-    gen_write("ret");
+    // self-recursive tail calls jump back to right after the parameters have been stored
+    if (gen.tail_recursive)
+        instructionlist_insert(&gen.ins, entry, (Instruction) { .op = OP_LABEL, .dst = label(LABEL_ENTRY, -1) });
+
+    // the prologue and epilogue depend on the registers in use, so they are
+    // only added once the body has been optimized
+    RegisterSet saved = 0;
+    int stack_size = gen.frame_extent;
+
+    if (pass_enabled(PASS_PEEPHOLE)) {
+        pass_start(PASS_PEEPHOLE, NULL);
+        peephole(&gen.ins);
+        pass_stop(PASS_PEEPHOLE, NULL);
+    }
+
+    if (pass_enabled(PASS_REGALLOC)) {
+        pass_start(PASS_REGALLOC, NULL);
+        saved = regalloc(&gen.ins, gen.vars, gen.vars_len);
+        stack_size = compact_frame(&gen.ins, stack_size);
+        pass_stop(PASS_REGALLOC, NULL);
+    }
+
+    // registers that replaced slots leave moves behind that can be removed now
+    if (pass_enabled(PASS_PEEPHOLE) && pass_enabled(PASS_REGALLOC)) {
+        pass_start(PASS_PEEPHOLE, NULL);
+        peephole(&gen.ins);
+        pass_stop(PASS_PEEPHOLE, NULL);
+    }
+
+    int outgoing = align_calls(&gen.ins);
+    int frame = frame_size(stack_size, saved, outgoing, is_leaf(&gen.ins));
+
+    prologue(stack_size, saved, frame);
+    epilogue(stack_size, saved, frame);
+
+    if (compiler_ctx.omit_frame_pointer)
+        omit_frame_pointer(&gen.ins, frame);
+
+    emitter_instructionlist(&gen.buf_text, &gen.ins);
+    instructionlist_clear(&gen.ins);
 
 }
 
 static void return_(const StmtReturn *ret) {
+    if (ret->expr != NULL && tail_call(ret->expr))
+        return;
+
     if (ret->expr != NULL)
         emit(ret->expr);
 
-    gen_write("jmp .return");
+    if (gen.inline_label != -1)
+        gen_ins1(OP_JMP, label(LABEL_INLINE, gen.inline_label));
+    else
+        gen_ins1(OP_JMP, label(LABEL_RETURN, -1));
 }
 
 static void block(const Block *block) {
-    Hashtable *old_scope = gen.scope;
-    gen.scope = block->symboltable;
-
     AstNodeList list = block->stmts;
     for (size_t i=0; i < list.size; ++i)
         emit(list.items[i]);
-
-    gen.scope = old_scope;
 }
 
-static Type unaryop_addr(const ExprUnaryOp *unaryop) {
+static void unaryop_addr(const ExprUnaryOp *unaryop) {
 
     switch (unaryop->kind) {
 
         case UNARYOP_DEREF: {
             // not using emit_addr(), as the operand must already be a pointer
-            return emit(unaryop->node);
+            emit(unaryop->node);
             // address is already in rax, do nothing.
             break;
         }
 
-        default: PANIC("unknown operation");
+        default: PANIC("unknown operation");
+    }
+
+}
+
+
+// sign extends an index to 64 bit, so it can be added to a pointer
+static void extend_index(Register r, TypeKind type) {
+    switch (type_primitive_size(type)) {
+        case 1:  gen_ins2(OP_MOVSX,  reg64(r), reg(r, type)); break;
+        case 4:  gen_ins2(OP_MOVSXD, reg64(r), reg(r, type)); break;
+        default: NOP() break;
+    }
+}
+
+// matches `ptr + i`, `i + ptr`, `ptr + (i + c)` and `ptr - c`, whose element size
+// can be scaled by the address itself, and splits it into its parts
+// `index` is NULL if the offset is constant
+static bool scaled_address(AstNode *node, AstNode **base, AstNode **index, int *scale, int64_t *disp) {
+
+    while (node->kind == ASTNODE_GROUPING)
+        node = node->expr_grouping.expr;
+
+    if (node->kind != ASTNODE_BINOP) return false;
+    const ExprBinOp *binop = &node->expr_binop;
+
+    if (binop->kind != BINOP_ADD && binop->kind != BINOP_SUB) return false;
+
+    *base  = binop->lhs;
+    *index = binop->rhs;
+    *disp  = 0;
+
+    if ((*base)->type.kind != TYPE_POINTER && binop->kind == BINOP_ADD) {
+        *base  = binop->rhs;
+        *index = binop->lhs;
+    }
+
+    if ((*base)->type.kind != TYPE_POINTER || (*index)->type.kind == TYPE_POINTER) return false;
+
+    *scale = type_primitive_size((*base)->type.pointee->kind);
+    if (*scale != 1 && *scale != 2 && *scale != 4 && *scale != 8) return false;
+
+    if (is_number(*index)) {
+        int64_t offset = number_value(*index) * *scale;
+        *disp  = binop->kind == BINOP_SUB ? -offset : offset;
+        *index = NULL;
+        return *disp == (int32_t) *disp;
+    }
+
+    // subtracting a variable index would need an extra negation
+    if (binop->kind == BINOP_SUB) return false;
+
+    const ExprBinOp *inner = &(*index)->expr_binop;
+    if ((*index)->kind == ASTNODE_BINOP && inner->kind == BINOP_ADD && is_number(inner->rhs)) {
+        *disp  = number_value(inner->rhs) * *scale;
+        *index = inner->lhs;
+        if (*disp != (int32_t) *disp) return false;
+    }
+
+    return true;
+}
+
+// evaluates the pointer `ptr` and returns the memory operand of `size` bytes it points to
+// at -O1, pointer arithmetic is folded into the operand as [base + index*scale + disp],
+// with the base in rax and the index in rdi, instead of computing the address up front
+static Operand pointee(AstNode *ptr, int size) {
+
+    AstNode *base, *index;
+    int scale;
+    int64_t disp;
+
+    if (!pass_enabled(PASS_ADDRESSING) || !scaled_address(ptr, &base, &index, &scale, &disp)) {
+        emit(ptr);
+        return operand_mem(REG_RAX, 0, size);
+    }
+
+    if (index == NULL) {
+        emit(base);
+        return operand_mem(REG_RAX, disp, size);
+    }
+
+    emit(index);
+    gen_ins1(OP_PUSH, reg64(REG_RAX));
+    emit(base);
+    gen_ins1(OP_POP, reg64(REG_RDI));
+    extend_index(REG_RDI, index->type.kind);
+
+    return operand_mem_index(REG_RAX, REG_RDI, scale, disp, size);
+}
+
+// sets rax to 1 if the condition code of the last comparison holds, to 0 otherwise
+static void setcc(Opcode op, TypeKind type) {
+    gen_ins1(op, reg(REG_RAX, TYPE_CHAR));
+
+    if (type_primitive_size(type) > 1)
+        gen_ins2(OP_MOVZX, reg(REG_RAX, TYPE_INT), reg(REG_RAX, TYPE_CHAR));
+}
+
+static void unaryop(const ExprUnaryOp *unaryop, Type type) {
+
+    switch (unaryop->kind) {
+
+        case UNARYOP_NEG: {
+            emit(unaryop->node);
+            gen_ins2(OP_CMP, reg(REG_RAX, type.kind), imm(0, type.kind));
+            setcc(OP_SETE, type.kind);
+        } break;
+
+        case UNARYOP_MINUS: {
+            emit(unaryop->node);
+            gen_ins2(OP_IMUL, reg(REG_RAX, type.kind), imm(-1, type.kind));
+        } break;
+
+        case UNARYOP_DEREF: {
+            Operand mem = pointee(unaryop->node, type_primitive_size(type.kind));
+            gen_ins2(OP_MOV, reg(REG_RAX, type.kind), mem);
+        } break;
+
+        case UNARYOP_ADDROF: {
+            emit_addr(unaryop->node);
+        } break;
+
+        default: PANIC("unknown operation");
+    }
+
+}
+
+// multiplies the integer operand of pointer arithmetic by the size of the pointee
+static void scale_index(Operand index, int size) {
+    if (pass_enabled(PASS_CONST_ARITH) && is_power_of_two(size))
+        gen_ins2(OP_SHL, index, shift_count(__builtin_ctz(size)));
+    else
+        gen_ins2(OP_IMUL, index, operand_imm(size, index.size));
+}
+
+// evaluates the LHS into rax and the RHS into rdi
+static void binop_operands(const ExprBinOp *binop, Operand *rax, Operand *rdi) {
+
+    Type rhs = binop->rhs->type;
+    Type lhs = binop->lhs->type;
+
+    emit(binop->rhs);
+    *rdi = reg(REG_RDI, rhs.kind);
+    gen_ins1(OP_PUSH, reg64(REG_RAX));
+
+    emit(binop->lhs);
+    *rax = reg(REG_RAX, lhs.kind);
+    gen_ins1(OP_POP, reg64(REG_RDI));
+
+    // TODO: maybe make this just an ast expansion
+
+    // overload plus operator for pointer arithmetic
+    // multiply the index with the size of the type pointed to by the pointer
+    // the index is added to the full pointer, so negative indices have to be sign extended
+    if (lhs.kind == TYPE_POINTER && rhs.kind != TYPE_POINTER) {
+        extend_index(REG_RDI, rhs.kind);
+        *rdi = reg64(REG_RDI);
+        scale_index(*rdi, type_primitive_size(lhs.pointee->kind));
+
+    } else if (lhs.kind != TYPE_POINTER && rhs.kind == TYPE_POINTER) {
+        extend_index(REG_RAX, lhs.kind);
+        *rax = reg64(REG_RAX);
+        scale_index(*rax, type_primitive_size(rhs.pointee->kind));
+    }
+
+}
+
+// multiplies `r` by a constant with shifts and lea where possible
+// rdi is clobbered
+static void mul_const(Operand r, int64_t c) {
+
+    Operand rdi = operand_reg(REG_RDI, r.size);
+
+    if (c == 0) {
+        gen_ins2(OP_MOV, r, operand_imm(0, r.size));
+        return;
+    }
+
+    if (c < INT32_MIN || c > INT32_MAX) {
+        // does not fit into an immediate
+        gen_ins2(OP_MOV, rdi, operand_imm(c, r.size));
+        gen_ins2(OP_IMUL, r, rdi);
+        return;
+    }
+
+    uint64_t abs = c < 0 ? -(uint64_t) c : (uint64_t) c;
+    int zeros = __builtin_ctzll(abs);
+    uint64_t odd = abs >> zeros;
+
+    if (odd == 1) {
+        if (zeros > 0) gen_ins2(OP_SHL, r, shift_count(zeros));
+
+    } else if (odd == 3 || odd == 5 || odd == 9) {
+        // x*3 = [x + x*2], x*5 = [x + x*4], x*9 = [x + x*8]
+        Operand addr = operand_mem_index(r.reg, r.reg, odd - 1, 0, r.size);
+        gen_ins2(OP_LEA, r, addr);
+        if (zeros > 0) gen_ins2(OP_SHL, r, shift_count(zeros));
+
+    } else if (is_power_of_two(abs - 1)) {
+        gen_ins2(OP_MOV, rdi, r);
+        gen_ins2(OP_SHL, r, shift_count(__builtin_ctzll(abs - 1)));
+        gen_ins2(OP_ADD, r, rdi);
+
+    } else if (is_power_of_two(abs + 1)) {
+        gen_ins2(OP_MOV, rdi, r);
+        gen_ins2(OP_SHL, r, shift_count(__builtin_ctzll(abs + 1)));
+        gen_ins2(OP_SUB, r, rdi);
+
+    } else {
+        gen_ins2(OP_IMUL, r, operand_imm(c, r.size));
+        return;
+    }
+
+    if (c < 0)
+        gen_ins1(OP_NEG, r);
+
+}
+
+typedef struct {
+    int64_t multiplier;
+    int shift;
+} Magic;
+
+// magic number for signed division by d, which must not be a power of two
+// see Hacker's Delight, chapter 10-4
+NO_DISCARD static Magic magic_signed(int64_t d, int bits) {
+    uint64_t mask = bits == 64 ? UINT64_MAX : (UINT64_C(1) << bits) - 1;
+    uint64_t two  = UINT64_C(1) << (bits - 1);
+
+    uint64_t ad  = (d < 0 ? -(uint64_t) d : (uint64_t) d) & mask;
+    uint64_t t   = two + (((uint64_t) d & mask) >> (bits - 1));
+    uint64_t anc = t - 1 - t % ad;
+
+    uint64_t q1 = two / anc, r1 = two - q1 * anc;
+    uint64_t q2 = two / ad,  r2 = two - q2 * ad;
+    uint64_t delta = 0;
+    int p = bits - 1;
+
+    do {
+        p++;
+
+        q1 = (2 * q1) & mask;
+        r1 = (2 * r1) & mask;
+        if (r1 >= anc) {
+            q1 = (q1 + 1) & mask;
+            r1 = (r1 - anc) & mask;
+        }
+
+        q2 = (2 * q2) & mask;
+        r2 = (2 * r2) & mask;
+        if (r2 >= ad) {
+            q2 = (q2 + 1) & mask;
+            r2 = (r2 - ad) & mask;
+        }
+
+        delta = (ad - r2) & mask;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    uint64_t m = (q2 + 1) & mask;
+    if (d < 0) m = -m & mask;
+
+    return (Magic) {
+        .multiplier = bits == 64 ? (int64_t) m : (int32_t) m,
+        .shift      = p - bits,
+    };
+}
+
+// divides rax by a constant, rounding towards zero like idiv
+// rdx and rdi are clobbered
+static void div_const(int size, int64_t d) {
+
+    int bits = size * 8;
+    Operand rax = operand_reg(REG_RAX, size);
+    Operand rdx = operand_reg(REG_RDX, size);
+    Operand rdi = operand_reg(REG_RDI, size);
+
+    if (d == 1) return;
+
+    if (d == -1) {
+        gen_ins1(OP_NEG, rax);
+        return;
+    }
+
+    uint64_t abs = d < 0 ? -(uint64_t) d : (uint64_t) d;
+
+    if (is_power_of_two(abs)) {
+        // negative dividends are biased by abs-1, so the shift rounds towards zero
+        int k = __builtin_ctzll(abs);
+        gen_ins2(OP_MOV, rdi, rax);
+        gen_ins2(OP_SAR, rdi, shift_count(bits - 1));
+        gen_ins2(OP_SHR, rdi, shift_count(bits - k));
+        gen_ins2(OP_ADD, rax, rdi);
+        gen_ins2(OP_SAR, rax, shift_count(k));
+
+        if (d < 0)
+            gen_ins1(OP_NEG, rax);
+        return;
+    }
+
+    // the quotient is the high half of the product with the magic number,
+    // plus one if it is negative
+    Magic magic = magic_signed(d, bits);
+
+    gen_ins2(OP_MOV, rdi, rax);
+    gen_ins2(OP_MOV, rax, operand_imm(magic.multiplier, size));
+    gen_ins1(OP_IMUL, rdi);
+
+    if (d > 0 && magic.multiplier < 0) gen_ins2(OP_ADD, rdx, rdi);
+    if (d < 0 && magic.multiplier > 0) gen_ins2(OP_SUB, rdx, rdi);
+    if (magic.shift > 0) gen_ins2(OP_SAR, rdx, shift_count(magic.shift));
+
+    gen_ins2(OP_MOV, rax, rdx);
+    gen_ins2(OP_SHR, rax, shift_count(bits - 1));
+    gen_ins2(OP_ADD, rax, rdx);
+
+}
+
+// multiplication and division by a constant operand are strength reduced
+// returns false if the operation has to be done in general
+static bool binop_const(const ExprBinOp *binop, TypeKind type) {
+
+    const AstNode *lhs = binop->lhs, *rhs = binop->rhs;
+
+    if (!pass_enabled(PASS_CONST_ARITH)) return false;
+
+    // a constant index of pointer arithmetic is scaled right away, as incremented pointers are common in loops
+    bool additive = binop->kind == BINOP_ADD || binop->kind == BINOP_SUB;
+    if (type == TYPE_POINTER && additive && lhs->type.kind == TYPE_POINTER && is_number(rhs)) {
+        int64_t offset = number_value(rhs) * type_primitive_size(lhs->type.pointee->kind);
+        if (offset < INT32_MIN || offset > INT32_MAX) return false;
+
+        emit(binop->lhs);
+        gen_ins2(binop->kind == BINOP_ADD ? OP_ADD : OP_SUB, reg64(REG_RAX), operand_imm(offset, 8));
+        return true;
+    }
+
+    if (type != TYPE_CHAR && type != TYPE_INT && type != TYPE_LONG) return false;
+    if (lhs->type.kind == TYPE_POINTER || rhs->type.kind == TYPE_POINTER) return false;
+
+    // char is computed in 32 bit, its low byte is the same
+    int size = type == TYPE_CHAR ? 4 : type_primitive_size(type);
+
+    switch (binop->kind) {
+        case BINOP_MUL: {
+            // multiplication is commutative, the constant may be on either side
+            const AstNode *constant = is_number(rhs) ? rhs : lhs;
+            const AstNode *operand  = is_number(rhs) ? lhs : rhs;
+            if (!is_number(constant)) return false;
+
+            emit((AstNode *) operand);
+            mul_const(operand_reg(REG_RAX, size), number_value(constant));
+        } return true;
+
+        case BINOP_DIV: {
+            if (!is_number(rhs) || number_value(rhs) == 0) return false;
+            int64_t d = number_value(rhs);
+
+            emit(binop->lhs);
+            if (type == TYPE_CHAR)
+                gen_ins2(OP_MOVSX, reg(REG_RAX, TYPE_INT), reg(REG_RAX, TYPE_CHAR));
+            div_const(size, d);
+        } return true;
+
+        default:
+            return false;
+    }
+
+}
+
+// sign extends the dividend in rax into rdx:rax, for idiv
+static void sign_extend_dividend(TypeKind type) {
+    switch (type_primitive_size(type)) {
+        case 1:
+            // idiv r8 divides ax, so both operands are widened to 32 bit instead
+            gen_ins2(OP_MOVSX, reg(REG_RAX, TYPE_INT), reg(REG_RAX, TYPE_CHAR));
+            gen_ins2(OP_MOVSX, reg(REG_RDI, TYPE_INT), reg(REG_RDI, TYPE_CHAR));
+            gen_ins0(OP_CDQ);
+            break;
+        case 4:
+            gen_ins0(OP_CDQ);
+            break;
+        default:
+            gen_ins0(OP_CQO);
+            break;
+    }
+}
+
+NO_DISCARD static bool is_comparison(BinOpKind kind) {
+    switch (kind) {
+        case BINOP_EQ:
+        case BINOP_NEQ:
+        case BINOP_GT:
+        case BINOP_GT_EQ:
+        case BINOP_LT:
+        case BINOP_LT_EQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// conditional jump that is taken if the comparison evaluates to `when`
+NO_DISCARD static Opcode comparison_jump(BinOpKind kind, bool when) {
+    switch (kind) {
+        case BINOP_EQ:    return when ? OP_JE  : OP_JNE;
+        case BINOP_NEQ:   return when ? OP_JNE : OP_JE;
+        case BINOP_GT:    return when ? OP_JG  : OP_JLE;
+        case BINOP_GT_EQ: return when ? OP_JGE : OP_JL;
+        case BINOP_LT:    return when ? OP_JL  : OP_JGE;
+        case BINOP_LT_EQ: return when ? OP_JLE : OP_JG;
+        default: PANIC("not a comparison");
     }
+}
 
-    UNREACHABLE();
+// jumps to `target` if the condition evaluates to `when`, and falls through otherwise
+// comparisons branch on the flags directly, and logical operators short-circuit,
+// so a condition is only materialized as a value if there is no other way
+static void branch(AstNode *cond, bool when, Operand target) {
 
-}
+    switch (cond->kind) {
 
-static Type unaryop(const ExprUnaryOp *unaryop) {
+        case ASTNODE_LITERAL:
+            if (cond->expr_literal.kind != LITERAL_NUMBER) break;
 
-    switch (unaryop->kind) {
+            // constant conditions either always or never jump
+            if ((cond->expr_literal.op.number != 0) == when)
+                gen_ins1(OP_JMP, target);
+            return;
 
-        case UNARYOP_NEG: {
-            Type ty = emit(unaryop->node);
-            gen_write("cmp %s, 0", subregister(REG_RAX, ty.kind));
-            gen_write("sete %s", subregister(REG_RAX, ty.kind));
-            return ty;
-        } break;
+        case ASTNODE_GROUPING:
+            branch(cond->expr_grouping.expr, when, target);
+            return;
+
+        case ASTNODE_UNARYOP:
+            if (cond->expr_unaryop.kind != UNARYOP_NEG) break;
+            branch(cond->expr_unaryop.node, !when, target);
+            return;
+
+        case ASTNODE_BINOP: {
+            const ExprBinOp *binop = &cond->expr_binop;
+
+            if (is_comparison(binop->kind)) {
+                Operand rax, rdi;
+                binop_operands(binop, &rax, &rdi);
+                gen_ins2(OP_CMP, rax, rdi);
+                gen_ins1(comparison_jump(binop->kind, when), target);
+                return;
+            }
 
-        case UNARYOP_MINUS: {
-            Type ty = emit(unaryop->node);
-            gen_write("imul %s, -1", subregister(REG_RAX, ty.kind));
-            return ty;
-        } break;
+            if (binop->kind != BINOP_LOG_AND && binop->kind != BINOP_LOG_OR) break;
 
-        case UNARYOP_DEREF: {
-            Type ty = emit(unaryop->node);
-            gen_write("mov %s, [rax]", subregister(REG_RAX, ty.kind));
-            return *ty.pointee;
-        } break;
+            // `a && b` is decided as soon as `a` is false, `a || b` as soon as `a` is true
+            bool decided = binop->kind == BINOP_LOG_OR;
 
-        case UNARYOP_ADDROF: {
-            return emit_addr(unaryop->node);
-        } break;
+            if (when == decided) {
+                branch(binop->lhs, when, target);
+                branch(binop->rhs, when, target);
+            } else {
+                int lbl = gen.label_count++;
+                branch(binop->lhs, decided, label(LABEL_SKIP, lbl));
+                branch(binop->rhs, when, target);
+                gen_label(LABEL_SKIP, lbl);
+            }
+        } return;
 
-        default: PANIC("unknown operation");
+        default: NOP() break;
     }
 
-    UNREACHABLE();
+    // any other value is true if it is not zero
+    emit(cond);
+    TypeKind type = cond->type.kind;
+    gen_ins2(OP_CMP, reg(REG_RAX, type), imm(0, type));
+    gen_ins1(when ? OP_JNE : OP_JE, target);
 
 }
 
-static Type binop(const ExprBinOp *binop) {
-
-    Type rhs = emit(binop->rhs);
-    const char *rdi = subregister(REG_RDI, rhs.kind);
-    gen_write("push rax");
+// materializes the result of a short-circuiting operator as either 1 or 0
+static void logical(AstNode *node) {
 
-    Type lhs = emit(binop->lhs);
-    const char *rax = subregister(REG_RAX, lhs.kind);
-    gen_write("pop rdi");
+    TypeKind type = node->type.kind;
+    int lbl = gen.label_count++;
 
-    const char *al = subregister(REG_RAX, TYPE_CHAR);
+    branch(node, false, label(LABEL_ELSE, lbl));
+    gen_ins2(OP_MOV, reg(REG_RAX, type), imm(1, type));
+    gen_ins1(OP_JMP, label(LABEL_END, lbl));
 
-    // LHS: rax
-    // RHS: rdi
+    gen_label(LABEL_ELSE, lbl);
+    gen_ins2(OP_MOV, reg(REG_RAX, type), imm(0, type));
+    gen_label(LABEL_END, lbl);
 
-    // TODO: maybe make this just an ast expansion
+}
 
-    // overload plus operator for pointer arithmetic
-    // multiply the index with the size of the type pointed to by the pointer
-    if (lhs.kind == TYPE_POINTER && rhs.kind != TYPE_POINTER) {
-        gen_write("imul %s, %d", subregister(REG_RDI, rhs.kind), type_primitive_size(lhs.pointee->kind));
+static void binop(AstNode *node) {
 
-    } else if (lhs.kind != TYPE_POINTER && rhs.kind == TYPE_POINTER) {
-        gen_write("imul %s, %d", subregister(REG_RAX, lhs.kind), type_primitive_size(rhs.pointee->kind));
+    const ExprBinOp *binop = &node->expr_binop;
+    TypeKind type = node->type.kind;
 
-    } else if (rhs.kind != lhs.kind) {
-        diagnostic_loc(
-            DIAG_ERROR,
-            &binop->op,
-            "Invalid types (%s, %s)",
-            stringify_typekind(rhs.kind),
-            stringify_typekind(lhs.kind)
-        );
-        exit(EXIT_FAILURE);
+    if (binop->kind == BINOP_LOG_AND || binop->kind == BINOP_LOG_OR) {
+        logical(node);
+        return;
     }
 
+    if (binop_const(binop, type))
+        return;
+
+    // LHS: rax
+    // RHS: rdi
+    Operand rax, rdi;
+    binop_operands(binop, &rax, &rdi);
+
     switch (binop->kind) {
         case BINOP_ADD:
-            gen_write("add %s, %s", rax, rdi);
+            gen_ins2(OP_ADD, rax, rdi);
             break;
 
         case BINOP_SUB:
-            gen_write("sub %s, %s", rax, rdi);
+            gen_ins2(OP_SUB, rax, rdi);
             break;
 
         case BINOP_MUL:
-            gen_write("imul %s", rdi);
+            gen_ins1(OP_IMUL, rdi);
             break;
 
         case BINOP_DIV:
-            gen_write("idiv %s", rdi);
+            sign_extend_dividend(type);
+            // chars are divided in 32 bit
+            gen_ins1(OP_IDIV, type_primitive_size(type) == 1 ? reg(REG_RDI, TYPE_INT) : rdi);
             break;
 
         case BINOP_EQ:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("sete %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETE, type);
             break;
 
         case BINOP_NEQ:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("setne %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETNE, type);
             break;
 
         case BINOP_GT:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("setg %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETG, type);
             break;
 
         case BINOP_GT_EQ:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("setge %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETGE, type);
             break;
 
         case BINOP_LT:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("setl %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETL, type);
             break;
 
         case BINOP_LT_EQ:
-            gen_write("cmp %s, %s", rax, rdi);
-            gen_write("setle %s", al);
+            gen_ins2(OP_CMP, rax, rdi);
+            setcc(OP_SETLE, type);
             break;
 
         case BINOP_BITWISE_OR:
-            gen_write("or %s, %s", rax, rdi);
+            gen_ins2(OP_OR, rax, rdi);
             break;
 
         case BINOP_BITWISE_AND:
-            gen_write("and %s, %s", rax, rdi);
+            gen_ins2(OP_AND, rax, rdi);
             break;
 
         case BINOP_LOG_OR:
-            // do a bitwise or, then convert the resulting number to either 1 or 0
-            gen_write("or %s, %s", rax, rdi);
-            gen_write("cmp %s, 0", rax);
-            gen_write("setne %s", al);
-            break;
-
         case BINOP_LOG_AND:
-            // do a bitwise and, then convert the resulting number to either 1 or 0
-            gen_write("and %s, %s", rax, rdi);
-            gen_write("cmp %s, 0", rax);
-            gen_write("setne %s", al);
-            break;
+            UNREACHABLE();
     }
 
-    // if pointer arithmetic was done, binop has to evaluate to a pointer
-    return rhs.kind == TYPE_POINTER ? rhs : lhs;
-
 }
 
-static Type literal_ident(const ExprLiteral *literal, const char *str, bool addr) {
-
-    Symbol *sym = symboltable_lookup(gen.scope, str);
+static void literal_ident(const ExprLiteral *literal, const char *str, bool addr) {
 
-    if (sym == NULL) {
-        diagnostic_loc(DIAG_ERROR, &literal->op, "Symbol `%s` does not exist in the current scope", str);
-        exit(EXIT_FAILURE);
-    }
+    // identifiers have already been bound by symboltable_build()
+    Symbol *sym = NON_NULL(literal->sym);
 
     switch (sym->kind) {
-        case SYMBOL_TABLE:
-            diagnostic_loc(DIAG_ERROR, &literal->op, "Symbol `%s` is a type, not a variable", str);
-            exit(EXIT_FAILURE);
-            break;
-
         case SYMBOL_PARAMETER:
         case SYMBOL_VARIABLE:
-            if (addr) {
-                gen_write("lea rax, [rbp-%d]", sym->offset);
-                return (Type) { .kind = TYPE_POINTER, .pointee = &sym->type };
-
-            } else {
-                gen_write("mov %s, [rbp-%d]", subregister(REG_RAX, sym->type.kind), sym->offset);
-            }
+            if (addr)
+                gen_ins2(OP_LEA, reg64(REG_RAX), slot(sym->offset, TYPE_LONG));
+            else
+                gen_ins2(OP_MOV, reg(REG_RAX, sym->type.kind), slot(sym->offset, sym->type.kind));
             break;
 
         case SYMBOL_PROCEDURE:
-            gen_write("mov rax, %s", str);
+            gen_ins2(OP_MOV, reg64(REG_RAX), operand_symbol(str));
             break;
 
+        case SYMBOL_TABLE:
         case SYMBOL_INVALID:
         case SYMBOL_NONE:
             PANIC("invalid symbol");
     }
 
-    return sym->type;
 }
 
-static Type literal_addr(const ExprLiteral *literal) {
+static void literal_addr(const ExprLiteral *literal) {
 
     const char *str = literal->op.value;
 
     switch (literal->kind) {
         case LITERAL_IDENT:
-            return literal_ident(literal, str, true);
+            literal_ident(literal, str, true);
             break;
         case LITERAL_STRING:
         case LITERAL_NUMBER:
             PANIC("unknown operation");
     }
 
-    UNREACHABLE();
-
-}
-
-static TypeKind type_from_token_literal(NumberLiteralType type) {
-    switch (type) {
-        case NUMBER_CHAR: return TYPE_CHAR;
-        case NUMBER_LONG: return TYPE_LONG;
-        case NUMBER_ANY:
-        case NUMBER_INT:  return TYPE_INT;
-    }
-    UNREACHABLE();
 }
 
-static Type literal(const ExprLiteral *literal) {
+static void literal(const ExprLiteral *literal, Type type) {
 
     const char *str = literal->op.value;
     int64_t num = literal->op.number;
@@ -572,156 +1401,401 @@ static Type literal(const ExprLiteral *literal) {
     switch (literal->kind) {
         case LITERAL_STRING: {
 
-            gen_write_data("string_%d:", gen.data_count);
-            gen_write_data("db \"%s\", 0", str);
-
-            gen_write("mov rax, string_%d", gen.data_count);
+            emitter_string(&gen.buf_data, gen.data_count, str);
+            gen_ins2(OP_MOV, reg64(REG_RAX), label(LABEL_STRING, gen.data_count));
             gen.data_count++;
-
-            // TODO: pointee info
-            return (Type) { .kind = TYPE_POINTER };
         } break;
 
         case LITERAL_NUMBER: {
-
-            TypeKind type = type_from_token_literal(literal->op.number_type);
-            gen_write("mov %s, %d", subregister(REG_RAX, type), num);
-            return (Type) { .kind = type };
+            gen_ins2(OP_MOV, reg(REG_RAX, type.kind), imm(num, type.kind));
         } break;
 
         case LITERAL_IDENT:
-            return literal_ident(literal, str, false);
+            literal_ident(literal, str, false);
             break;
     }
 
-    UNREACHABLE();
-
 }
 
-static Type grouping(const ExprGrouping *grouping) {
-    return emit(grouping->expr);
+static void grouping(const ExprGrouping *grouping) {
+    emit(grouping->expr);
 }
 
 static void cond(const StmtIf *cond) {
 
     int lbl = gen.label_count++;
-    Type ty = emit(cond->condition);
-    const char *rax = subregister(REG_RAX, ty.kind);
 
     // IF
-    gen_write("cmp %s, 0", rax);
-    gen_write("je .else%d", lbl);
+    branch(cond->condition, false, label(LABEL_ELSE, lbl));
 
     // THEN
     emit(cond->then_body);
 
     // ELSE
-    gen_write("jmp .end%d", lbl);
-    gen_write(".else%d:", lbl);
+    gen_ins1(OP_JMP, label(LABEL_END, lbl));
+    gen_label(LABEL_ELSE, lbl);
 
     if (cond->else_body != NULL)
         emit(cond->else_body);
 
     // END
-    gen_write(".end%d:", lbl);
+    gen_label(LABEL_END, lbl);
+
+}
+
+// vector register of the loop, xmm or ymm
+NO_DISCARD static inline Operand vreg(const VectorLoop *vec, int index) {
+    return operand_reg(REG_XMM0 + index, vec->width);
+}
+
+NO_DISCARD static inline Operand xmm(int index) {
+    return operand_reg(REG_XMM0 + index, 16);
+}
+
+// the byte, dword and qword forms of an operation follow each other
+NO_DISCARD static Opcode sized_op(Opcode byte, TypeKind type) {
+    switch (type_primitive_size(type)) {
+        case 1:  return byte;
+        case 4:  return byte + 1;
+        default: return byte + 2;
+    }
+}
+
+// copies the scalar in rax into every lane of the register
+static void broadcast(const VectorLoop *vec, int index) {
+    Operand x = xmm(index);
+
+    if (type_primitive_size(vec->type) == 8)
+        gen_ins2(OP_MOVQ, x, reg64(REG_RAX));
+    else
+        gen_ins2(OP_MOVD, x, reg(REG_RAX, TYPE_INT));
+
+    if (compiler_ctx.avx2) {
+        gen_ins2(sized_op(OP_VPBROADCASTB, vec->type), vreg(vec, index), x);
+        return;
+    }
+
+    // every unpack doubles the copies of the lowest element
+    switch (type_primitive_size(vec->type)) {
+        case 1:
+            gen_ins2(OP_PUNPCKLBW, x, x);
+            gen_ins2(OP_PUNPCKLWD, x, x);
+            // fallthrough
+        case 4:
+            gen_ins2(OP_PUNPCKLDQ, x, x);
+            // fallthrough
+        default:
+            gen_ins2(OP_PUNPCKLQDQ, x, x);
+    }
+}
+
+// sign extends the index into rdi, where the loads and the store of an iteration expect it
+static void vector_index(const VectorLoop *vec) {
+    TypeKind type = vec->index->type.kind;
+    gen_ins2(OP_MOV, reg(REG_RDI, type), slot(vec->index->offset, type));
+    extend_index(REG_RDI, type);
+}
+
+// computes the node into register r, the ones above it may be used as well
+static void vector_expr(const VectorLoop *vec, AstNode *node, int r) {
+
+    while (node->kind == ASTNODE_GROUPING)
+        node = node->expr_grouping.expr;
+
+    Operand dst = vreg(vec, r);
+    int size = type_primitive_size(vec->type);
+
+    int invariant = vector_invariant(vec, node);
+    if (invariant != -1) {
+        gen_ins2(OP_MOVDQA, dst, vreg(vec, invariant));
+        return;
+    }
+
+    AstNode *ptr = vector_pointer(vec, node);
+    if (ptr != NULL) {
+        emit(ptr);
+        gen_ins2(OP_MOVDQU, dst, operand_mem_index(REG_RAX, REG_RDI, size, 0, vec->width));
+        return;
+    }
+
+    const ExprBinOp *binop = &node->expr_binop;
+
+    // `a < b` is `b > a`, and `a >= b` is `!(b > a)`
+    bool swapped = binop->kind == BINOP_LT || binop->kind == BINOP_GT_EQ;
+    AstNode *first  = swapped ? binop->rhs : binop->lhs;
+    AstNode *second = swapped ? binop->lhs : binop->rhs;
+
+    vector_expr(vec, first, r);
+
+    Operand src = vreg(vec, r+1);
+    invariant = vector_invariant(vec, second);
+
+    if (invariant != -1)
+        src = vreg(vec, invariant);
+    else
+        vector_expr(vec, second, r+1);
+
+    switch (binop->kind) {
+        case BINOP_ADD:         gen_ins2(sized_op(OP_PADDB, vec->type), dst, src); break;
+        case BINOP_SUB:         gen_ins2(sized_op(OP_PSUBB, vec->type), dst, src); break;
+        case BINOP_MUL:         gen_ins2(OP_PMULLD, dst, src);                     break;
+        case BINOP_BITWISE_AND: gen_ins2(OP_PAND, dst, src);                       break;
+        case BINOP_BITWISE_OR:  gen_ins2(OP_POR, dst, src);                        break;
+        case BINOP_EQ:
+        case BINOP_NEQ:         gen_ins2(sized_op(OP_PCMPEQB, vec->type), dst, src); break;
+        case BINOP_GT:
+        case BINOP_GT_EQ:
+        case BINOP_LT:
+        case BINOP_LT_EQ:       gen_ins2(sized_op(OP_PCMPGTB, vec->type), dst, src); break;
+        default: PANIC("operation is not vectorized");
+    }
+
+    // the mask of all ones becomes 1, `pandn` inverts it first
+    Operand one = vec->one != NULL ? vreg(vec, vector_invariant(vec, vec->one)) : operand_none();
+
+    switch (binop->kind) {
+        case BINOP_EQ:
+        case BINOP_GT:
+        case BINOP_LT:
+            gen_ins2(OP_PAND, dst, one);
+            break;
+
+        case BINOP_NEQ:
+        case BINOP_GT_EQ:
+        case BINOP_LT_EQ:
+            gen_ins2(OP_PANDN, dst, one);
+            break;
+
+        default:
+            NOP() break;
+    }
+}
+
+// adds up the lanes of the accumulator in xmm0, and the result to the accumulator variable
+static void vector_reduce(const VectorLoop *vec) {
+    TypeKind type = vec->type;
+    int size = type_primitive_size(type);
+
+    // subtraction has accumulated the negated elements
+    Opcode op = vec->reduce == BINOP_BITWISE_AND ? OP_PAND
+              : vec->reduce == BINOP_BITWISE_OR  ? OP_POR
+              : sized_op(OP_PADDB, type);
+
+    if (vec->width == 32) {
+        gen_ins2(OP_VEXTRACTI128, xmm(1), vreg(vec, 0));
+        gen_ins2(op, xmm(0), xmm(1));
+    }
+
+    // halves the lanes each time, until the low element holds all of them
+    for (int bytes=8; bytes >= size; bytes /= 2) {
+        gen_ins2(OP_MOVDQA, xmm(1), xmm(0));
+        gen_ins2(OP_PSRLDQ, xmm(1), operand_imm(bytes, 1));
+        gen_ins2(op, xmm(0), xmm(1));
+    }
+
+    if (size == 8)
+        gen_ins2(OP_MOVQ, reg64(REG_RAX), xmm(0));
+    else
+        gen_ins2(OP_MOVD, reg(REG_RAX, TYPE_INT), xmm(0));
+
+    Operand acc = slot(vec->acc->offset, type);
+    Opcode scalar = vec->reduce == BINOP_BITWISE_AND ? OP_AND
+                  : vec->reduce == BINOP_BITWISE_OR  ? OP_OR
+                  : OP_ADD;
+
+    gen_ins2(scalar, reg(REG_RAX, type), acc);
+    gen_ins2(OP_MOV, acc, reg(REG_RAX, type));
+}
+
+// runs the loop `lanes` iterations at a time, for as long as there are that
+// many left, and leaves the rest to the scalar loop behind it.
+// the bound minus lanes-1 is kept in rcx, the index in rdi. both are computed
+// in 64 bit, so int bounds can not overflow, long bounds are checked first
+static void vector_loop(const VectorLoop *vec) {
+
+    int lbl = gen.label_count++;
+    TypeKind index = vec->index->type.kind;
+    int size = type_primitive_size(vec->type);
+
+    // and starts from all ones, everything else from zero
+    if (vec->kind == VECTOR_REDUCE) {
+        Operand acc = vreg(vec, 0);
+        gen_ins2(vec->reduce == BINOP_BITWISE_AND ? OP_PCMPEQB : OP_PXOR, acc, acc);
+    }
 
+    // an iteration loads a whole vector before it stores any of it, which
+    // differs from the scalar loop, if the target starts within a vector behind a source
+    for (size_t i=0; i < vec->sources_len; ++i) {
+        int skip = gen.label_count++;
+
+        emit(vec->sources[i]);
+        gen_ins2(OP_MOV, reg64(REG_RDI), reg64(REG_RAX));
+        emit(vec->target);
+        gen_ins2(OP_SUB, reg64(REG_RAX), reg64(REG_RDI));
+        gen_ins2(OP_CMP, reg64(REG_RAX), operand_imm(0, 8));
+        gen_ins1(OP_JLE, label(LABEL_SKIP, skip));
+        gen_ins2(OP_CMP, reg64(REG_RAX), operand_imm(vec->width, 8));
+        gen_ins1(OP_JL, label(LABEL_END, lbl));
+        gen_label(LABEL_SKIP, skip);
+    }
+
+    emit(vec->bound);
+    extend_index(REG_RAX, index);
+
+    if (index == TYPE_LONG) {
+        gen_ins2(OP_MOV, reg64(REG_RDI), operand_imm(INT64_MIN + vec->lanes - 1, 8));
+        gen_ins2(OP_CMP, reg64(REG_RAX), reg64(REG_RDI));
+        gen_ins1(OP_JL, label(LABEL_END, lbl));
+    }
+
+    gen_ins2(OP_SUB, reg64(REG_RAX), operand_imm(vec->lanes - 1, 8));
+    gen_ins2(OP_MOV, reg64(REG_RCX), reg64(REG_RAX));
+
+    for (size_t i=0; i < vec->invariants_len; ++i) {
+        emit(vec->invariants[i]);
+        broadcast(vec, vector_invariant(vec, vec->invariants[i]));
+    }
+
+    gen_ins1(OP_JMP, label(LABEL_COND, lbl));
+    gen_label(LABEL_WHILE, lbl);
+    vector_index(vec);
+
+    Operand value = vreg(vec, vector_temporaries(vec));
+    int invariant = vector_invariant(vec, vec->expr);
+
+    if (invariant != -1)
+        value = vreg(vec, invariant);
+    else
+        vector_expr(vec, vec->expr, vector_temporaries(vec));
+
+    if (vec->kind == VECTOR_MAP) {
+        emit(vec->target);
+        gen_ins2(OP_MOVDQU, operand_mem_index(REG_RAX, REG_RDI, size, 0, vec->width), value);
+
+    } else {
+        Opcode op = vec->reduce == BINOP_BITWISE_AND ? OP_PAND
+                  : vec->reduce == BINOP_BITWISE_OR  ? OP_POR
+                  : vec->reduce == BINOP_SUB         ? sized_op(OP_PSUBB, vec->type)
+                  : sized_op(OP_PADDB, vec->type);
+        gen_ins2(op, vreg(vec, 0), value);
+    }
+
+    Operand i = slot(vec->index->offset, index);
+    gen_ins2(OP_MOV, reg(REG_RAX, index), i);
+    gen_ins2(OP_ADD, reg(REG_RAX, index), imm(vec->lanes, index));
+    gen_ins2(OP_MOV, i, reg(REG_RAX, index));
+
+    gen_label(LABEL_COND, lbl);
+    vector_index(vec);
+    gen_ins2(OP_CMP, reg64(REG_RDI), reg64(REG_RCX));
+    gen_ins1(vec->compare == BINOP_LT ? OP_JL : OP_JLE, label(LABEL_WHILE, lbl));
+    gen_label(LABEL_END, lbl);
+
+    if (vec->kind == VECTOR_REDUCE)
+        vector_reduce(vec);
+
+    // avoids the penalty of mixing the upper halves with SSE code elsewhere
+    if (compiler_ctx.avx2)
+        gen_ins0(OP_VZEROUPPER);
 }
 
 static void while_(const StmtWhile *loop) {
 
+    if (loop->vector != NULL)
+        vector_loop(loop->vector);
+
     int lbl = gen.label_count++;
 
     // WHILE
-    gen_write("jmp .cond%d", lbl);
-    gen_write(".while%d:", lbl);
+    gen_ins1(OP_JMP, label(LABEL_COND, lbl));
+    gen_label(LABEL_WHILE, lbl);
 
     // DO
     emit(loop->body);
 
     // END
-    gen_write(".cond%lu:", lbl);
-    Type cond = emit(loop->condition);
-    const char *rax = subregister(REG_RAX, cond.kind);
-    gen_write("cmp %s, 0", rax);
-    gen_write("jne .while%lu", lbl);
+    gen_label(LABEL_COND, lbl);
+    branch(loop->condition, true, label(LABEL_WHILE, lbl));
 
 }
 
 static void vardecl(const StmtVarDecl *decl) {
 
+    gen_var(decl->offset, decl->type.kind);
     if (decl->init == NULL) return;
 
-    const char *ident = decl->ident.value;
-    Type init = emit(decl->init);
-    if (decl->type.kind != init.kind) {
-        diagnostic_loc(
-            DIAG_ERROR,
-            &decl->op,
-            "Invalid type (%s, %s)",
-            stringify_typekind(decl->type.kind),
-            stringify_typekind(init.kind)
-        );
-        exit(EXIT_FAILURE);
-    }
-    gen_write(
-        "mov [rbp-%d], %s ; %s",
-        decl->offset,
-        subregister(REG_RAX, init.kind),
-        ident
-    );
+    TypeKind type = decl->type.kind;
+    emit(decl->init);
+    gen_ins(OP_MOV, slot(decl->offset, type), reg(REG_RAX, type), decl->ident.value);
 
 }
 
-static Type assign(const ExprAssign *assign) {
+static void assign(const ExprAssign *assign) {
+
+    TypeKind type = assign->value->type.kind;
+    const AstNode *target = assign->target;
 
-    Type target = emit_addr(assign->target);
-    gen_write("push rax");
-    Type ty = emit(assign->value);
+    // variables are stored to directly, so their address is not needed
+    if (target->kind == ASTNODE_LITERAL && target->expr_literal.sym->kind != SYMBOL_PROCEDURE) {
+        emit(assign->value);
+        gen_ins2(OP_MOV, slot(target->expr_literal.sym->offset, type), reg(REG_RAX, type));
+        return;
+    }
+
+    // the target of a deref is computed as an operand, which is spilled
+    // around the value: the base as usual, the index in a second slot
+    if (target->kind == ASTNODE_UNARYOP && target->expr_unaryop.kind == UNARYOP_DEREF) {
+        Operand mem = pointee(target->expr_unaryop.node, type_primitive_size(type));
+
+        if (mem.index != REG_INVALID)
+            gen_ins1(OP_PUSH, reg64(REG_RDI));
+        gen_ins1(OP_PUSH, reg64(REG_RAX));
+        emit(assign->value);
+
+        gen_ins1(OP_POP, reg64(REG_RDI));
+        mem.reg = REG_RDI;
+        if (mem.index != REG_INVALID) {
+            gen_ins1(OP_POP, reg64(REG_RSI));
+            mem.index = REG_RSI;
+        }
 
-    if (target.kind != ty.kind) {
-        diagnostic_loc(
-            DIAG_ERROR,
-            &assign->op,
-            "Invalid type (%s, %s)",
-            stringify_typekind(target.kind),
-            stringify_typekind(ty.kind)
-        );
-        exit(EXIT_FAILURE);
+        gen_ins2(OP_MOV, mem, reg(REG_RAX, type));
+        return;
     }
 
-    gen_write("pop rdi");
-    gen_write("mov [rdi], %s", subregister(REG_RAX, ty.kind));
+    emit_addr(assign->target);
+    gen_ins1(OP_PUSH, reg64(REG_RAX));
+    emit(assign->value);
+
+    gen_ins1(OP_POP, reg64(REG_RDI));
+    gen_ins2(OP_MOV, operand_mem(REG_RDI, 0, type_primitive_size(type)), reg(REG_RAX, type));
 
-    return ty;
 }
 
-static Type array(const ExprArray *array) {
+static void array(const ExprArray *array) {
 
     AstNodeList list = array->values;
-    int elem_size = type_primitive_size(array->type.kind);
+    TypeKind type = array->type.kind;
+    int elem_size = type_primitive_size(type);
 
     for (size_t i=0; i < list.size; ++i) {
         emit(list.items[i]);
 
         int offset = array->offset + (list.size - i) * elem_size;
-        gen_write("mov [rbp-%d], %s ; array", offset, subregister(REG_RAX, array->type.kind));
+        gen_ins(OP_MOV, slot(offset, type), reg(REG_RAX, type), "array");
 
     }
 
-    gen_write("lea rax, [rbp-%d]", array->offset + list.size * elem_size);
+    gen_ins2(OP_LEA, reg64(REG_RAX), slot(array->offset + list.size * elem_size, TYPE_LONG));
 
-    // TODO: remove const cast
-    return (Type) { .kind = TYPE_POINTER, .pointee = (Type*) &array->type };
 }
-
-
 // get address of lvalue
-static Type emit_addr(AstNode *node) {
+static void emit_addr(AstNode *node) {
     NON_NULL(node);
 
     switch (node->kind) {
-        case ASTNODE_UNARYOP: return unaryop_addr(&node->expr_unaryop); break;
-        case ASTNODE_LITERAL: return literal_addr(&node->expr_literal); break;
+        case ASTNODE_UNARYOP: unaryop_addr(&node->expr_unaryop); break;
+        case ASTNODE_LITERAL: literal_addr(&node->expr_literal); break;
 
         case ASTNODE_FOR:
         case ASTNODE_INDEX:
@@ -741,41 +1815,353 @@ static Type emit_addr(AstNode *node) {
             PANIC("unknown node kind");
     }
 
-    UNREACHABLE();
-
 }
 
-static Type emit(AstNode *node) {
+static void emit(AstNode *node) {
     NON_NULL(node);
 
     switch (node->kind) {
-        case ASTNODE_BLOCK:     block           (&node->block);         break;
-        case ASTNODE_WHILE:     while_          (&node->stmt_while);    break;
-        case ASTNODE_PROC:      proc            (&node->stmt_proc);     break;
-        case ASTNODE_RETURN:    return_         (&node->stmt_return);   break;
-        case ASTNODE_VARDECL:   vardecl         (&node->stmt_vardecl);  break;
-        case ASTNODE_IF:        cond            (&node->stmt_if);       break;
-        case ASTNODE_GROUPING:  return grouping (&node->expr_grouping); break;
-        case ASTNODE_ASSIGN:    return assign   (&node->expr_assign);   break;
-        case ASTNODE_BINOP:     return binop    (&node->expr_binop);    break;
-        case ASTNODE_CALL:      return call     (&node->expr_call);     break;
-        case ASTNODE_UNARYOP:   return unaryop  (&node->expr_unaryop);  break;
-        case ASTNODE_LITERAL:   return literal  (&node->expr_literal);  break;
-        case ASTNODE_ARRAY:     return array    (&node->expr_array);    break;
+        case ASTNODE_BLOCK:     block    (&node->block);                     break;
+        case ASTNODE_WHILE:     while_   (&node->stmt_while);                break;
+        case ASTNODE_PROC:      proc     (&node->stmt_proc);                 break;
+        case ASTNODE_RETURN:    return_  (&node->stmt_return);               break;
+        case ASTNODE_VARDECL:   vardecl  (&node->stmt_vardecl);              break;
+        case ASTNODE_IF:        cond     (&node->stmt_if);                   break;
+        case ASTNODE_GROUPING:  grouping (&node->expr_grouping);             break;
+        case ASTNODE_ASSIGN:    assign   (&node->expr_assign);               break;
+        case ASTNODE_BINOP:     binop    (node);                             break;
+        case ASTNODE_CALL:      call     (&node->expr_call, false);          break;
+        case ASTNODE_UNARYOP:   unaryop  (&node->expr_unaryop, node->type);  break;
+        case ASTNODE_LITERAL:   literal  (&node->expr_literal, node->type);  break;
+        case ASTNODE_ARRAY:     array    (&node->expr_array);                break;
         case ASTNODE_INDEX:
         case ASTNODE_FOR:
             PANIC("syntactic sugar should have been expanded earlier"); break;
-        case ASTNODE_TABLE:     NOP()                                   break;
+        case ASTNODE_TABLE:     NOP()                                        break;
+    }
+
+}
+
+// with -fssa, procedures are generated from the SSA IR instead of the tree,
+// a block at a time, in the order of the layout. every value with a result
+// gets a slot of its own past the variables of the procedure, which the
+// register allocator treats like any other variable. constants are used as
+// immediates instead. every phi has a second slot, that the predecessors copy
+// their argument into before they jump, and which is copied into the phi at
+// the start of its block, so phis of the same block may select each other.
+// the IR has no vectorized loops and no inlined calls
+
+static const IrProc *ssa_proc(const DeclProc *proc) {
+    for (size_t i=0; i < gen.ir->procs_len; ++i) {
+        if (gen.ir->procs[i]->decl == proc)
+            return gen.ir->procs[i];
+    }
+    PANIC("procedure has not been lowered to the IR");
+}
+
+NO_DISCARD static int ssa_offset(const IrValue *value) {
+    return gen.ir_offsets[value->id];
+}
+
+// incoming argument of a phi
+NO_DISCARD static int ssa_phi_offset(const IrValue *phi) {
+    return gen.ir_offsets[gen.ir_proc->values_count + phi->id];
+}
+
+NO_DISCARD static inline Operand ssa_block_label(const IrBlock *block) {
+    return label(LABEL_BLOCK, gen.ir_label + block->id);
+}
+
+static void ssa_load(Register r, const IrValue *value) {
+    if (value->op == IR_CONST)
+        gen_ins2(OP_MOV, reg(r, value->type), imm(value->imm, value->type));
+    else
+        gen_ins2(OP_MOV, reg(r, value->type), slot(ssa_offset(value), value->type));
+}
+
+// the comparison is only evaluated by the branch that directly follows it, if it has no other uses
+NO_DISCARD static bool ssa_fused(const IrBlock *block, size_t i) {
+    const IrValue *value = block->values[i];
+    const IrValue *next  = i + 1 < block->values_len ? block->values[i + 1] : NULL;
+
+    return value->op == IR_CMP && next != NULL && next->op == IR_BR
+        && next->args[0] == value && gen.ir_uses[value->id] == 1;
+}
+
+NO_DISCARD static Opcode comparison_set(BinOpKind kind) {
+    switch (kind) {
+        case BINOP_EQ:    return OP_SETE;
+        case BINOP_NEQ:   return OP_SETNE;
+        case BINOP_GT:    return OP_SETG;
+        case BINOP_GT_EQ: return OP_SETGE;
+        case BINOP_LT:    return OP_SETL;
+        case BINOP_LT_EQ: return OP_SETLE;
+        default: PANIC("not a comparison");
+    }
+}
+
+// copies the arguments of the phis of `target` for the edge coming from `block`
+static void ssa_edge(const IrBlock *block, const IrBlock *target) {
+
+    size_t pred = 0;
+    while (target->preds[pred] != block)
+        pred++;
+
+    for (size_t i=0; i < target->values_len && target->values[i]->op == IR_PHI; ++i) {
+        const IrValue *phi = target->values[i];
+        ssa_load(REG_RAX, phi->args[pred]);
+        gen_ins2(OP_MOV, slot(ssa_phi_offset(phi), phi->type), reg(REG_RAX, phi->type));
+    }
+
+}
+
+static void ssa_call(const IrValue *value) {
+
+    size_t first = value->name == NULL ? 1 : 0;
+    size_t count = value->args_len - first;
+
+    int area = count > 6 ? 8 * (count - 6) : 0;
+    gen_ins2(OP_SUB, reg64(REG_RSP), operand_imm(area, 8));
+
+    for (size_t i=0; i < count; ++i) {
+        Register abi = abi_register(i+1);
+
+        // stack arguments go through r11, which is neither an argument register nor the callee
+        ssa_load(abi == REG_INVALID ? REG_R11 : abi, value->args[first + i]);
+
+        if (abi == REG_INVALID)
+            gen_ins2(OP_MOV, operand_mem(REG_RSP, 8 * (i - 6), 8), reg64(REG_R11));
+    }
+
+    if (value->name != NULL) {
+        gen_ins1(OP_CALL, operand_symbol(value->name));
+    } else {
+        ssa_load(REG_RAX, value->args[0]);
+        gen_ins1(OP_CALL, reg64(REG_RAX));
+    }
+
+    gen_ins2(OP_ADD, reg64(REG_RSP), operand_imm(area, 8));
+}
+
+static void ssa_value(const IrBlock *block, size_t i) {
+
+    const IrValue *value = block->values[i];
+    TypeKind type = value->type;
+    IrValue **args = value->args;
+
+    // operands go into rax and rdi, the result is left in rax
+    switch (value->op) {
+        case IR_CONST:
+            return;
+
+        case IR_PARAM: {
+            Register abi = abi_register(value->imm + 1);
+            if (abi == REG_INVALID)
+                gen_ins2(OP_MOV, reg(REG_RAX, type), operand_mem(REG_RBP, 16 + 8 * (value->imm - 6), type_primitive_size(type)));
+            else
+                gen_ins2(OP_MOV, reg(REG_RAX, type), reg(abi, type));
+        } break;
+
+        case IR_SLOT:
+            gen_ins2(OP_LEA, reg64(REG_RAX), slot(value->imm, TYPE_LONG));
+            break;
+
+        case IR_STRING:
+            emitter_string(&gen.buf_data, gen.data_count, value->name);
+            gen_ins2(OP_MOV, reg64(REG_RAX), label(LABEL_STRING, gen.data_count));
+            gen.data_count++;
+            break;
+
+        case IR_SYMBOL:
+            gen_ins2(OP_MOV, reg64(REG_RAX), operand_symbol(value->name));
+            break;
+
+        case IR_LOAD:
+            ssa_load(REG_RAX, args[0]);
+            gen_ins2(OP_MOV, reg(REG_RAX, type), operand_mem(REG_RAX, 0, type_primitive_size(type)));
+            break;
+
+        case IR_STORE:
+            ssa_load(REG_RDI, args[0]);
+            ssa_load(REG_RAX, args[1]);
+            gen_ins2(OP_MOV, operand_mem(REG_RDI, 0, type_primitive_size(args[1]->type)), reg(REG_RAX, args[1]->type));
+            return;
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_AND:
+        case IR_OR: {
+            Opcode ops[] = { [IR_ADD] = OP_ADD, [IR_SUB] = OP_SUB, [IR_AND] = OP_AND, [IR_OR] = OP_OR };
+            ssa_load(REG_RAX, args[0]);
+            ssa_load(REG_RDI, args[1]);
+            gen_ins2(ops[value->op], reg(REG_RAX, type), reg(REG_RDI, type));
+        } break;
+
+        case IR_MUL:
+            ssa_load(REG_RAX, args[0]);
+            ssa_load(REG_RDI, args[1]);
+            gen_ins1(OP_IMUL, reg(REG_RDI, type));
+            break;
+
+        case IR_DIV:
+            ssa_load(REG_RAX, args[0]);
+            ssa_load(REG_RDI, args[1]);
+            sign_extend_dividend(type);
+            // chars are divided in 32 bit
+            gen_ins1(OP_IDIV, type_primitive_size(type) == 1 ? reg(REG_RDI, TYPE_INT) : reg(REG_RDI, type));
+            break;
+
+        case IR_PTRADD:
+            ssa_load(REG_RAX, args[0]);
+            ssa_load(REG_RDI, args[1]);
+            extend_index(REG_RDI, args[1]->type);
+
+            if (value->imm > 0)
+                scale_index(reg64(REG_RDI), value->imm);
+            else
+                gen_ins2(OP_IMUL, reg64(REG_RDI), operand_imm(value->imm, 8));
+
+            gen_ins2(OP_ADD, reg64(REG_RAX), reg64(REG_RDI));
+            break;
+
+        case IR_NEG:
+            ssa_load(REG_RAX, args[0]);
+            gen_ins1(OP_NEG, reg(REG_RAX, type));
+            break;
+
+        case IR_NOT:
+            ssa_load(REG_RAX, args[0]);
+            gen_ins2(OP_CMP, reg(REG_RAX, type), imm(0, type));
+            setcc(OP_SETE, type);
+            break;
+
+        case IR_CMP:
+            if (ssa_fused(block, i)) return;
+
+            ssa_load(REG_RAX, args[0]);
+            ssa_load(REG_RDI, args[1]);
+            gen_ins2(OP_CMP, reg(REG_RAX, args[0]->type), reg(REG_RDI, args[1]->type));
+            setcc(comparison_set(value->cmp), type);
+            break;
+
+        case IR_CALL:
+            ssa_call(value);
+            if (type == TYPE_VOID) return;
+            break;
+
+        case IR_PHI:
+            gen_ins2(OP_MOV, reg(REG_RAX, type), slot(ssa_phi_offset(value), type));
+            break;
+
+        case IR_JMP:
+            ssa_edge(block, value->targets[0]);
+            gen_ins1(OP_JMP, ssa_block_label(value->targets[0]));
+            return;
+
+        case IR_BR: {
+            const IrValue *cond = args[0];
+            ssa_edge(block, value->targets[0]);
+            ssa_edge(block, value->targets[1]);
+
+            // the copies leave the flags alone, so a fused comparison is evaluated after them
+            if (i > 0 && ssa_fused(block, i - 1)) {
+                ssa_load(REG_RAX, cond->args[0]);
+                ssa_load(REG_RDI, cond->args[1]);
+                gen_ins2(OP_CMP, reg(REG_RAX, cond->args[0]->type), reg(REG_RDI, cond->args[1]->type));
+                gen_ins1(comparison_jump(cond->cmp, true), ssa_block_label(value->targets[0]));
+            } else {
+                ssa_load(REG_RAX, cond);
+                gen_ins2(OP_CMP, reg(REG_RAX, cond->type), imm(0, cond->type));
+                gen_ins1(OP_JNE, ssa_block_label(value->targets[0]));
+            }
+
+            gen_ins1(OP_JMP, ssa_block_label(value->targets[1]));
+        } return;
+
+        case IR_RET:
+            if (value->args_len > 0)
+                ssa_load(REG_RAX, args[0]);
+            gen_ins1(OP_JMP, label(LABEL_RETURN, -1));
+            return;
+    }
+
+    gen_ins2(OP_MOV, slot(ssa_offset(value), type), reg(REG_RAX, type));
+}
+
+// places a slot of the given type past the ones before it, aligned to its size
+NO_DISCARD static int ssa_slot(int *size, TypeKind type) {
+    int bytes = type_primitive_size(type);
+    *size = (*size + 2 * bytes - 1) / bytes * bytes;
+    return *size;
+}
+
+static void ssa_body(const IrProc *ir) {
+
+    gen.ir_proc    = ir;
+    gen.ir_label   = gen.label_count;
+    gen.ir_uses    = NON_NULL(calloc(ir->values_count + 1, sizeof(int)));
+    gen.ir_offsets = NON_NULL(calloc(2 * ir->values_count + 1, sizeof(int)));
+    gen.label_count += ir->blocks_len;
+
+    for (size_t i=0; i < ir->blocks_len; ++i) {
+        const IrBlock *block = ir->blocks[i];
+
+        for (size_t j=0; j < block->values_len; ++j) {
+            const IrValue *value = block->values[j];
+            for (size_t k=0; k < value->args_len; ++k)
+                gen.ir_uses[value->args[k]->id]++;
+        }
+    }
+
+    // constants and fused comparisons are never stored
+    int size = gen.proc->stack_size;
+
+    for (size_t i=0; i < ir->blocks_len; ++i) {
+        const IrBlock *block = ir->blocks[i];
+
+        for (size_t j=0; j < block->values_len; ++j) {
+            const IrValue *value = block->values[j];
+            if (value->type == TYPE_VOID || value->op == IR_CONST || ssa_fused(block, j)) continue;
+
+            gen.ir_offsets[value->id] = ssa_slot(&size, value->type);
+            gen_var(ssa_offset(value), value->type);
+
+            if (value->op != IR_PHI) continue;
+
+            gen.ir_offsets[ir->values_count + value->id] = ssa_slot(&size, value->type);
+            gen_var(ssa_phi_offset(value), value->type);
+        }
     }
 
-    return (Type) { .kind = TYPE_VOID };
+    gen.frame_size   = size;
+    gen.frame_extent = size;
 
+    for (size_t i=0; i < ir->blocks_len; ++i) {
+        const IrBlock *block = ir->blocks[i];
+        gen_ins1(OP_LABEL, ssa_block_label(block));
+
+        for (size_t j=0; j < block->values_len; ++j)
+            ssa_value(block, j);
+    }
+
+    free(gen.ir_uses);
+    free(gen.ir_offsets);
+    gen.ir_uses    = NULL;
+    gen.ir_offsets = NULL;
 }
 
-void codegen(AstNode *root, const char *filename) {
+void codegen(AstNode *root, const IrProgram *ir, const char *filename) {
     printf("GEN %s\n", filename);
+    pass_start(PASS_CODEGEN, NULL);
     gen_init();
+    gen.ir = ir;
     emit(root);
-    gen_write_to_file(filename);
+    emitter_write_file(filename, &gen.buf_data, &gen.buf_text);
     gen_destroy();
+    pass_stop(PASS_CODEGEN, NULL);
+
+    if (compiler_ctx.stats && pass_enabled(PASS_PEEPHOLE))
+        peephole_print_stats();
+    if (compiler_ctx.stats && pass_enabled(PASS_REGALLOC))
+        regalloc_print_stats();
 }
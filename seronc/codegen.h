@@ -2,7 +2,9 @@
 #define _CODEGEN_H
 
 #include "parser.h"
+#include "ir.h"
 
-void codegen(AstNode *root, const char *filename);
+// ir is NULL unless the procedures are generated from the SSA IR
+void codegen(AstNode *root, const IrProgram *ir, const char *filename);
 
 #endif // _CODEGEN_H
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+
+#include "cse.h"
+
+// the statements of a block are numbered one after the other, a statement with
+// a body of its own ends the basic block. every expression gets a value number,
+// which two expressions only share if they compute the same value: variables
+// get a new number whenever they are assigned to, constants are numbered by
+// their value, and operations by their kind and the numbers of their operands.
+//
+// loads, and variables whose address is taken, are numbered anew after every
+// store through a pointer and every call, as either may change them.
+//
+// when an operation turns up a second time, its first occurrence is computed in
+// front of its statement, into a new variable, and both are replaced by it:
+//
+// x = a * b + 1;          let t: int = a * b;
+// y = a * b;              x = t + 1;
+//                         y = t;
+//
+// this is only done for operations that are evaluated unconditionally, before
+// any side effect of their statement, so they have the same value in front of
+// it. a repeated expression is replaced as a whole, its parts are left alone.
+//
+// the new variables get slots at the end of the frame of the procedure
+
+static struct {
+    int eliminated, temporaries;
+} stats = { 0 };
+
+// value number of an expression, and whether it reads memory, so stores may change it
+typedef struct {
+    int number;
+    bool load;
+} Value;
+
+// operation or constant that has been numbered in the current basic block
+typedef struct {
+    // the key, which is compared to find repetitions
+    AstNodeKind kind;
+    int op;           // kind of the binop or unaryop
+    TypeKind type;
+    TypeKind pointee; // pointer arithmetic is scaled by it
+    int64_t lhs, rhs; // value numbers of the operands, or the value of a constant
+    bool load;
+
+    int number;
+    bool killed;      // a load, which may have been changed by a store since
+    AstNode *first;   // where it has been computed first, NULL for constants
+    size_t stmt;      // index of the statement of first in its block
+    int order;        // operands are numbered before the operations using them
+    AstNode *decl;    // variable holding it, NULL until it is repeated
+} Expr;
+
+typedef struct {
+    Symbol *sym;
+    int number;
+} Binding;
+
+// repetition of exprs[expr], which is replaced at the end of its statement
+typedef struct {
+    size_t expr;
+    AstNode *node;
+} Match;
+
+// declaration that goes in front of the statement stmt of its block
+typedef struct {
+    size_t stmt;
+    int order;
+    AstNode *decl;
+} Hoisted;
+
+typedef struct {
+    Arena *arena;
+    DeclProc *proc;
+    SymbolSet addressed; // variables of the procedure whose address is taken
+    Expr *exprs;
+    size_t exprs_len, exprs_cap;
+    Binding *bindings;   // current value numbers of variables
+    size_t bindings_len, bindings_cap;
+    Match *matches;      // repetitions in the current statement
+    size_t matches_len, matches_cap;
+    Hoisted *hoisted;    // of every block that is being numbered, the innermost last
+    size_t hoisted_len, hoisted_cap;
+    size_t stmt;         // index of the current statement in its block
+    bool assigned;       // a variable has been assigned to in the current statement
+    bool clobbered;      // memory has been written to in the current statement
+    int conditional;     // depth of right operands of short-circuiting operators
+    int next_number;
+    int next_order;
+    int temp_count;
+} Cse;
+
+
+
+// values that fit into a register, which a variable can hold
+NO_DISCARD static bool is_scalar(TypeKind type) {
+    return type == TYPE_CHAR || type == TYPE_INT || type == TYPE_LONG || type == TYPE_POINTER;
+}
+
+NO_DISCARD static bool is_commutative(BinOpKind kind) {
+    switch (kind) {
+        case BINOP_ADD:
+        case BINOP_MUL:
+        case BINOP_EQ:
+        case BINOP_NEQ:
+        case BINOP_BITWISE_OR:
+        case BINOP_BITWISE_AND:
+            return true;
+        default:
+            return false;
+    }
+}
+
+NO_DISCARD static bool has_side_effects(const AstNode *node) {
+
+    switch (node->kind) {
+        case ASTNODE_LITERAL:  return false;
+        case ASTNODE_GROUPING: return has_side_effects(node->expr_grouping.expr);
+        case ASTNODE_UNARYOP:  return has_side_effects(node->expr_unaryop.node);
+        case ASTNODE_BINOP:
+            return has_side_effects(node->expr_binop.lhs) || has_side_effects(node->expr_binop.rhs);
+        default:
+            return true;
+    }
+}
+
+NO_DISCARD static bool same_key(const Expr *a, const Expr *b) {
+    return a->kind    == b->kind
+        && a->op      == b->op
+        && a->type    == b->type
+        && a->pointee == b->pointee
+        && a->lhs     == b->lhs
+        && a->rhs     == b->rhs;
+}
+
+
+
+// moves the first occurrence of the expression into a new variable, which is
+// declared in front of its statement, and replaces it by a reference to that variable
+static void new_temporary(Cse *c, Expr *e) {
+
+    AstNode *expr = e->first;
+    Type type = expr->type;
+    int offset = symboltable_new_slot(c->proc, type_primitive_size(type.kind));
+
+    Symbol *sym = arena_alloc(c->arena, sizeof(Symbol));
+    *sym = (Symbol) {
+        .kind   = SYMBOL_VARIABLE,
+        .type   = type,
+        .offset = offset,
+    };
+
+    Token op = { 0 };
+    op.kind = TOK_LITERAL_IDENT;
+    snprintf(op.value, ARRAY_LEN(op.value), "cse%d", c->temp_count++);
+
+    AstNode *init = ast_new_node(c->arena, expr->kind, type);
+    *init = *expr;
+
+    AstNode *decl = ast_new_node(c->arena, ASTNODE_VARDECL, type);
+    decl->stmt_vardecl = (StmtVarDecl) {
+        .op     = op,
+        .ident  = op,
+        .init   = init,
+        .type   = type,
+        .offset = offset,
+        .sym    = sym,
+    };
+
+    if (c->hoisted_len == c->hoisted_cap) {
+        c->hoisted_cap = c->hoisted_cap == 0 ? 8 : c->hoisted_cap * 2;
+        c->hoisted = NON_NULL(realloc(c->hoisted, c->hoisted_cap * sizeof(Hoisted)));
+    }
+    c->hoisted[c->hoisted_len++] = (Hoisted) { e->stmt, e->order, decl };
+
+    *expr = *ast_new_ident(c->arena, sym, op);
+    e->decl = decl;
+    stats.temporaries++;
+}
+
+
+
+NO_DISCARD static int fresh(Cse *c) {
+    return c->next_number++;
+}
+
+NO_DISCARD static int binding(Cse *c, Symbol *sym) {
+
+    for (size_t i=0; i < c->bindings_len; ++i)
+        if (c->bindings[i].sym == sym) return c->bindings[i].number;
+
+    if (c->bindings_len == c->bindings_cap) {
+        c->bindings_cap = c->bindings_cap == 0 ? 16 : c->bindings_cap * 2;
+        c->bindings = NON_NULL(realloc(c->bindings, c->bindings_cap * sizeof(Binding)));
+    }
+
+    int number = fresh(c);
+    c->bindings[c->bindings_len++] = (Binding) { sym, number };
+    return number;
+}
+
+// the variable holds a value that nothing numbered so far has been computed from
+static void rebind(Cse *c, const Symbol *sym) {
+    for (size_t i=0; i < c->bindings_len; ++i)
+        if (c->bindings[i].sym == sym) c->bindings[i].number = fresh(c);
+}
+
+// a store through a pointer, or a call, may change every load, and every
+// variable whose address is taken
+static void clobber(Cse *c) {
+
+    for (size_t i=0; i < c->exprs_len; ++i)
+        if (c->exprs[i].load) c->exprs[i].killed = true;
+
+    for (size_t i=0; i < c->bindings_len; ++i)
+        if (symbolset_contains(&c->addressed, c->bindings[i].sym)) c->bindings[i].number = fresh(c);
+
+    c->clobbered = true;
+}
+
+// forgets everything, when the basic block ends
+static void reset(Cse *c) {
+    c->exprs_len = 0;
+    c->bindings_len = 0;
+}
+
+// numbers an operation, or a constant if node is NULL. `mark` is where the
+// repetitions found in its operands start
+NO_DISCARD static Value operation(Cse *c, AstNode *node, Expr key, size_t mark) {
+
+    // after a side effect, the evaluation order decides what is repeated
+    if (!is_scalar(key.type) || c->assigned || (key.load && c->clobbered))
+        return (Value) { fresh(c), key.load };
+
+    for (size_t i=0; i < c->exprs_len; ++i) {
+        const Expr *e = &c->exprs[i];
+        if (e->killed || !same_key(e, &key)) continue;
+
+        // the parts of a repeated expression go along with it
+        if (node != NULL) {
+            c->matches_len = mark;
+
+            if (c->matches_len == c->matches_cap) {
+                c->matches_cap = c->matches_cap == 0 ? 8 : c->matches_cap * 2;
+                c->matches = NON_NULL(realloc(c->matches, c->matches_cap * sizeof(Match)));
+            }
+            c->matches[c->matches_len++] = (Match) { i, node };
+        }
+
+        return (Value) { e->number, e->load };
+    }
+
+    // what is computed conditionally, may not have been when it is repeated
+    if (node != NULL && c->conditional > 0)
+        return (Value) { fresh(c), key.load };
+
+    if (c->exprs_len == c->exprs_cap) {
+        c->exprs_cap = c->exprs_cap == 0 ? 16 : c->exprs_cap * 2;
+        c->exprs = NON_NULL(realloc(c->exprs, c->exprs_cap * sizeof(Expr)));
+    }
+
+    key.number = fresh(c);
+    key.killed = false;
+    key.first  = node;
+    key.stmt   = c->stmt;
+    key.order  = c->next_order++;
+    key.decl   = NULL;
+    c->exprs[c->exprs_len++] = key;
+
+    return (Value) { key.number, key.load };
+}
+
+// numbers the expression and everything in it, in the order it is evaluated
+static Value number(Cse *c, AstNode *node) {
+
+    size_t mark = c->matches_len;
+    TypeKind pointee = node->type.kind == TYPE_POINTER ? node->type.pointee->kind : TYPE_INVALID;
+
+    switch (node->kind) {
+        case ASTNODE_LITERAL: {
+            if (ast_is_constant(node)) {
+                Expr key = {
+                    .kind = ASTNODE_LITERAL,
+                    .type = node->type.kind,
+                    .lhs  = (int64_t) node->expr_literal.op.number,
+                };
+                return operation(c, NULL, key, mark);
+            }
+
+            // strings and procedures are not worth a variable
+            Symbol *sym = ast_variable(node);
+            if (sym == NULL) return (Value) { fresh(c), false };
+
+            return (Value) { binding(c, sym), symbolset_contains(&c->addressed, sym) };
+        }
+
+        case ASTNODE_GROUPING:
+            return number(c, node->expr_grouping.expr);
+
+        case ASTNODE_UNARYOP: {
+            ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+            // the address of a variable does not read it
+            if (unaryop->kind == UNARYOP_ADDROF) {
+                if (ast_variable(unaryop->node) == NULL)
+                    number(c, unaryop->node);
+                return (Value) { fresh(c), false };
+            }
+
+            Value operand = number(c, unaryop->node);
+            Expr key = {
+                .kind    = ASTNODE_UNARYOP,
+                .op      = unaryop->kind,
+                .type    = node->type.kind,
+                .pointee = pointee,
+                .lhs     = operand.number,
+                .load    = operand.load || unaryop->kind == UNARYOP_DEREF,
+            };
+            return operation(c, node, key, mark);
+        }
+
+        case ASTNODE_BINOP: {
+            ExprBinOp *binop = &node->expr_binop;
+
+            // the right operand is only evaluated depending on the left one
+            if (binop->kind == BINOP_LOG_AND || binop->kind == BINOP_LOG_OR) {
+                number(c, binop->lhs);
+                c->conditional++;
+                number(c, binop->rhs);
+                c->conditional--;
+                return (Value) { fresh(c), false };
+            }
+
+            // operands are evaluated right to left, except for the index of an
+            // address, which comes first. their side effects may happen either way
+            if (has_side_effects(binop->lhs) || has_side_effects(binop->rhs)) {
+                c->assigned = true;
+                c->clobbered = true;
+            }
+
+            Value rhs = number(c, binop->rhs);
+            Value lhs = number(c, binop->lhs);
+
+            if (is_commutative(binop->kind) && lhs.number > rhs.number) {
+                Value tmp = lhs;
+                lhs = rhs;
+                rhs = tmp;
+            }
+
+            Expr key = {
+                .kind    = ASTNODE_BINOP,
+                .op      = binop->kind,
+                .type    = node->type.kind,
+                .pointee = pointee,
+                .lhs     = lhs.number,
+                .rhs     = rhs.number,
+                .load    = lhs.load || rhs.load,
+            };
+            return operation(c, node, key, mark);
+        }
+
+        case ASTNODE_CALL: {
+            ExprCall *call = &node->expr_call;
+
+            for (size_t i=call->args.size; i-- > 0;)
+                number(c, call->args.items[i]);
+            number(c, call->callee);
+
+            clobber(c);
+            return (Value) { fresh(c), false };
+        }
+
+        case ASTNODE_ASSIGN: {
+            ExprAssign *assign = &node->expr_assign;
+            AstNode *target = assign->target;
+            Symbol *sym = ast_variable(target);
+
+            if (sym != NULL) {
+                number(c, assign->value);
+                rebind(c, sym);
+                c->assigned = true;
+
+                if (symbolset_contains(&c->addressed, sym))
+                    clobber(c);
+                return (Value) { fresh(c), false };
+            }
+
+            // the address of a deref is computed before the value
+            if (target->kind == ASTNODE_UNARYOP && target->expr_unaryop.kind == UNARYOP_DEREF)
+                number(c, target->expr_unaryop.node);
+            else
+                c->assigned = true;
+
+            number(c, assign->value);
+            clobber(c);
+            return (Value) { fresh(c), false };
+        }
+
+        case ASTNODE_ARRAY:
+            for (size_t i=0; i < node->expr_array.values.size; ++i)
+                number(c, node->expr_array.values.items[i]);
+
+            clobber(c);
+            return (Value) { fresh(c), false };
+
+        default:
+            c->assigned = true;
+            clobber(c);
+            return (Value) { fresh(c), false };
+    }
+}
+
+// replaces the repetitions of the current statement by the variables holding them
+static void replace_matches(Cse *c) {
+
+    for (size_t i=0; i < c->matches_len; ++i) {
+        const Match *match = &c->matches[i];
+        Expr *e = &c->exprs[match->expr];
+
+        if (e->decl == NULL)
+            new_temporary(c, e);
+
+        const StmtVarDecl *decl = &e->decl->stmt_vardecl;
+        *match->node = *ast_new_ident(c->arena, decl->sym, decl->ident);
+        stats.eliminated++;
+    }
+
+    c->matches_len = 0;
+}
+
+static void block(Cse *c, AstNode *node);
+
+static void statement(Cse *c, AstNode *node) {
+
+    c->assigned = false;
+    c->clobbered = false;
+
+    switch (node->kind) {
+        case ASTNODE_VARDECL: {
+            StmtVarDecl *vardecl = &node->stmt_vardecl;
+
+            if (vardecl->init != NULL)
+                number(c, vardecl->init);
+            rebind(c, vardecl->sym);
+
+            // the variable may have been pointed to in an earlier iteration
+            if (symbolset_contains(&c->addressed, vardecl->sym))
+                clobber(c);
+        } break;
+
+        case ASTNODE_RETURN:
+            if (node->stmt_return.expr != NULL)
+                number(c, node->stmt_return.expr);
+            break;
+
+        // the condition is evaluated once, in front of the branches
+        case ASTNODE_IF:
+            number(c, node->stmt_if.condition);
+            replace_matches(c);
+
+            if (node->stmt_if.then_body->kind == ASTNODE_BLOCK)
+                block(c, node->stmt_if.then_body);
+            if (node->stmt_if.else_body != NULL && node->stmt_if.else_body->kind == ASTNODE_BLOCK)
+                block(c, node->stmt_if.else_body);
+            reset(c);
+            break;
+
+        // the condition is evaluated in every iteration, vectorized loops are
+        // generated from the nodes as they are
+        case ASTNODE_WHILE:
+            if (node->stmt_while.vector == NULL && node->stmt_while.body->kind == ASTNODE_BLOCK)
+                block(c, node->stmt_while.body);
+            reset(c);
+            break;
+
+        case ASTNODE_BLOCK:
+            block(c, node);
+            break;
+
+        default:
+            number(c, node);
+            break;
+    }
+
+    replace_matches(c);
+}
+
+static int compare_order(const void *a, const void *b) {
+    const Hoisted *x = a, *y = b;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void block(Cse *c, AstNode *node) {
+
+    AstNodeList *stmts = &node->block.stmts;
+    size_t base = c->hoisted_len;
+
+    reset(c);
+    for (size_t i=0; i < stmts->size; ++i) {
+        c->stmt = i;
+        statement(c, stmts->items[i]);
+    }
+    reset(c);
+
+    if (c->hoisted_len == base) return;
+
+    // operands are declared before the expressions that have been computed from them
+    qsort(c->hoisted + base, c->hoisted_len - base, sizeof(Hoisted), compare_order);
+
+    AstNodeList list;
+    astnodelist_init(&list, c->arena);
+
+    size_t h = base;
+    for (size_t i=0; i < stmts->size; ++i) {
+        for (; h < c->hoisted_len && c->hoisted[h].stmt == i; ++h)
+            astnodelist_append(&list, c->hoisted[h].decl);
+        astnodelist_append(&list, stmts->items[i]);
+    }
+
+    node->block.stmts = list;
+    c->hoisted_len = base;
+}
+
+
+
+static void addressed(AstNode *node, UNUSED int _depth, void *args) {
+    Cse *c = args;
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+    Symbol *sym = ast_variable(unaryop->node);
+    if (unaryop->kind == UNARYOP_ADDROF && sym != NULL)
+        symbolset_add(&c->addressed, sym);
+}
+
+void eliminate_common_subexpressions(AstNode *root, Arena *arena) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    Cse c = { .arena = arena };
+    const AstNodeList *list = &root->block.stmts;
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL) continue;
+        if (node->stmt_proc.body->kind != ASTNODE_BLOCK) continue;
+
+        c.proc = &node->stmt_proc;
+        c.addressed.len = 0;
+
+        AstDispatchEntry addrs[] = {
+            { ASTNODE_UNARYOP, addressed, NULL },
+        };
+        parser_dispatch_ast(c.proc->body, addrs, ARRAY_LEN(addrs), &c);
+
+        block(&c, c.proc->body);
+    }
+
+    free(c.addressed.items);
+    free(c.exprs);
+    free(c.bindings);
+    free(c.matches);
+    free(c.hoisted);
+}
+
+void cse_print_stats(void) {
+    printf("CSE %-18s %d\n", "eliminated", stats.eliminated);
+    printf("CSE %-18s %d\n", "temporaries", stats.temporaries);
+}
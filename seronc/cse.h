@@ -0,0 +1,14 @@
+#ifndef _CSE_H
+#define _CSE_H
+
+#include <arena.h>
+#include "parser.h"
+
+// computes pure expressions that are repeated within a basic block only once,
+// into a new variable that the repetitions read instead
+// must be called after optimize_loops(), and before inline_calls() looks at the size of bodies
+void eliminate_common_subexpressions(AstNode *root, Arena *arena);
+// prints how many expressions have been eliminated so far
+void cse_print_stats(void);
+
+#endif // _CSE_H
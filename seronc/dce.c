@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "main.h"
+
+#include "dce.h"
+
+// code is removed at three levels:
+//
+// statements behind one that never finishes, which returns, or is an if whose
+// branches both do so, or a loop without a condition, are never executed.
+//
+// variables are dead if they are never read, only assigned to by statements
+// of their own. both the declaration and these statements are removed, but
+// their values are still evaluated if they call a procedure or assign to
+// anything else. removing them may leave other variables dead, so it is
+// repeated until none are left.
+//
+// procedures are kept if they can be reached from an entry point, by being
+// called or having their address taken. declarations of procedures that are
+// not defined in this file would otherwise still emit an `extern`
+
+static struct {
+    int unreachable, stores, procs, externs;
+} stats = { 0 };
+
+
+
+NO_DISCARD static bool is_endless(const AstNode *loop) {
+    const AstNode *cond = loop->stmt_while.condition;
+    return cond->kind == ASTNODE_LITERAL && cond->expr_literal.kind == LITERAL_NUMBER
+        && cond->expr_literal.op.number != 0;
+}
+
+// whether execution never continues behind the statement
+NO_DISCARD static bool terminates(const AstNode *node) {
+    switch (node->kind) {
+        case ASTNODE_RETURN:
+            return true;
+
+        case ASTNODE_BLOCK: {
+            const AstNodeList *list = &node->block.stmts;
+            return list->size > 0 && terminates(list->items[list->size - 1]);
+        }
+
+        case ASTNODE_IF: {
+            const StmtIf *cond = &node->stmt_if;
+            return cond->else_body != NULL && terminates(cond->then_body) && terminates(cond->else_body);
+        }
+
+        // there is no way out of a loop but returning
+        case ASTNODE_WHILE:
+            return is_endless(node);
+
+        default:
+            return false;
+    }
+}
+
+// blocks are visited after their statements, so nested blocks have been truncated already
+static void unreachable(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    AstNodeList *list = &node->block.stmts;
+
+    for (size_t i=0; i+1 < list->size; ++i) {
+        if (!terminates(list->items[i])) continue;
+
+        stats.unreachable += list->size - i - 1;
+        list->size = i + 1;
+    }
+}
+
+
+
+// variable of `<ident> = <value>`, NULL if the statement is no such assignment
+NO_DISCARD static Symbol *stored_variable(const AstNode *stmt) {
+    if (stmt->kind != ASTNODE_ASSIGN) return NULL;
+
+    const AstNode *target = stmt->expr_assign.target;
+    if (target->kind != ASTNODE_LITERAL || target->expr_literal.kind != LITERAL_IDENT) return NULL;
+
+    Symbol *sym = target->expr_literal.sym;
+    return sym->kind == SYMBOL_VARIABLE || sym->kind == SYMBOL_PARAMETER ? sym : NULL;
+}
+
+static void reset_reads(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    if (node->kind == ASTNODE_VARDECL)
+        node->stmt_vardecl.sym->reads = 0;
+    else if (node->expr_literal.sym != NULL)
+        node->expr_literal.sym->reads = 0;
+}
+
+// every use counts as a read, even taking the address
+static void count_read(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    if (node->expr_literal.sym != NULL)
+        node->expr_literal.sym->reads++;
+}
+
+// the targets of assignments that are statements have been counted as well
+static void uncount_stores(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    const AstNodeList *list = &node->block.stmts;
+
+    for (size_t i=0; i < list->size; ++i) {
+        Symbol *sym = stored_variable(list->items[i]);
+        if (sym != NULL)
+            sym->reads--;
+    }
+}
+
+static void side_effect(AstNode *node, UNUSED int _depth, void *args) {
+    bool *found = args;
+    if (node->kind == ASTNODE_CALL || node->kind == ASTNODE_ASSIGN)
+        *found = true;
+}
+
+NO_DISCARD static bool has_side_effects(AstNode *node) {
+    bool found = false;
+    parser_traverse_ast(node, side_effect, NULL, &found);
+    return found;
+}
+
+static void dead_stores(AstNode *node, UNUSED int _depth, void *args) {
+    bool *changed = args;
+    AstNodeList *list = &node->block.stmts;
+    size_t len = 0;
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *stmt = list->items[i];
+        Symbol *sym = stored_variable(stmt);
+        AstNode *value = sym != NULL ? stmt->expr_assign.value : NULL;
+
+        if (stmt->kind == ASTNODE_VARDECL) {
+            sym = stmt->stmt_vardecl.sym;
+            value = stmt->stmt_vardecl.init;
+        }
+
+        if (sym == NULL || sym->reads > 0) {
+            list->items[len++] = stmt;
+            continue;
+        }
+
+        if (value != NULL && has_side_effects(value))
+            list->items[len++] = value;
+
+        stats.stores++;
+        *changed = true;
+    }
+
+    list->size = len;
+}
+
+
+
+typedef struct {
+    AstNodeList *decls; // top level of the program
+    bool *reached;      // reached[i] is set if decls->items[i] is a reachable procedure
+} Eliminator;
+
+// every declaration of the procedure is reached, there may be one before its definition
+static void reference(AstNode *node, UNUSED int _depth, void *args) {
+    Eliminator *e = args;
+    const ExprLiteral *literal = &node->expr_literal;
+
+    if (literal->sym == NULL || literal->sym->kind != SYMBOL_PROCEDURE) return;
+
+    for (size_t i=0; i < e->decls->size; ++i) {
+        const AstNode *decl = e->decls->items[i];
+        if (decl->kind == ASTNODE_PROC && !strcmp(decl->stmt_proc.ident.value, literal->op.value))
+            e->reached[i] = true;
+    }
+}
+
+NO_DISCARD static bool is_entry(const DeclProc *proc) {
+    if (proc->body == NULL) return false;
+    return !compiler_ctx.whole_program || !strcmp(proc->ident.value, "main");
+}
+
+static void unused_procs(AstNode *root) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    AstNodeList *list = &root->block.stmts;
+
+    Eliminator e = {
+        .decls   = list,
+        .reached = NON_NULL(calloc(list->size + 1, sizeof(bool))),
+    };
+
+    bool *visited = NON_NULL(calloc(list->size + 1, sizeof(bool)));
+
+    for (size_t i=0; i < list->size; ++i) {
+        const AstNode *node = list->items[i];
+        e.reached[i] = node->kind == ASTNODE_PROC && is_entry(&node->stmt_proc);
+    }
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_LITERAL, reference, NULL },
+    };
+
+    // bodies reached for the first time may reach procedures that come before them
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i=0; i < list->size; ++i) {
+            AstNode *node = list->items[i];
+            if (!e.reached[i] || visited[i] || node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL)
+                continue;
+
+            visited[i] = true;
+            changed = true;
+            parser_dispatch_ast(node->stmt_proc.body, table, ARRAY_LEN(table), &e);
+        }
+    }
+
+    size_t len = 0;
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+
+        if (node->kind != ASTNODE_PROC || e.reached[i]) {
+            list->items[len++] = node;
+            continue;
+        }
+
+        const DeclProc *proc = &node->stmt_proc;
+
+        if (proc->body == NULL) {
+            if (compiler_ctx.stats)
+                printf("DCE extern %s: never called\n", proc->ident.value);
+            stats.externs++;
+        } else {
+            if (compiler_ctx.stats)
+                printf("DCE procedure %s: unreachable\n", proc->ident.value);
+            stats.procs++;
+        }
+    }
+
+    list->size = len;
+
+    free(e.reached);
+    free(visited);
+}
+
+void eliminate_dead_code(AstNode *root) {
+
+    AstDispatchEntry blocks[] = {
+        { ASTNODE_BLOCK, NULL, unreachable },
+    };
+
+    parser_dispatch_ast(root, blocks, ARRAY_LEN(blocks), NULL);
+
+    AstDispatchEntry reset[] = {
+        { ASTNODE_VARDECL, reset_reads, NULL },
+        { ASTNODE_LITERAL, reset_reads, NULL },
+    };
+
+    AstDispatchEntry reads[] = {
+        { ASTNODE_LITERAL, count_read,     NULL },
+        { ASTNODE_BLOCK,   uncount_stores, NULL },
+    };
+
+    AstDispatchEntry stores[] = {
+        { ASTNODE_BLOCK, NULL, dead_stores },
+    };
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        parser_dispatch_ast(root, reset, ARRAY_LEN(reset), NULL);
+        parser_dispatch_ast(root, reads, ARRAY_LEN(reads), NULL);
+        parser_dispatch_ast(root, stores, ARRAY_LEN(stores), &changed);
+    }
+
+    unused_procs(root);
+}
+
+void dce_print_stats(void) {
+    printf("DCE %-18s %d\n", "unreachable", stats.unreachable);
+    printf("DCE %-18s %d\n", "dead stores", stats.stores);
+    printf("DCE %-18s %d\n", "procedures",  stats.procs);
+    printf("DCE %-18s %d\n", "externs",     stats.externs);
+}
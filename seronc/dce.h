@@ -0,0 +1,15 @@
+#ifndef _DCE_H
+#define _DCE_H
+
+#include "parser.h"
+
+// removes statements that can never be reached, variables that are written
+// but never read, and procedures and externs that can not be reached from the
+// procedures called from outside, which are all of them, or only `main` with
+// -fwhole-program
+// must be called after fold(), as folding leaves such code behind
+void eliminate_dead_code(AstNode *root);
+// prints every procedure and extern that has been removed, and how much code
+void dce_print_stats(void);
+
+#endif // _DCE_H
@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <ver.h>
+
+#include "diagnostics.h"
+#include "emitter.h"
+#include "main.h"
+
+
+
+typedef struct {
+    const char *str;
+    size_t len;
+} Fragment;
+
+#define FRAG(s) { (s), sizeof(s) - 1 }
+
+static const Fragment mnemonics[OP_COUNT] = {
+    [OP_MOV]   = FRAG("mov"),
+    [OP_MOVZX] = FRAG("movzx"),
+    [OP_MOVSX] = FRAG("movsx"),
+    [OP_MOVSXD] = FRAG("movsxd"),
+    [OP_LEA]   = FRAG("lea"),
+    [OP_ADD]   = FRAG("add"),
+    [OP_SUB]   = FRAG("sub"),
+    [OP_IMUL]  = FRAG("imul"),
+    [OP_IDIV]  = FRAG("idiv"),
+    [OP_CDQ]   = FRAG("cdq"),
+    [OP_CQO]   = FRAG("cqo"),
+    [OP_NEG]   = FRAG("neg"),
+    [OP_AND]   = FRAG("and"),
+    [OP_OR]    = FRAG("or"),
+    [OP_SHL]   = FRAG("shl"),
+    [OP_SHR]   = FRAG("shr"),
+    [OP_SAR]   = FRAG("sar"),
+    [OP_CMP]   = FRAG("cmp"),
+    [OP_SETE]  = FRAG("sete"),
+    [OP_SETNE] = FRAG("setne"),
+    [OP_SETG]  = FRAG("setg"),
+    [OP_SETGE] = FRAG("setge"),
+    [OP_SETL]  = FRAG("setl"),
+    [OP_SETLE] = FRAG("setle"),
+    [OP_PUSH]  = FRAG("push"),
+    [OP_POP]   = FRAG("pop"),
+    [OP_CALL]  = FRAG("call"),
+    [OP_JMP]   = FRAG("jmp"),
+    [OP_JE]    = FRAG("je"),
+    [OP_JNE]   = FRAG("jne"),
+    [OP_JG]    = FRAG("jg"),
+    [OP_JGE]   = FRAG("jge"),
+    [OP_JL]    = FRAG("jl"),
+    [OP_JLE]   = FRAG("jle"),
+    [OP_RET]   = FRAG("ret"),
+
+    [OP_MOVD]       = FRAG("movd"),
+    [OP_MOVQ]       = FRAG("movq"),
+    [OP_MOVDQU]     = FRAG("movdqu"),
+    [OP_MOVDQA]     = FRAG("movdqa"),
+    [OP_PXOR]       = FRAG("pxor"),
+    [OP_PAND]       = FRAG("pand"),
+    [OP_PANDN]      = FRAG("pandn"),
+    [OP_POR]        = FRAG("por"),
+    [OP_PADDB]      = FRAG("paddb"),
+    [OP_PADDD]      = FRAG("paddd"),
+    [OP_PADDQ]      = FRAG("paddq"),
+    [OP_PSUBB]      = FRAG("psubb"),
+    [OP_PSUBD]      = FRAG("psubd"),
+    [OP_PSUBQ]      = FRAG("psubq"),
+    [OP_PCMPEQB]    = FRAG("pcmpeqb"),
+    [OP_PCMPEQD]    = FRAG("pcmpeqd"),
+    [OP_PCMPEQQ]    = FRAG("pcmpeqq"),
+    [OP_PCMPGTB]    = FRAG("pcmpgtb"),
+    [OP_PCMPGTD]    = FRAG("pcmpgtd"),
+    [OP_PCMPGTQ]    = FRAG("pcmpgtq"),
+    [OP_PMULLD]     = FRAG("pmulld"),
+    [OP_PUNPCKLBW]  = FRAG("punpcklbw"),
+    [OP_PUNPCKLWD]  = FRAG("punpcklwd"),
+    [OP_PUNPCKLDQ]  = FRAG("punpckldq"),
+    [OP_PUNPCKLQDQ] = FRAG("punpcklqdq"),
+    [OP_PSRLDQ]     = FRAG("psrldq"),
+
+    [OP_VPBROADCASTB] = FRAG("vpbroadcastb"),
+    [OP_VPBROADCASTD] = FRAG("vpbroadcastd"),
+    [OP_VPBROADCASTQ] = FRAG("vpbroadcastq"),
+    [OP_VEXTRACTI128] = FRAG("vextracti128"),
+    [OP_VZEROUPPER]   = FRAG("vzeroupper"),
+};
+
+// SSE2 instructions, whose VEX encoding has a separate destination operand
+// moves are the only ones that do not read their destination
+NO_DISCARD static bool is_sse(Opcode op) {
+    return op >= OP_MOVD && op <= OP_PSRLDQ;
+}
+
+NO_DISCARD static bool is_move(Opcode op) {
+    return op == OP_MOVD || op == OP_MOVQ || op == OP_MOVDQU || op == OP_MOVDQA;
+}
+
+// indexed by register and log2 of the size in bytes
+static const Fragment registers[REG_COUNT][6] = {
+    [REG_RAX] = { FRAG("al"),   FRAG("ax"),   FRAG("eax"),  FRAG("rax") },
+    [REG_RBX] = { FRAG("bl"),   FRAG("bx"),   FRAG("ebx"),  FRAG("rbx") },
+    [REG_RCX] = { FRAG("cl"),   FRAG("cx"),   FRAG("ecx"),  FRAG("rcx") },
+    [REG_RDX] = { FRAG("dl"),   FRAG("dx"),   FRAG("edx"),  FRAG("rdx") },
+    [REG_RSI] = { FRAG("sil"),  FRAG("si"),   FRAG("esi"),  FRAG("rsi") },
+    [REG_RDI] = { FRAG("dil"),  FRAG("di"),   FRAG("edi"),  FRAG("rdi") },
+    [REG_RBP] = { FRAG("bpl"),  FRAG("bp"),   FRAG("ebp"),  FRAG("rbp") },
+    [REG_RSP] = { FRAG("spl"),  FRAG("sp"),   FRAG("esp"),  FRAG("rsp") },
+    [REG_R8]  = { FRAG("r8b"),  FRAG("r8w"),  FRAG("r8d"),  FRAG("r8")  },
+    [REG_R9]  = { FRAG("r9b"),  FRAG("r9w"),  FRAG("r9d"),  FRAG("r9")  },
+    [REG_R10] = { FRAG("r10b"), FRAG("r10w"), FRAG("r10d"), FRAG("r10") },
+    [REG_R11] = { FRAG("r11b"), FRAG("r11w"), FRAG("r11d"), FRAG("r11") },
+    [REG_R12] = { FRAG("r12b"), FRAG("r12w"), FRAG("r12d"), FRAG("r12") },
+    [REG_R13] = { FRAG("r13b"), FRAG("r13w"), FRAG("r13d"), FRAG("r13") },
+    [REG_R14] = { FRAG("r14b"), FRAG("r14w"), FRAG("r14d"), FRAG("r14") },
+    [REG_R15] = { FRAG("r15b"), FRAG("r15w"), FRAG("r15d"), FRAG("r15") },
+    [REG_XMM0] = { [4] = FRAG("xmm0"), [5] = FRAG("ymm0") },
+    [REG_XMM1] = { [4] = FRAG("xmm1"), [5] = FRAG("ymm1") },
+    [REG_XMM2] = { [4] = FRAG("xmm2"), [5] = FRAG("ymm2") },
+    [REG_XMM3] = { [4] = FRAG("xmm3"), [5] = FRAG("ymm3") },
+};
+
+static const Fragment size_keywords[6] = {
+    FRAG("byte "), FRAG("word "), FRAG("dword "), FRAG("qword "), FRAG("oword "), FRAG("yword "),
+};
+
+static const Fragment labels[LABEL_COUNT] = {
+    [LABEL_ELSE]   = FRAG(".else"),
+    [LABEL_END]    = FRAG(".end"),
+    [LABEL_WHILE]  = FRAG(".while"),
+    [LABEL_COND]   = FRAG(".cond"),
+    [LABEL_SKIP]   = FRAG(".skip"),
+    [LABEL_RETURN] = FRAG(".return"),
+    [LABEL_INLINE] = FRAG(".inline"),
+    [LABEL_ENTRY]  = FRAG(".entry"),
+    [LABEL_BLOCK]  = FRAG(".block"),
+    [LABEL_STRING] = FRAG("string_"),
+};
+
+
+
+void buffer_init(Buffer *buf) {
+    *buf = (Buffer) { 0 };
+}
+
+void buffer_destroy(Buffer *buf) {
+    free(buf->items);
+    buf->items = NULL;
+}
+
+static inline void buffer_reserve(Buffer *buf, size_t len) {
+    if (buf->len + len <= buf->cap) return;
+
+    if (buf->cap == 0)
+        buf->cap = 4096;
+
+    while (buf->len + len > buf->cap)
+        buf->cap *= 2;
+
+    buf->items = NON_NULL(realloc(buf->items, buf->cap));
+}
+
+void buffer_append_mem(Buffer *buf, const char *mem, size_t len) {
+    buffer_reserve(buf, len);
+    memcpy(buf->items + buf->len, mem, len);
+    buf->len += len;
+}
+
+void buffer_append_str(Buffer *buf, const char *str) {
+    buffer_append_mem(buf, str, strlen(str));
+}
+
+static inline void buffer_append_char(Buffer *buf, char c) {
+    buffer_reserve(buf, 1);
+    buf->items[buf->len++] = c;
+}
+
+static inline void buffer_append_frag(Buffer *buf, Fragment frag) {
+    buffer_append_mem(buf, frag.str, frag.len);
+}
+
+void buffer_append_int(Buffer *buf, int64_t value) {
+    char digits[20];
+    size_t len = 0;
+
+    // negate in unsigned arithmetic, so INT64_MIN does not overflow
+    uint64_t abs = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+    do {
+        digits[len++] = '0' + abs % 10;
+        abs /= 10;
+    } while (abs);
+
+    buffer_reserve(buf, len + 1);
+
+    if (value < 0)
+        buf->items[buf->len++] = '-';
+
+    while (len)
+        buf->items[buf->len++] = digits[--len];
+}
+
+
+
+NO_DISCARD static int size_index(int size) {
+    switch (size) {
+        case 1: return 0;
+        case 2: return 1;
+        case 4: return 2;
+        case 8: return 3;
+        case 16: return 4;
+        case 32: return 5;
+        default: PANIC("invalid operand size");
+    }
+    UNREACHABLE();
+}
+
+// immediates are truncated to the size of the operand they're written to
+NO_DISCARD static int64_t truncate_imm(int64_t imm, int size) {
+    switch (size) {
+        case 1:  return (int8_t)  imm;
+        case 2:  return (int16_t) imm;
+        case 4:  return (int32_t) imm;
+        default: return imm;
+    }
+}
+
+static void emit_operand(Buffer *buf, const Operand *op, bool sized) {
+    switch (op->kind) {
+        case OPERAND_REG:
+            buffer_append_frag(buf, registers[op->reg][size_index(op->size)]);
+            break;
+
+        case OPERAND_IMM:
+            buffer_append_int(buf, truncate_imm(op->imm, op->size));
+            break;
+
+        case OPERAND_MEM:
+            if (sized)
+                buffer_append_frag(buf, size_keywords[size_index(op->size)]);
+
+            buffer_append_char(buf, '[');
+            buffer_append_frag(buf, registers[op->reg][3]);
+
+            if (op->index != REG_INVALID) {
+                buffer_append_char(buf, '+');
+                buffer_append_frag(buf, registers[op->index][3]);
+                buffer_append_char(buf, '*');
+                buffer_append_int(buf, op->scale);
+            }
+
+            if (op->imm != 0) {
+                buffer_append_char(buf, op->imm < 0 ? '-' : '+');
+                buffer_append_int(buf, op->imm < 0 ? -op->imm : op->imm);
+            }
+
+            buffer_append_char(buf, ']');
+            break;
+
+        case OPERAND_LABEL:
+            buffer_append_frag(buf, labels[op->label]);
+            if (op->id >= 0)
+                buffer_append_int(buf, op->id);
+            break;
+
+        case OPERAND_SYMBOL:
+            buffer_append_str(buf, op->symbol);
+            break;
+
+        case OPERAND_NONE:
+            PANIC("missing operand");
+    }
+}
+
+void emitter_ins(Buffer *buf, const Instruction *ins) {
+
+    const Operand *dst = &ins->dst;
+    const Operand *src = &ins->src;
+
+    if (ins->op == OP_LABEL) {
+        emitter_label(buf, dst->label, dst->id);
+        return;
+    }
+
+    bool vex = compiler_ctx.avx2 && is_sse(ins->op);
+    if (vex)
+        buffer_append_char(buf, 'v');
+
+    buffer_append_frag(buf, mnemonics[ins->op]);
+
+    // memory operands only need an explicit size, if no register determines it
+    bool sized = dst->kind != OPERAND_REG && src->kind != OPERAND_REG;
+
+    if (dst->kind != OPERAND_NONE) {
+        buffer_append_char(buf, ' ');
+        emit_operand(buf, dst, sized);
+    }
+
+    if (vex && !is_move(ins->op)) {
+        buffer_append_mem(buf, ", ", 2);
+        emit_operand(buf, dst, sized);
+    }
+
+    if (src->kind != OPERAND_NONE) {
+        buffer_append_mem(buf, ", ", 2);
+        emit_operand(buf, src, sized);
+    }
+
+    if (ins->op == OP_VEXTRACTI128)
+        buffer_append_mem(buf, ", 1", 3);
+
+    if (ins->comment != NULL) {
+        buffer_append_mem(buf, " ; ", 3);
+        buffer_append_str(buf, ins->comment);
+    }
+
+    buffer_append_char(buf, '\n');
+}
+
+void emitter_instructionlist(Buffer *buf, const InstructionList *list) {
+    for (size_t i=0; i < list->len; ++i)
+        emitter_ins(buf, &list->items[i]);
+}
+
+void emitter_label(Buffer *buf, LabelKind label, int id) {
+    buffer_append_frag(buf, labels[label]);
+    if (id >= 0)
+        buffer_append_int(buf, id);
+    buffer_append_mem(buf, ":\n", 2);
+}
+
+void emitter_proc_label(Buffer *buf, const char *ident) {
+    buffer_append_str(buf, ident);
+    buffer_append_mem(buf, ":\n", 2);
+}
+
+void emitter_global(Buffer *buf, const char *ident) {
+    buffer_append_mem(buf, "global ", 7);
+    buffer_append_str(buf, ident);
+    buffer_append_char(buf, '\n');
+}
+
+void emitter_extern(Buffer *buf, const char *ident) {
+    buffer_append_mem(buf, "extern ", 7);
+    buffer_append_str(buf, ident);
+    buffer_append_char(buf, '\n');
+}
+
+void emitter_string(Buffer *buf, int id, const char *str) {
+    emitter_label(buf, LABEL_STRING, id);
+    buffer_append_mem(buf, "db \"", 4);
+    buffer_append_str(buf, str);
+    buffer_append_mem(buf, "\", 0\n", 5);
+}
+
+void emitter_write_file(const char *path, const Buffer *data, const Buffer *text) {
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        diagnostic(DIAG_ERROR, "Failed to open output file %s", path);
+        exit(EXIT_FAILURE);
+    }
+
+    static const char data_header[] = "section .data\n";
+    static const char text_header[] = "section .text\n";
+
+    struct iovec iov[4];
+    int iovcnt = 0;
+
+    if (data->len) {
+        iov[iovcnt++] = (struct iovec) { (void*) data_header, sizeof(data_header) - 1 };
+        iov[iovcnt++] = (struct iovec) { data->items, data->len };
+    }
+
+    if (text->len) {
+        iov[iovcnt++] = (struct iovec) { (void*) text_header, sizeof(text_header) - 1 };
+        iov[iovcnt++] = (struct iovec) { text->items, text->len };
+    }
+
+    struct iovec *cur = iov;
+
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, cur, iovcnt);
+
+        if (written == -1) {
+            diagnostic(DIAG_ERROR, "Failed to write output file %s", path);
+            exit(EXIT_FAILURE);
+        }
+
+        // skip over everything that has been written, in case of a short write
+        while (iovcnt > 0 && (size_t) written >= cur->iov_len) {
+            written -= cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0) {
+            cur->iov_base = (char*) cur->iov_base + written;
+            cur->iov_len -= written;
+        }
+    }
+
+    close(fd);
+}
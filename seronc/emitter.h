@@ -0,0 +1,42 @@
+#ifndef _EMITTER_H
+#define _EMITTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <ver.h>
+
+#include "types.h"
+#include "instruction.h"
+
+// fast NASM text emitter
+// instructions are formatted straight into a growable buffer, by copying
+// pre-built fragments for mnemonics and registers, instead of going through printf
+
+
+
+typedef struct {
+    size_t cap, len;
+    char *items;
+} Buffer;
+
+void buffer_init(Buffer *buf);
+void buffer_destroy(Buffer *buf);
+void buffer_append_mem(Buffer *buf, const char *mem, size_t len);
+void buffer_append_str(Buffer *buf, const char *str);
+void buffer_append_int(Buffer *buf, int64_t value);
+
+void emitter_ins(Buffer *buf, const Instruction *ins);
+// prints the instructions in NASM syntax
+void emitter_instructionlist(Buffer *buf, const InstructionList *list);
+void emitter_label(Buffer *buf, LabelKind label, int id);
+void emitter_proc_label(Buffer *buf, const char *ident);
+void emitter_global(Buffer *buf, const char *ident);
+void emitter_extern(Buffer *buf, const char *ident);
+void emitter_string(Buffer *buf, int id, const char *str);
+// writes both sections with a single system call
+void emitter_write_file(const char *path, const Buffer *data, const Buffer *text);
+
+
+
+#endif // _EMITTER_H
@@ -43,6 +43,7 @@ static void for_pre(AstNode *node, UNUSED int _depth, void *args) {
         .op        = op,
         .condition = cond,
         .body      = body,
+        .unroll    = for_->unroll,
     };
 
     node->kind = ASTNODE_BLOCK;
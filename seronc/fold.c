@@ -0,0 +1,232 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+
+#include "fold.h"
+
+// every callback runs after the children of its node have been folded, so a
+// whole constant expression collapses into a single literal bottom up.
+// variables are only propagated if no assignment or address-of refers to
+// them anywhere, which is determined in a separate pass beforehand
+
+static struct {
+    int binops, unaryops, groupings, variables, branches;
+} stats = { 0 };
+
+
+
+NO_DISCARD static NumberLiteralType number_type(TypeKind type) {
+    switch (type) {
+        case TYPE_CHAR: return NUMBER_CHAR;
+        case TYPE_LONG: return NUMBER_LONG;
+        default:        return NUMBER_INT;
+    }
+}
+
+// turns node into a number literal of its own type
+// `op` is only kept for its location
+static void make_constant(AstNode *node, uint64_t value, Token op) {
+    Type type = node->type;
+
+    op.kind        = TOK_LITERAL_NUMBER;
+    op.number      = ast_wrap(value, type.kind);
+    op.number_type = number_type(type.kind);
+    snprintf(op.value, ARRAY_LEN(op.value), "%ld", (int64_t) op.number);
+
+    node->kind = ASTNODE_LITERAL;
+    node->expr_literal = (ExprLiteral) {
+        .op   = op,
+        .kind = LITERAL_NUMBER,
+        .sym  = NULL,
+    };
+}
+
+static void make_empty_block(AstNode *node, Arena *arena) {
+    node->kind = ASTNODE_BLOCK;
+    astnodelist_init(&node->block.stmts, arena);
+}
+
+
+
+static void assign_pre(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    AstNode *target = node->expr_assign.target;
+
+    if (target->kind == ASTNODE_LITERAL && target->expr_literal.sym != NULL)
+        target->expr_literal.sym->written = true;
+}
+
+static void unaryop_pre(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+    AstNode *operand = unaryop->node;
+
+    // the variable may be written through the pointer
+    if (unaryop->kind == UNARYOP_ADDROF && operand->kind == ASTNODE_LITERAL && operand->expr_literal.sym != NULL)
+        operand->expr_literal.sym->written = true;
+}
+
+
+
+static void binop(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    ExprBinOp *binop = &node->expr_binop;
+    AstNode *lhs = binop->lhs;
+    AstNode *rhs = binop->rhs;
+
+    // pointer arithmetic depends on the size of the pointee, and is left to codegen
+    if (!ast_is_integer(node->type.kind)) return;
+
+    // short-circuiting operators may already be decided by their lhs
+    if (ast_is_constant(lhs)) {
+        bool value = ast_constant(lhs) != 0;
+
+        if ((binop->kind == BINOP_LOG_AND && !value) || (binop->kind == BINOP_LOG_OR && value)) {
+            make_constant(node, value, binop->op);
+            stats.binops++;
+            return;
+        }
+    }
+
+    if (!ast_is_constant(lhs) || !ast_is_constant(rhs)) return;
+
+    int64_t a = ast_constant(lhs);
+    int64_t b = ast_constant(rhs);
+    // arithmetic is done unsigned, so overflow wraps around
+    uint64_t result = 0;
+
+    switch (binop->kind) {
+        case BINOP_ADD:         result = (uint64_t) a + (uint64_t) b; break;
+        case BINOP_SUB:         result = (uint64_t) a - (uint64_t) b; break;
+        case BINOP_MUL:         result = (uint64_t) a * (uint64_t) b; break;
+        case BINOP_EQ:          result = a == b;                      break;
+        case BINOP_NEQ:         result = a != b;                      break;
+        case BINOP_GT:          result = a >  b;                      break;
+        case BINOP_GT_EQ:       result = a >= b;                      break;
+        case BINOP_LT:          result = a <  b;                      break;
+        case BINOP_LT_EQ:       result = a <= b;                      break;
+        case BINOP_BITWISE_OR:  result = a | b;                       break;
+        case BINOP_BITWISE_AND: result = a & b;                       break;
+        case BINOP_LOG_OR:      result = a || b;                      break;
+        case BINOP_LOG_AND:     result = a && b;                      break;
+
+        case BINOP_DIV:
+            // division by zero and overflowing divisions trap at runtime,
+            // which must not be turned into a compile time error
+            if (b == 0 || (b == -1 && a == INT64_MIN)) return;
+            if (ast_wrap(a / b, node->type.kind) != a / b) return;
+            result = a / b;
+            break;
+    }
+
+    make_constant(node, result, binop->op);
+    stats.binops++;
+}
+
+static void unaryop(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+    if (!ast_is_constant(unaryop->node) || !ast_is_integer(node->type.kind)) return;
+    int64_t value = ast_constant(unaryop->node);
+
+    switch (unaryop->kind) {
+        case UNARYOP_MINUS: make_constant(node, -(uint64_t) value, unaryop->op); break;
+        case UNARYOP_NEG:   make_constant(node, value == 0,        unaryop->op); break;
+        case UNARYOP_ADDROF:
+        case UNARYOP_DEREF:
+            return;
+    }
+
+    stats.unaryops++;
+}
+
+static void grouping(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    AstNode *expr = node->expr_grouping.expr;
+    if (!ast_is_constant(expr)) return;
+
+    make_constant(node, ast_constant(expr), expr->expr_literal.op);
+    stats.groupings++;
+}
+
+static void literal(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    ExprLiteral *literal = &node->expr_literal;
+    Symbol *sym = literal->sym;
+
+    if (literal->kind != LITERAL_IDENT || sym == NULL) return;
+    if (sym->kind != SYMBOL_VARIABLE || !sym->constant) return;
+
+    make_constant(node, sym->value, literal->op);
+    stats.variables++;
+}
+
+static void vardecl(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    StmtVarDecl *vardecl = &node->stmt_vardecl;
+    Symbol *sym = vardecl->sym;
+
+    // the declaration is visited before any use of the variable, as it is
+    // only bound after its own initializer. copies of an unrolled loop share
+    // the symbol, so a declaration that is not constant resets it again
+    if (vardecl->init == NULL || sym->written || !ast_is_constant(vardecl->init)) {
+        sym->constant = false;
+        return;
+    }
+
+    sym->constant = true;
+    sym->value = ast_constant(vardecl->init);
+}
+
+static void cond(AstNode *node, UNUSED int _depth, void *args) {
+    Arena *arena = args;
+    StmtIf *cond = &node->stmt_if;
+
+    if (!ast_is_constant(cond->condition)) return;
+
+    AstNode *taken = ast_constant(cond->condition) ? cond->then_body : cond->else_body;
+
+    if (taken != NULL)
+        *node = *taken;
+    else
+        make_empty_block(node, arena);
+
+    stats.branches++;
+}
+
+static void while_(AstNode *node, UNUSED int _depth, void *args) {
+    Arena *arena = args;
+    StmtWhile *loop = &node->stmt_while;
+
+    if (!ast_is_constant(loop->condition) || ast_constant(loop->condition) != 0) return;
+
+    make_empty_block(node, arena);
+    stats.branches++;
+}
+
+void fold(AstNode *root, Arena *arena) {
+
+    AstDispatchEntry writes[] = {
+        { ASTNODE_ASSIGN,  assign_pre,  NULL },
+        { ASTNODE_UNARYOP, unaryop_pre, NULL },
+    };
+
+    parser_dispatch_ast(root, writes, ARRAY_LEN(writes), NULL);
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_BINOP,    NULL, binop    },
+        { ASTNODE_UNARYOP,  NULL, unaryop  },
+        { ASTNODE_GROUPING, NULL, grouping },
+        { ASTNODE_LITERAL,  NULL, literal  },
+        { ASTNODE_VARDECL,  NULL, vardecl  },
+        { ASTNODE_IF,       NULL, cond     },
+        { ASTNODE_WHILE,    NULL, while_   },
+    };
+
+    parser_dispatch_ast(root, table, ARRAY_LEN(table), arena);
+}
+
+void fold_print_stats(void) {
+    printf("FOLD %-18s %d\n", "binops",    stats.binops);
+    printf("FOLD %-18s %d\n", "unaryops",  stats.unaryops);
+    printf("FOLD %-18s %d\n", "groupings", stats.groupings);
+    printf("FOLD %-18s %d\n", "variables", stats.variables);
+    printf("FOLD %-18s %d\n", "branches",  stats.branches);
+}
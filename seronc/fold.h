@@ -0,0 +1,14 @@
+#ifndef _FOLD_H
+#define _FOLD_H
+
+#include <arena.h>
+#include "parser.h"
+
+// folds constant expressions, propagates variables that are never written
+// after being initialized with a constant, and removes branches that are never taken
+// must be called after typecheck(), as results wrap around at the width of their type
+void fold(AstNode *root, Arena *arena);
+// prints how many nodes have been folded so far
+void fold_print_stats(void);
+
+#endif // _FOLD_H
@@ -13,29 +13,33 @@ const char *stringify_typekind(TypeKind type) {
         case TYPE_POINTER:   return "pointer"; break;
         case TYPE_VOID:      return "void";    break;
         case TYPE_PROCEDURE: return "proc";    break;
+        case TYPE_OBJECT:    return "object";  break;
+        case TYPE_TABLE:     return "table";   break;
         default:             PANIC("unknown type");
     }
 }
 
 
 static size_t hash(size_t size, const char *key) {
-    // sum up the ascii representation of the string
-    size_t sum = 0;
+    // FNV-1a
+    size_t h = 14695981039346656037UL;
 
-    for (size_t i=0; i < strlen(key); ++i)
-        sum += (size_t) key[i] * i;
+    for (const char *c=key; *c; c++) {
+        h ^= (unsigned char) *c;
+        h *= 1099511628211UL;
+    }
 
-    return sum % size;
+    return h % size;
 }
 
-static HashtableEntry *new_entry(Arena *arena, const char *key, Symbol value) {
+static HashtableEntry *new_entry(Arena *arena, const char *key) {
 
     HashtableEntry *entry = NON_NULL(arena_alloc(arena, sizeof(HashtableEntry)));
     *entry = (HashtableEntry) {
-        .value = value,
+        .value = NULL,
         .next  = NULL,
     };
-    strncpy(entry->key, key, ARRAY_LEN(entry->key));
+    strncpy(entry->key, key, ARRAY_LEN(entry->key) - 1);
 
     return entry;
 }
@@ -44,7 +48,6 @@ void hashtable_init(Hashtable *ht, size_t size, Arena *arena) {
     *ht = (Hashtable) {
         .size     = size,
         .buckets  = NULL,
-        .parent   = NULL,
         .arena    = arena,
     };
 
@@ -54,49 +57,32 @@ void hashtable_init(Hashtable *ht, size_t size, Arena *arena) {
         ht->buckets[i] = NULL;
 }
 
-int hashtable_insert(Hashtable *ht, const char *key, Symbol value) {
+HashtableEntry *hashtable_intern(Hashtable *ht, const char *key) {
 
     NON_NULL(ht);
 
     size_t index = hash(ht->size, key);
-    HashtableEntry *current = ht->buckets[index];
-
-    if (current == NULL) {
-        ht->buckets[index] = new_entry(ht->arena, key, value);
-        return 0;
-    }
 
-    while (current != NULL) {
+    for (HashtableEntry *current = ht->buckets[index]; current != NULL; current = current->next)
         if (!strcmp(current->key, key))
-            return -1;
+            return current;
 
-        if (current->next == NULL) {
-            current->next = new_entry(ht->arena, key, value);
-            return 0;
-        }
-
-        current = current->next;
-    }
+    HashtableEntry *entry = new_entry(ht->arena, key);
+    entry->next = ht->buckets[index];
+    ht->buckets[index] = entry;
 
-    UNREACHABLE();
+    return entry;
 }
 
-Symbol *hashtable_get(const Hashtable *ht, const char *key) {
+HashtableEntry *hashtable_get(const Hashtable *ht, const char *key) {
 
     NON_NULL(ht);
 
     size_t index = hash(ht->size, key);
-    HashtableEntry *current = ht->buckets[index];
-
-    if (current == NULL)
-        return NULL;
 
-    while (current != NULL) {
+    for (HashtableEntry *current = ht->buckets[index]; current != NULL; current = current->next)
         if (!strcmp(current->key, key))
-            return &current->value;
-
-        current = current->next;
-    }
+            return current;
 
     return NULL;
 
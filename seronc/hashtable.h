@@ -26,34 +26,39 @@ typedef enum {
     SYMBOL_TABLE,
 } SymbolKind;
 
-typedef struct {
+typedef struct Symbol {
     SymbolKind kind;
     Type type;
     union {
         int offset; // var / param
     };
+    // set by fold() for variables
+    bool written;  // assigned to, or address taken after the declaration
+    bool constant; // never written, and initialized with a constant
+    int64_t value; // value of constant variables
+    int reads;     // uses other than being assigned to by a statement, set by eliminate_dead_code()
+    struct Symbol *shadowed; // binding of the same name in an outer scope, NULL if none
 } Symbol;
 
+// every distinct name has exactly one entry, so the entry doubles as the interned name
 typedef struct HashtableEntry {
     char key[MAX_IDENT_LEN];
     struct HashtableEntry *next;
-    Symbol value;
+    Symbol *value; // innermost binding, NULL if the name is currently unbound
 } HashtableEntry;
 
 // separate-chaining hashtable
 typedef struct Hashtable {
     size_t size;
     HashtableEntry **buckets;
-    struct Hashtable *parent;
     Arena *arena;
 } Hashtable;
 
 void hashtable_init(Hashtable *ht, size_t size, Arena *arena);
-void hashtable_destroy(Hashtable *ht);
-/* returns -1 if key already exists, else 0 */
-int hashtable_insert(Hashtable *ht, const char *key, Symbol value);
+/* returns the entry for key, creating an unbound one if it does not exist yet */
+HashtableEntry *hashtable_intern(Hashtable *ht, const char *key);
 /* returns NULL if the key does not exist */
-Symbol *hashtable_get(const Hashtable *ht, const char *key);
+HashtableEntry *hashtable_get(const Hashtable *ht, const char *key);
 
 
 #endif // _HASHTABLE_H
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+#include "main.h"
+
+#include "inline.h"
+
+// the decision is made per call site, but only depends on the callee: it has
+// to be defined in this file, small enough, and must not be able to reach
+// itself through the call graph, as codegen() would never stop expanding it.
+// calls through function pointers are never inlined.
+// bodies are not copied, codegen() generates the callee's body in place of
+// the call, with its locals moved below the frame of the caller
+
+static struct {
+    int inlined, too_large, recursive;
+} stats = { 0 };
+
+typedef struct {
+    AstNode *node;
+    int size;                  // AST nodes of the body, counted once
+    bool recursive;            // may reach itself through the call graph
+    size_t calls, calls_end;   // its callees are edges[calls] up to edges[calls_end]
+    size_t index, lowlink;     // visit order of find_recursion(), 0 if not visited yet
+    bool on_stack;
+} Proc;
+
+typedef struct {
+    Proc *procs;       // every procedure with a body, sorted by name
+    size_t procs_len;
+    size_t *edges;     // callees of all procedures, as indices into procs
+    size_t edges_len, edges_cap;
+    size_t *stack;     // procedures whose component is not complete yet
+    size_t stack_len;
+    size_t visits;
+    size_t current;    // procedure that is being visited
+    int limit;
+} Inliner;
+
+
+
+NO_DISCARD static bool is_direct_call(const AstNode *callee) {
+    return callee->kind == ASTNODE_LITERAL && callee->expr_literal.kind == LITERAL_IDENT
+        && callee->expr_literal.sym->kind == SYMBOL_PROCEDURE;
+}
+
+static int compare_procs(const void *a, const void *b) {
+    return strcmp(((const Proc*) a)->node->stmt_proc.ident.value, ((const Proc*) b)->node->stmt_proc.ident.value);
+}
+
+// returns procs_len if there is no procedure with a body of that name
+NO_DISCARD static size_t find_proc(const Inliner *in, const char *ident) {
+    size_t lo = 0, hi = in->procs_len;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(in->procs[mid].node->stmt_proc.ident.value, ident);
+
+        if (cmp == 0) return mid;
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return in->procs_len;
+}
+
+static void call_edge(AstNode *node, UNUSED int _depth, void *args) {
+    Inliner *in = args;
+    const ExprCall *call = &node->expr_call;
+
+    if (!is_direct_call(call->callee)) return;
+
+    size_t callee = find_proc(in, call->callee->expr_literal.op.value);
+    if (callee == in->procs_len) return;
+
+    if (in->edges_len == in->edges_cap) {
+        in->edges_cap = in->edges_cap == 0 ? 16 : in->edges_cap * 2;
+        in->edges = NON_NULL(realloc(in->edges, in->edges_cap * sizeof(size_t)));
+    }
+
+    in->edges[in->edges_len++] = callee;
+}
+
+// tarjan's algorithm: a procedure is recursive if it calls itself, or if its
+// strongly connected component of the call graph has other members
+static void find_recursion(Inliner *in, size_t v) {
+    Proc *proc = &in->procs[v];
+
+    proc->index = proc->lowlink = ++in->visits;
+    proc->on_stack = true;
+    in->stack[in->stack_len++] = v;
+
+    for (size_t e=proc->calls; e < proc->calls_end; ++e) {
+        size_t w = in->edges[e];
+        Proc *callee = &in->procs[w];
+
+        if (w == v)
+            proc->recursive = true;
+
+        if (callee->index == 0) {
+            find_recursion(in, w);
+            if (callee->lowlink < proc->lowlink)
+                proc->lowlink = callee->lowlink;
+        } else if (callee->on_stack && callee->index < proc->lowlink) {
+            proc->lowlink = callee->index;
+        }
+    }
+
+    if (proc->lowlink != proc->index) return;
+
+    // v is the root of its component, which is everything above it on the stack
+    size_t root = in->stack_len;
+    while (in->stack[--root] != v);
+
+    for (size_t i=root; i < in->stack_len; ++i) {
+        Proc *member = &in->procs[in->stack[i]];
+        member->on_stack = false;
+        if (in->stack_len - root > 1)
+            member->recursive = true;
+    }
+
+    in->stack_len = root;
+}
+
+static void call_site(AstNode *node, UNUSED int _depth, void *args) {
+    Inliner *in = args;
+    ExprCall *call = &node->expr_call;
+
+    if (!is_direct_call(call->callee)) return;
+
+    size_t i = find_proc(in, call->callee->expr_literal.op.value);
+    if (i == in->procs_len) return;
+
+    const Proc *callee = &in->procs[i];
+    const char *name = callee->node->stmt_proc.ident.value;
+    const char *caller = in->procs[in->current].node->stmt_proc.ident.value;
+
+    if (callee->recursive) {
+        if (compiler_ctx.stats)
+            printf("INLINE %s into %s: recursive\n", name, caller);
+        stats.recursive++;
+        return;
+    }
+
+    if (callee->size > in->limit) {
+        if (compiler_ctx.stats)
+            printf("INLINE %s into %s: size %d exceeds limit %d\n", name, caller, callee->size, in->limit);
+        stats.too_large++;
+        return;
+    }
+
+    if (compiler_ctx.stats)
+        printf("INLINE %s into %s: size %d\n", name, caller, callee->size);
+
+    call->inlined = callee->node;
+    stats.inlined++;
+}
+
+void inline_calls(AstNode *root, int limit) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    const AstNodeList *list = &root->block.stmts;
+
+    Inliner in = {
+        .procs = NON_NULL(calloc(list->size + 1, sizeof(Proc))),
+        .stack = NON_NULL(calloc(list->size + 1, sizeof(size_t))),
+        .limit = limit,
+    };
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind == ASTNODE_PROC && node->stmt_proc.body != NULL)
+            in.procs[in.procs_len++] = (Proc) { .node = node };
+    }
+
+    size_t n = in.procs_len;
+    qsort(in.procs, n, sizeof(Proc), compare_procs);
+
+    AstDispatchEntry edges[] = {
+        { ASTNODE_CALL, call_edge, NULL },
+    };
+
+    for (in.current=0; in.current < n; ++in.current) {
+        Proc *proc = &in.procs[in.current];
+        proc->size  = ast_size(proc->node->stmt_proc.body);
+        proc->calls = in.edges_len;
+        parser_dispatch_ast(proc->node->stmt_proc.body, edges, ARRAY_LEN(edges), &in);
+        proc->calls_end = in.edges_len;
+    }
+
+    for (size_t i=0; i < n; ++i)
+        if (in.procs[i].index == 0)
+            find_recursion(&in, i);
+
+    AstDispatchEntry sites[] = {
+        { ASTNODE_CALL, call_site, NULL },
+    };
+
+    // call sites are visited in the order of the source, so that --stats is too
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL) continue;
+
+        in.current = find_proc(&in, node->stmt_proc.ident.value);
+        parser_dispatch_ast(node->stmt_proc.body, sites, ARRAY_LEN(sites), &in);
+    }
+
+    free(in.procs);
+    free(in.edges);
+    free(in.stack);
+}
+
+void inline_print_stats(void) {
+    printf("INLINE %-18s %d\n", "inlined",   stats.inlined);
+    printf("INLINE %-18s %d\n", "too large", stats.too_large);
+    printf("INLINE %-18s %d\n", "recursive", stats.recursive);
+}
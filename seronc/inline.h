@@ -0,0 +1,14 @@
+#ifndef _INLINE_H
+#define _INLINE_H
+
+#include "parser.h"
+
+// marks calls to small, non-recursive procedures, whose bodies are then
+// generated in place of the call by codegen()
+// the size of a body is the number of its AST nodes, bodies larger than `limit` are never inlined
+// must be called after typecheck() and fold(), as folding shrinks bodies
+void inline_calls(AstNode *root, int limit);
+// prints every decision that has been made, and how many calls have been inlined
+void inline_print_stats(void);
+
+#endif // _INLINE_H
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include <ver.h>
+
+#include "instruction.h"
+
+
+
+void instructionlist_init(InstructionList *list) {
+    *list = (InstructionList) { 0 };
+}
+
+void instructionlist_destroy(InstructionList *list) {
+    free(list->items);
+    list->items = NULL;
+}
+
+void instructionlist_append(InstructionList *list, Instruction ins) {
+
+    if (list->len == list->cap) {
+        list->cap = list->cap == 0 ? 64 : list->cap * 2;
+        list->items = NON_NULL(realloc(list->items, list->cap * sizeof(Instruction)));
+    }
+
+    list->items[list->len++] = ins;
+}
+
+void instructionlist_clear(InstructionList *list) {
+    list->len = 0;
+}
+
+void instructionlist_insert(InstructionList *list, size_t index, Instruction ins) {
+    assert(index <= list->len);
+
+    // grow the list by appending a placeholder
+    instructionlist_append(list, ins);
+
+    memmove(
+        list->items + index + 1,
+        list->items + index,
+        (list->len - index - 1) * sizeof(Instruction)
+    );
+
+    list->items[index] = ins;
+}
+
+void instructionlist_remove(InstructionList *list, size_t index, size_t count) {
+    assert(index + count <= list->len);
+
+    memmove(
+        list->items + index,
+        list->items + index + count,
+        (list->len - index - count) * sizeof(Instruction)
+    );
+
+    list->len -= count;
+}
+
+NO_DISCARD bool operand_mentions(const Operand *op, Register reg) {
+    if (op->kind == OPERAND_MEM && op->index == reg) return true;
+    return (op->kind == OPERAND_REG || op->kind == OPERAND_MEM) && op->reg == reg;
+}
+
+// registers that are accessed without being an operand
+NO_DISCARD static bool implicitly_mentions(const Instruction *ins, Register reg) {
+    switch (ins->op) {
+        case OP_IMUL:
+            // one-operand form multiplies into rdx:rax
+            if (ins->src.kind != OPERAND_NONE) return false;
+            return reg == REG_RAX || reg == REG_RDX;
+
+        case OP_IDIV:
+        case OP_CDQ:
+        case OP_CQO:
+            return reg == REG_RAX || reg == REG_RDX;
+
+        case OP_PUSH:
+        case OP_POP:
+        case OP_RET:
+            return reg == REG_RSP;
+
+        case OP_CALL:
+            // clobbers every caller-saved register
+            return reg != REG_RBX && reg != REG_RBP
+                && reg != REG_R12 && reg != REG_R13
+                && reg != REG_R14 && reg != REG_R15;
+
+        default:
+            return false;
+    }
+}
+
+NO_DISCARD bool instruction_mentions(const Instruction *ins, Register reg) {
+    return operand_mentions(&ins->dst, reg)
+        || operand_mentions(&ins->src, reg)
+        || implicitly_mentions(ins, reg);
+}
@@ -0,0 +1,222 @@
+#ifndef _INSTRUCTION_H
+#define _INSTRUCTION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ver.h>
+
+// machine instructions
+// codegen collects the instructions of every procedure into a list, so they can
+// be inspected and rewritten before being printed by the emitter
+
+
+
+typedef enum {
+    REG_INVALID,
+
+    REG_RAX,
+    REG_RBX,
+    REG_RCX,
+    REG_RDX,
+    REG_RSI,
+    REG_RDI,
+    REG_RBP,
+    REG_RSP,
+    REG_R8,
+    REG_R9,
+    REG_R10,
+    REG_R11,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+
+    // only used by vectorized loops, operands of 16 bytes are xmm, of 32 bytes ymm
+    REG_XMM0,
+    REG_XMM1,
+    REG_XMM2,
+    REG_XMM3,
+
+    REG_COUNT,
+} Register;
+
+// bit `1 << reg` is set for every register in the set
+typedef uint32_t RegisterSet;
+
+typedef enum {
+    OP_MOV,
+    OP_MOVZX,
+    OP_MOVSX,
+    OP_MOVSXD,
+    OP_LEA,
+    OP_ADD,
+    OP_SUB,
+    OP_IMUL,
+    OP_IDIV,
+    OP_CDQ,
+    OP_CQO,
+    OP_NEG,
+    OP_AND,
+    OP_OR,
+    OP_SHL,
+    OP_SHR,
+    OP_SAR,
+    OP_CMP,
+    OP_SETE,
+    OP_SETNE,
+    OP_SETG,
+    OP_SETGE,
+    OP_SETL,
+    OP_SETLE,
+    OP_PUSH,
+    OP_POP,
+    OP_CALL,
+    OP_JMP,
+    OP_JE,
+    OP_JNE,
+    OP_JG,
+    OP_JGE,
+    OP_JL,
+    OP_JLE,
+    OP_RET,
+
+    // SSE2, which every x86_64 processor has, emitted in their VEX encoding with
+    // -mavx2, where the two operand form is kept by repeating the destination.
+    // the element sizes of an operation follow each other, as byte, dword, qword
+    OP_MOVD,
+    OP_MOVQ,
+    OP_MOVDQU,
+    OP_MOVDQA,
+    OP_PXOR,
+    OP_PAND,
+    OP_PANDN,
+    OP_POR,
+    OP_PADDB,
+    OP_PADDD,
+    OP_PADDQ,
+    OP_PSUBB,
+    OP_PSUBD,
+    OP_PSUBQ,
+    OP_PCMPEQB,
+    OP_PCMPEQD,
+    OP_PCMPEQQ, // SSE4.1
+    OP_PCMPGTB,
+    OP_PCMPGTD,
+    OP_PCMPGTQ, // SSE4.2
+    OP_PMULLD,  // SSE4.1
+    OP_PUNPCKLBW,
+    OP_PUNPCKLWD,
+    OP_PUNPCKLDQ,
+    OP_PUNPCKLQDQ,
+    OP_PSRLDQ,
+
+    // AVX2 only
+    OP_VPBROADCASTB,
+    OP_VPBROADCASTD,
+    OP_VPBROADCASTQ,
+    OP_VEXTRACTI128, // upper half of the ymm register in `src`, the immediate is implied
+    OP_VZEROUPPER,
+
+    OP_LABEL, // pseudo instruction, defines the label in `dst`
+
+    OP_COUNT,
+} Opcode;
+
+// local labels are scoped to the enclosing procedure by NASM
+typedef enum {
+    LABEL_ELSE,
+    LABEL_END,
+    LABEL_WHILE,
+    LABEL_COND,
+    LABEL_SKIP, // rest of a short-circuiting condition
+    LABEL_RETURN,
+    LABEL_INLINE, // end of an inlined body
+    LABEL_ENTRY,  // start of the body, after the parameters have been stored
+    LABEL_BLOCK,  // basic block of the SSA IR
+    LABEL_STRING,
+
+    LABEL_COUNT,
+} LabelKind;
+
+typedef enum {
+    OPERAND_NONE,
+    OPERAND_REG,    // <reg>
+    OPERAND_IMM,    // <imm>
+    OPERAND_MEM,    // [<reg> + <index>*<scale> + <imm>]
+    OPERAND_LABEL,  // <label><id>
+    OPERAND_SYMBOL, // <symbol>
+} OperandKind;
+
+typedef struct {
+    OperandKind kind;
+    int size;     // in bytes
+    Register reg; // register, or base register of memory operands
+    Register index; // index register of memory operands, REG_INVALID if none
+    int scale;      // 1, 2, 4 or 8
+    LabelKind label;
+    int id;       // label number, negative if the label is unnumbered
+    union {
+        int64_t imm; // immediate, or displacement of memory operands
+        const char *symbol;
+    };
+} Operand;
+
+NO_DISCARD static inline Operand operand_none(void) {
+    return (Operand) { .kind = OPERAND_NONE };
+}
+
+NO_DISCARD static inline Operand operand_reg(Register reg, int size) {
+    return (Operand) { .kind = OPERAND_REG, .reg = reg, .size = size };
+}
+
+NO_DISCARD static inline Operand operand_imm(int64_t imm, int size) {
+    return (Operand) { .kind = OPERAND_IMM, .imm = imm, .size = size };
+}
+
+NO_DISCARD static inline Operand operand_mem(Register base, int64_t disp, int size) {
+    return (Operand) { .kind = OPERAND_MEM, .reg = base, .imm = disp, .size = size };
+}
+
+NO_DISCARD static inline Operand operand_mem_index(Register base, Register index, int scale, int64_t disp, int size) {
+    return (Operand) { .kind = OPERAND_MEM, .reg = base, .index = index, .scale = scale, .imm = disp, .size = size };
+}
+
+NO_DISCARD static inline Operand operand_label(LabelKind label, int id) {
+    return (Operand) { .kind = OPERAND_LABEL, .label = label, .id = id };
+}
+
+NO_DISCARD static inline Operand operand_symbol(const char *symbol) {
+    return (Operand) { .kind = OPERAND_SYMBOL, .symbol = symbol };
+}
+
+typedef struct {
+    Opcode op;
+    Operand dst, src;    // OPERAND_NONE if unused
+    const char *comment; // may be NULL
+} Instruction;
+
+typedef struct {
+    size_t len, cap;
+    Instruction *items;
+} InstructionList;
+
+void instructionlist_init(InstructionList *list);
+void instructionlist_destroy(InstructionList *list);
+void instructionlist_append(InstructionList *list, Instruction ins);
+void instructionlist_clear(InstructionList *list);
+// inserts `ins` before the instruction at `index`
+void instructionlist_insert(InstructionList *list, size_t index, Instruction ins);
+// removes `count` instructions starting at `index`
+void instructionlist_remove(InstructionList *list, size_t index, size_t count);
+
+// true if reg is the operand, or the base or index register of a memory operand
+NO_DISCARD bool operand_mentions(const Operand *op, Register reg);
+// true if the instruction reads or writes reg, including implicit accesses
+// calls are considered to write every caller-saved register
+NO_DISCARD bool instruction_mentions(const Instruction *ins, Register reg);
+
+
+
+#endif // _INSTRUCTION_H
@@ -0,0 +1,1347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdarg.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+#include "diagnostics.h"
+
+#include "ir.h"
+
+// SSA construction follows "Simple and Efficient Construction of Static Single
+// Assignment Form" by Braun et al.: the value a variable has at the end of every
+// block is recorded as it is assigned. reading a variable that has not been
+// assigned in the current block looks it up in the predecessors, placing a phi
+// where there is more than one of them. blocks whose predecessors are not all
+// known yet, like loop headers, get phis without operands, which are completed
+// once the block is sealed. phis that only ever select a single value are
+// replaced by that value.
+//
+// the tree is lowered after the optimizations on it, calls that are marked
+// for inlining and vectorized loops are lowered as if they were not
+
+typedef struct {
+    Symbol *var;
+    IrValue *value;
+} Def;
+
+typedef struct {
+    Def *defs;          // value of every variable assigned in the block, at its current end
+    size_t defs_len, defs_cap;
+    Def *incomplete;    // phis of a block that has not been sealed yet, waiting for their operands
+    size_t incomplete_len, incomplete_cap;
+    bool sealed;        // every predecessor is known
+} BlockInfo;
+
+typedef struct {
+    Arena *arena;
+    IrProc *proc;
+    IrBlock **blocks;   // in the order they have been created, which is their index into infos
+    BlockInfo *infos;
+    size_t blocks_len, blocks_cap;
+    IrBlock *current;   // block that is being appended to
+    SymbolSet addressed; // variables whose address is taken, which stay in memory
+    IrValue *params[MAX_PARAM_COUNT]; // created once a parameter is read
+    size_t front;       // values at the start of the entry block, parameters and undefined values
+} Builder;
+
+
+
+// arrays of the IR live as long as the arena, growing one leaves the old items behind
+NO_DISCARD static void *grow(Arena *arena, void *items, size_t len, size_t *cap, size_t size) {
+    if (len < *cap) return items;
+
+    *cap = *cap == 0 ? 4 : *cap * 2;
+    void *new = NON_NULL(arena_alloc(arena, *cap * size));
+    if (len > 0)
+        memcpy(new, items, len * size);
+    return new;
+}
+
+bool ir_is_terminator(IrOp op) {
+    return op == IR_JMP || op == IR_BR || op == IR_RET;
+}
+
+NO_DISCARD static bool is_pointer(TypeKind type) {
+    return type == TYPE_POINTER || type == TYPE_PROCEDURE;
+}
+
+NO_DISCARD static IrValue *resolve(IrValue *value) {
+    while (value->replaced != NULL)
+        value = value->replaced;
+    return value;
+}
+
+NO_DISCARD static size_t count_phis(const IrBlock *block) {
+    size_t n = 0;
+    while (n < block->values_len && block->values[n]->op == IR_PHI)
+        n++;
+    return n;
+}
+
+
+
+NO_DISCARD static IrBlock *new_block(Builder *b) {
+    IrBlock *block = NON_NULL(arena_alloc(b->arena, sizeof(IrBlock)));
+    memset(block, 0, sizeof(IrBlock));
+    block->id = b->blocks_len;
+
+    if (b->blocks_len == b->blocks_cap) {
+        b->blocks_cap = b->blocks_cap == 0 ? 16 : b->blocks_cap * 2;
+        b->blocks = NON_NULL(realloc(b->blocks, b->blocks_cap * sizeof(IrBlock*)));
+        b->infos  = NON_NULL(realloc(b->infos, b->blocks_cap * sizeof(BlockInfo)));
+    }
+
+    b->blocks[b->blocks_len] = block;
+    b->infos[b->blocks_len++] = (BlockInfo) { 0 };
+    return block;
+}
+
+NO_DISCARD static IrValue *new_value(Builder *b, IrOp op, TypeKind type) {
+    IrValue *value = NON_NULL(arena_alloc(b->arena, sizeof(IrValue)));
+    memset(value, 0, sizeof(IrValue));
+    value->op   = op;
+    value->type = type;
+    value->id   = b->proc->values_count++;
+    return value;
+}
+
+static void add_arg(Builder *b, IrValue *value, IrValue *arg) {
+    value->args = grow(b->arena, value->args, value->args_len, &value->args_cap, sizeof(IrValue*));
+    value->args[value->args_len++] = arg;
+}
+
+static void insert(Builder *b, IrBlock *block, size_t index, IrValue *value) {
+    block->values = grow(b->arena, block->values, block->values_len, &block->values_cap, sizeof(IrValue*));
+    memmove(&block->values[index + 1], &block->values[index], (block->values_len - index) * sizeof(IrValue*));
+    block->values[index] = value;
+    block->values_len++;
+    value->block = block;
+}
+
+static void add_pred(Builder *b, IrBlock *block, IrBlock *pred) {
+    block->preds = grow(b->arena, block->preds, block->preds_len, &block->preds_cap, sizeof(IrBlock*));
+    block->preds[block->preds_len++] = pred;
+}
+
+NO_DISCARD static bool is_terminated(const IrBlock *block) {
+    return block->values_len > 0 && ir_is_terminator(block->values[block->values_len - 1]->op);
+}
+
+// appends an instruction to the current block
+static IrValue *append(Builder *b, IrOp op, TypeKind type) {
+    assert(!is_terminated(b->current));
+
+    IrValue *value = new_value(b, op, type);
+    insert(b, b->current, b->current->values_len, value);
+    return value;
+}
+
+static IrValue *append1(Builder *b, IrOp op, TypeKind type, IrValue *arg) {
+    IrValue *value = append(b, op, type);
+    add_arg(b, value, arg);
+    return value;
+}
+
+static IrValue *append2(Builder *b, IrOp op, TypeKind type, IrValue *lhs, IrValue *rhs) {
+    IrValue *value = append1(b, op, type, lhs);
+    add_arg(b, value, rhs);
+    return value;
+}
+
+static IrValue *constant(Builder *b, TypeKind type, int64_t imm) {
+    IrValue *value = append(b, IR_CONST, type);
+    value->imm = imm;
+    return value;
+}
+
+// placed at the start of the entry block, so it is available everywhere
+NO_DISCARD static IrValue *front_value(Builder *b, IrOp op, TypeKind type, int64_t imm) {
+    IrValue *value = new_value(b, op, type);
+    value->imm = imm;
+    insert(b, b->blocks[0], b->front++, value);
+    return value;
+}
+
+// value of a variable that is read before it is assigned, anything would do
+NO_DISCARD static IrValue *undefined(Builder *b, TypeKind type) {
+    return front_value(b, IR_CONST, type, 0);
+}
+
+// code behind a return is lowered into a block that can never be entered
+static void unreachable(Builder *b) {
+    b->current = new_block(b);
+    b->infos[b->current->id].sealed = true;
+}
+
+static void jump(Builder *b, IrBlock *target) {
+    if (is_terminated(b->current)) return;
+
+    IrValue *jmp = append(b, IR_JMP, TYPE_VOID);
+    jmp->targets[0] = target;
+    add_pred(b, target, b->current);
+}
+
+static void branch(Builder *b, IrValue *cond, IrBlock *then, IrBlock *else_) {
+    IrValue *br = append1(b, IR_BR, TYPE_VOID, cond);
+    br->targets[0] = then;
+    br->targets[1] = else_;
+    add_pred(b, then, b->current);
+    add_pred(b, else_, b->current);
+}
+
+
+
+static void addressed(AstNode *node, UNUSED int _depth, void *args) {
+    Builder *b = args;
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+    Symbol *sym = ast_variable(unaryop->node);
+    if (unaryop->kind == UNARYOP_ADDROF && sym != NULL)
+        symbolset_add(&b->addressed, sym);
+}
+
+// parameters share the offset of their slot with their symbol
+NO_DISCARD static size_t param_index(const Builder *b, const Symbol *sym) {
+    const ProcSignature *sig = b->proc->decl->type.signature;
+
+    for (size_t i=0; i < sig->params_count; ++i)
+        if (sig->params[i].offset == sym->offset)
+            return i;
+
+    PANIC("parameter is not part of the signature");
+}
+
+NO_DISCARD static IrValue *param(Builder *b, size_t index) {
+    if (b->params[index] == NULL) {
+        const Param *param = &b->proc->decl->type.signature->params[index];
+        b->params[index] = front_value(b, IR_PARAM, param->type.kind, index);
+    }
+    return b->params[index];
+}
+
+
+
+static void write_variable(Builder *b, IrBlock *block, Symbol *var, IrValue *value) {
+    BlockInfo *info = &b->infos[block->id];
+
+    for (size_t i=0; i < info->defs_len; ++i) {
+        if (info->defs[i].var != var) continue;
+        info->defs[i].value = value;
+        return;
+    }
+
+    if (info->defs_len == info->defs_cap) {
+        info->defs_cap = info->defs_cap == 0 ? 8 : info->defs_cap * 2;
+        info->defs = NON_NULL(realloc(info->defs, info->defs_cap * sizeof(Def)));
+    }
+
+    info->defs[info->defs_len++] = (Def) { var, value };
+}
+
+NO_DISCARD static IrValue *new_phi(Builder *b, IrBlock *block, TypeKind type) {
+    IrValue *phi = new_value(b, IR_PHI, type);
+    insert(b, block, count_phis(block), phi);
+    return phi;
+}
+
+// a phi that only selects itself and a single other value is that value
+static IrValue *remove_trivial_phi(Builder *b, IrValue *phi) {
+    IrValue *same = NULL;
+
+    for (size_t i=0; i < phi->args_len; ++i) {
+        IrValue *arg = resolve(phi->args[i]);
+        if (arg == same || arg == phi) continue;
+        if (same != NULL) return phi;
+        same = arg;
+    }
+
+    phi->replaced = same != NULL ? same : undefined(b, phi->type);
+    return phi->replaced;
+}
+
+static IrValue *read_variable(Builder *b, IrBlock *block, Symbol *var);
+
+static IrValue *add_phi_operands(Builder *b, Symbol *var, IrValue *phi) {
+    IrBlock *block = phi->block;
+
+    for (size_t i=0; i < block->preds_len; ++i)
+        add_arg(b, phi, read_variable(b, block->preds[i], var));
+
+    return remove_trivial_phi(b, phi);
+}
+
+static IrValue *read_variable(Builder *b, IrBlock *block, Symbol *var) {
+    BlockInfo *info = &b->infos[block->id];
+
+    for (size_t i=0; i < info->defs_len; ++i)
+        if (info->defs[i].var == var)
+            return resolve(info->defs[i].value);
+
+    IrValue *value;
+
+    if (!info->sealed) {
+        value = new_phi(b, block, var->type.kind);
+
+        if (info->incomplete_len == info->incomplete_cap) {
+            info->incomplete_cap = info->incomplete_cap == 0 ? 8 : info->incomplete_cap * 2;
+            info->incomplete = NON_NULL(realloc(info->incomplete, info->incomplete_cap * sizeof(Def)));
+        }
+        info->incomplete[info->incomplete_len++] = (Def) { var, value };
+
+    } else if (block->preds_len == 0) {
+        // only the entry block has the parameters, other blocks without predecessors are never entered
+        bool entry = block == b->blocks[0] && var->kind == SYMBOL_PARAMETER;
+        value = entry ? param(b, param_index(b, var)) : undefined(b, var->type.kind);
+
+    } else if (block->preds_len == 1) {
+        value = read_variable(b, block->preds[0], var);
+
+    } else {
+        // recorded first, so cycles through loops end at the phi
+        IrValue *phi = new_phi(b, block, var->type.kind);
+        write_variable(b, block, var, phi);
+        value = add_phi_operands(b, var, phi);
+    }
+
+    write_variable(b, block, var, value);
+    return value;
+}
+
+static void seal(Builder *b, IrBlock *block) {
+    BlockInfo *info = &b->infos[block->id];
+    info->sealed = true;
+
+    for (size_t i=0; i < info->incomplete_len; ++i)
+        (void) add_phi_operands(b, info->incomplete[i].var, info->incomplete[i].value);
+
+    info->incomplete_len = 0;
+}
+
+
+
+static IrValue *lower(Builder *b, AstNode *node);
+static IrValue *literal(Builder *b, AstNode *node);
+
+// address of the slot of a variable that stays in memory
+NO_DISCARD static IrValue *slot(Builder *b, int offset) {
+    IrValue *value = append(b, IR_SLOT, TYPE_POINTER);
+    value->imm = offset;
+    return value;
+}
+
+static void assign_variable(Builder *b, Symbol *var, IrValue *value) {
+    if (symbolset_contains(&b->addressed, var))
+        append2(b, IR_STORE, TYPE_VOID, slot(b, var->offset), value);
+    else
+        write_variable(b, b->current, var, value);
+}
+
+// jumps to `then` if the condition holds, and to `else_` otherwise
+// logical operators short-circuit through blocks of their own
+static void condition(Builder *b, AstNode *cond, IrBlock *then, IrBlock *else_) {
+
+    switch (cond->kind) {
+        case ASTNODE_LITERAL:
+            if (cond->expr_literal.kind != LITERAL_NUMBER) break;
+            jump(b, cond->expr_literal.op.number != 0 ? then : else_);
+            return;
+
+        case ASTNODE_GROUPING:
+            condition(b, cond->expr_grouping.expr, then, else_);
+            return;
+
+        case ASTNODE_UNARYOP:
+            if (cond->expr_unaryop.kind != UNARYOP_NEG) break;
+            condition(b, cond->expr_unaryop.node, else_, then);
+            return;
+
+        case ASTNODE_BINOP: {
+            const ExprBinOp *binop = &cond->expr_binop;
+            if (binop->kind != BINOP_LOG_AND && binop->kind != BINOP_LOG_OR) break;
+
+            // the rhs is only evaluated if the lhs has not decided the condition yet
+            IrBlock *rest = new_block(b);
+
+            if (binop->kind == BINOP_LOG_AND)
+                condition(b, binop->lhs, rest, else_);
+            else
+                condition(b, binop->lhs, then, rest);
+
+            seal(b, rest);
+            b->current = rest;
+            condition(b, binop->rhs, then, else_);
+        } return;
+
+        default: NOP() break;
+    }
+
+    branch(b, lower(b, cond), then, else_);
+}
+
+// materializes a short-circuiting operator as 1 or 0
+static IrValue *logical(Builder *b, AstNode *node) {
+    TypeKind type = node->type.kind;
+
+    IrBlock *then  = new_block(b);
+    IrBlock *else_ = new_block(b);
+    IrBlock *end   = new_block(b);
+
+    condition(b, node, then, else_);
+    seal(b, then);
+    seal(b, else_);
+
+    b->current = then;
+    IrValue *one = constant(b, type, 1);
+    jump(b, end);
+
+    b->current = else_;
+    IrValue *zero = constant(b, type, 0);
+    jump(b, end);
+
+    seal(b, end);
+    b->current = end;
+
+    IrValue *phi = new_phi(b, end, type);
+    add_arg(b, phi, one);
+    add_arg(b, phi, zero);
+    return phi;
+}
+
+// the rhs is evaluated first, like codegen() does
+static IrValue *binop(Builder *b, AstNode *node) {
+    const ExprBinOp *binop = &node->expr_binop;
+    TypeKind type = node->type.kind;
+
+    if (binop->kind == BINOP_LOG_AND || binop->kind == BINOP_LOG_OR)
+        return logical(b, node);
+
+    IrValue *rhs = lower(b, binop->rhs);
+    IrValue *lhs = lower(b, binop->lhs);
+
+    TypeKind left = binop->lhs->type.kind, right = binop->rhs->type.kind;
+
+    // pointer arithmetic scales the integer operand by the size of the pointee,
+    // other operations on a pointer and an integer scale it as well, like codegen() does
+    if (left == TYPE_POINTER && right != TYPE_POINTER) {
+        int size = type_primitive_size(binop->lhs->type.pointee->kind);
+
+        if (binop->kind == BINOP_ADD || binop->kind == BINOP_SUB) {
+            IrValue *value = append2(b, IR_PTRADD, type, lhs, rhs);
+            value->imm = binop->kind == BINOP_ADD ? size : -size;
+            return value;
+        }
+
+        rhs = append2(b, IR_PTRADD, type, constant(b, type, 0), rhs);
+        rhs->imm = size;
+
+    } else if (left != TYPE_POINTER && right == TYPE_POINTER) {
+        int size = type_primitive_size(binop->rhs->type.pointee->kind);
+
+        if (binop->kind == BINOP_ADD) {
+            IrValue *value = append2(b, IR_PTRADD, type, rhs, lhs);
+            value->imm = size;
+            return value;
+        }
+
+        lhs = append2(b, IR_PTRADD, type, constant(b, type, 0), lhs);
+        lhs->imm = size;
+    }
+
+    IrOp op;
+    switch (binop->kind) {
+        case BINOP_ADD:         op = IR_ADD; break;
+        case BINOP_SUB:         op = IR_SUB; break;
+        case BINOP_MUL:         op = IR_MUL; break;
+        case BINOP_DIV:         op = IR_DIV; break;
+        case BINOP_BITWISE_AND: op = IR_AND; break;
+        case BINOP_BITWISE_OR:  op = IR_OR;  break;
+
+        case BINOP_EQ:
+        case BINOP_NEQ:
+        case BINOP_GT:
+        case BINOP_GT_EQ:
+        case BINOP_LT:
+        case BINOP_LT_EQ: {
+            IrValue *value = append2(b, IR_CMP, type, lhs, rhs);
+            value->cmp = binop->kind;
+            return value;
+        }
+
+        case BINOP_LOG_OR:
+        case BINOP_LOG_AND:
+            UNREACHABLE();
+    }
+
+    return append2(b, op, type, lhs, rhs);
+}
+
+static IrValue *unaryop(Builder *b, AstNode *node) {
+    const ExprUnaryOp *unaryop = &node->expr_unaryop;
+    TypeKind type = node->type.kind;
+
+    switch (unaryop->kind) {
+        case UNARYOP_NEG:
+            return append1(b, IR_NOT, type, lower(b, unaryop->node));
+
+        case UNARYOP_MINUS:
+            return append1(b, IR_NEG, type, lower(b, unaryop->node));
+
+        case UNARYOP_DEREF:
+            return append1(b, IR_LOAD, type, lower(b, unaryop->node));
+
+        case UNARYOP_ADDROF: {
+            AstNode *operand = unaryop->node;
+            Symbol *var = ast_variable(operand);
+
+            if (var != NULL)
+                return slot(b, var->offset);
+
+            if (operand->kind == ASTNODE_LITERAL && operand->expr_literal.kind == LITERAL_IDENT)
+                return literal(b, operand);
+
+            // `&*ptr` is the pointer itself
+            if (operand->kind == ASTNODE_UNARYOP && operand->expr_unaryop.kind == UNARYOP_DEREF)
+                return lower(b, operand->expr_unaryop.node);
+
+            PANIC("unknown operation");
+        }
+    }
+
+    UNREACHABLE();
+}
+
+static IrValue *literal(Builder *b, AstNode *node) {
+    const ExprLiteral *literal = &node->expr_literal;
+    TypeKind type = node->type.kind;
+
+    switch (literal->kind) {
+        case LITERAL_STRING: {
+            IrValue *value = append(b, IR_STRING, TYPE_POINTER);
+            value->name = literal->op.value;
+            return value;
+        }
+
+        case LITERAL_NUMBER:
+            return constant(b, type, literal->op.number);
+
+        case LITERAL_IDENT: {
+            Symbol *sym = NON_NULL(literal->sym);
+
+            if (sym->kind == SYMBOL_PROCEDURE) {
+                IrValue *value = append(b, IR_SYMBOL, type);
+                value->name = literal->op.value;
+                return value;
+            }
+
+            if (symbolset_contains(&b->addressed, sym))
+                return append1(b, IR_LOAD, sym->type.kind, slot(b, sym->offset));
+
+            return read_variable(b, b->current, sym);
+        }
+    }
+
+    UNREACHABLE();
+}
+
+// arguments are lowered right to left, and a function pointer after them, in the
+// order push_args() and call() of codegen.c evaluate them. constants are left
+// for last there, which is the same, since nothing can change them
+static IrValue *call(Builder *b, AstNode *node) {
+    const ExprCall *call = &node->expr_call;
+    const AstNodeList *list = &call->args;
+
+    IrValue **args = NON_NULL(calloc(list->size + 1, sizeof(IrValue*)));
+    for (size_t i=list->size; i-- > 0;)
+        args[i] = lower(b, list->items[i]);
+
+    const AstNode *callee = call->callee;
+    bool direct = callee->kind == ASTNODE_LITERAL && callee->expr_literal.kind == LITERAL_IDENT
+               && callee->expr_literal.sym->kind == SYMBOL_PROCEDURE;
+
+    IrValue *pointer = direct ? NULL : lower(b, call->callee);
+    IrValue *value = append(b, IR_CALL, node->type.kind);
+
+    if (direct)
+        value->name = callee->expr_literal.op.value;
+    else
+        add_arg(b, value, pointer);
+
+    for (size_t i=0; i < list->size; ++i)
+        add_arg(b, value, args[i]);
+
+    free(args);
+    return value;
+}
+
+static IrValue *assign(Builder *b, AstNode *node) {
+    const ExprAssign *assign = &node->expr_assign;
+    AstNode *target = assign->target;
+
+    Symbol *var = ast_variable(target);
+    if (var != NULL) {
+        IrValue *value = lower(b, assign->value);
+        assign_variable(b, var, value);
+        return value;
+    }
+
+    // the address is computed before the value
+    assert(target->kind == ASTNODE_UNARYOP && target->expr_unaryop.kind == UNARYOP_DEREF);
+
+    IrValue *ptr = lower(b, target->expr_unaryop.node);
+    IrValue *value = lower(b, assign->value);
+    append2(b, IR_STORE, TYPE_VOID, ptr, value);
+    return value;
+}
+
+// elements are stored upwards from the start of the array, like codegen() does
+static IrValue *array(Builder *b, AstNode *node) {
+    const ExprArray *array = &node->expr_array;
+    const AstNodeList *list = &array->values;
+    int elem_size = type_primitive_size(array->type.kind);
+
+    for (size_t i=0; i < list->size; ++i) {
+        IrValue *value = lower(b, list->items[i]);
+        append2(b, IR_STORE, TYPE_VOID, slot(b, array->offset + (list->size - i) * elem_size), value);
+    }
+
+    return slot(b, array->offset + list->size * elem_size);
+}
+
+static void cond(Builder *b, const StmtIf *cond) {
+    IrBlock *then  = new_block(b);
+    IrBlock *else_ = cond->else_body != NULL ? new_block(b) : NULL;
+    IrBlock *end   = new_block(b);
+
+    condition(b, cond->condition, then, else_ != NULL ? else_ : end);
+    seal(b, then);
+
+    b->current = then;
+    lower(b, cond->then_body);
+    jump(b, end);
+
+    if (else_ != NULL) {
+        seal(b, else_);
+        b->current = else_;
+        lower(b, cond->else_body);
+        jump(b, end);
+    }
+
+    seal(b, end);
+    b->current = end;
+}
+
+// the header is sealed once the body has added the back edge
+static void while_(Builder *b, const StmtWhile *loop) {
+    IrBlock *head = new_block(b);
+    IrBlock *body = new_block(b);
+    IrBlock *end  = new_block(b);
+
+    jump(b, head);
+    b->current = head;
+    condition(b, loop->condition, body, end);
+    seal(b, body);
+    seal(b, end);
+
+    b->current = body;
+    lower(b, loop->body);
+    jump(b, head);
+    seal(b, head);
+
+    b->current = end;
+}
+
+static void vardecl(Builder *b, const StmtVarDecl *decl) {
+    if (decl->init == NULL) return;
+    assign_variable(b, decl->sym, lower(b, decl->init));
+}
+
+static void return_(Builder *b, const StmtReturn *ret) {
+    IrValue *value = ret->expr != NULL ? lower(b, ret->expr) : NULL;
+    IrValue *ins = append(b, IR_RET, TYPE_VOID);
+
+    if (value != NULL)
+        add_arg(b, ins, value);
+
+    unreachable(b);
+}
+
+// returns the value of expressions, NULL for statements
+static IrValue *lower(Builder *b, AstNode *node) {
+
+    switch (node->kind) {
+        case ASTNODE_BLOCK: {
+            const AstNodeList *list = &node->block.stmts;
+            for (size_t i=0; i < list->size; ++i)
+                lower(b, list->items[i]);
+        } return NULL;
+
+        case ASTNODE_WHILE:    while_(b, &node->stmt_while);     return NULL;
+        case ASTNODE_IF:       cond(b, &node->stmt_if);          return NULL;
+        case ASTNODE_VARDECL:  vardecl(b, &node->stmt_vardecl);  return NULL;
+        case ASTNODE_RETURN:   return_(b, &node->stmt_return);   return NULL;
+        case ASTNODE_TABLE:    NOP()                             return NULL;
+
+        case ASTNODE_GROUPING: return lower(b, node->expr_grouping.expr);
+        case ASTNODE_BINOP:    return binop(b, node);
+        case ASTNODE_UNARYOP:  return unaryop(b, node);
+        case ASTNODE_LITERAL:  return literal(b, node);
+        case ASTNODE_CALL:     return call(b, node);
+        case ASTNODE_ASSIGN:   return assign(b, node);
+        case ASTNODE_ARRAY:    return array(b, node);
+
+        case ASTNODE_PROC:
+        case ASTNODE_INDEX:
+        case ASTNODE_FOR:
+            PANIC("syntactic sugar should have been expanded earlier");
+    }
+
+    UNREACHABLE();
+}
+
+
+
+static void visit(IrBlock *block, bool *visited, IrBlock **order, size_t *len) {
+    visited[block->id] = true;
+
+    const IrValue *last = block->values[block->values_len - 1];
+    for (int i=1; i >= 0; --i)
+        if (last->targets[i] != NULL && !visited[last->targets[i]->id])
+            visit(last->targets[i], visited, order, len);
+
+    order[(*len)++] = block;
+}
+
+// drops blocks that can not be reached, along with their edges into the rest,
+// and orders the others in reverse postorder, so every block comes after its
+// dominators, and only loops jump backwards
+static void layout(Builder *b) {
+    bool *visited = NON_NULL(calloc(b->blocks_len + 1, sizeof(bool)));
+    IrBlock **order = NON_NULL(calloc(b->blocks_len + 1, sizeof(IrBlock*)));
+    size_t len = 0;
+
+    visit(b->blocks[0], visited, order, &len);
+
+    for (size_t i=0; i < len; ++i) {
+        IrBlock *block = order[i];
+        size_t phis = count_phis(block);
+        size_t kept = 0;
+
+        for (size_t j=0; j < block->preds_len; ++j) {
+            if (!visited[block->preds[j]->id]) continue;
+
+            for (size_t k=0; k < phis; ++k)
+                block->values[k]->args[kept] = block->values[k]->args[j];
+            block->preds[kept++] = block->preds[j];
+        }
+
+        block->preds_len = kept;
+        for (size_t k=0; k < phis; ++k)
+            block->values[k]->args_len = kept;
+    }
+
+    IrProc *proc = b->proc;
+    proc->blocks = NON_NULL(arena_alloc(b->arena, (len + 1) * sizeof(IrBlock*)));
+    proc->blocks_len = len;
+
+    for (size_t i=0; i < len; ++i) {
+        proc->blocks[i] = order[len - 1 - i];
+        proc->blocks[i]->id = i;
+    }
+
+    free(visited);
+    free(order);
+}
+
+// phis may only turn out to be trivial once the phis they select are known to be
+static void remove_trivial_phis(Builder *b) {
+    IrProc *proc = b->proc;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i=0; i < proc->blocks_len; ++i) {
+            IrBlock *block = proc->blocks[i];
+
+            for (size_t j=0; j < count_phis(block); ++j) {
+                IrValue *phi = block->values[j];
+                if (phi->replaced != NULL) continue;
+
+                changed |= remove_trivial_phi(b, phi) != phi;
+            }
+        }
+    }
+
+    // uses of the replaced phis are redirected to the values they stand for
+    for (size_t i=0; i < proc->blocks_len; ++i) {
+        IrBlock *block = proc->blocks[i];
+        size_t len = 0;
+
+        for (size_t j=0; j < block->values_len; ++j) {
+            IrValue *value = block->values[j];
+            if (value->replaced != NULL) continue;
+
+            for (size_t k=0; k < value->args_len; ++k)
+                value->args[k] = resolve(value->args[k]);
+            block->values[len++] = value;
+        }
+
+        block->values_len = len;
+    }
+}
+
+// undefined values for blocks that have been dropped, or for phis that have been
+// replaced, may be left behind
+static void remove_unused_constants(IrProc *proc) {
+    bool *used = NON_NULL(calloc(proc->values_count + 1, sizeof(bool)));
+
+    for (size_t i=0; i < proc->blocks_len; ++i) {
+        const IrBlock *block = proc->blocks[i];
+        for (size_t j=0; j < block->values_len; ++j) {
+            const IrValue *value = block->values[j];
+            for (size_t k=0; k < value->args_len; ++k)
+                used[value->args[k]->id] = true;
+        }
+    }
+
+    for (size_t i=0; i < proc->blocks_len; ++i) {
+        IrBlock *block = proc->blocks[i];
+        size_t len = 0;
+
+        for (size_t j=0; j < block->values_len; ++j) {
+            if (block->values[j]->op != IR_CONST || used[block->values[j]->id])
+                block->values[len++] = block->values[j];
+        }
+
+        block->values_len = len;
+    }
+
+    free(used);
+}
+
+static void number_values(IrProc *proc) {
+    proc->values_count = 0;
+
+    for (size_t i=0; i < proc->blocks_len; ++i) {
+        const IrBlock *block = proc->blocks[i];
+        for (size_t j=0; j < block->values_len; ++j)
+            block->values[j]->id = proc->values_count++;
+    }
+}
+
+NO_DISCARD static IrProc *build_proc(Arena *arena, const DeclProc *decl) {
+    IrProc *proc = NON_NULL(arena_alloc(arena, sizeof(IrProc)));
+    *proc = (IrProc) { .decl = decl };
+
+    Builder b = {
+        .arena = arena,
+        .proc  = proc,
+    };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_UNARYOP, addressed, NULL },
+    };
+    parser_dispatch_ast(decl->body, table, ARRAY_LEN(table), &b);
+
+    b.current = new_block(&b);
+    seal(&b, b.current);
+
+    // parameters whose address is taken are stored to their slots right away
+    const ProcSignature *sig = decl->type.signature;
+    for (size_t i=0; i < sig->params_count; ++i) {
+        for (size_t j=0; j < b.addressed.len; ++j) {
+            const Symbol *sym = b.addressed.items[j];
+            if (sym->kind == SYMBOL_PARAMETER && sym->offset == sig->params[i].offset)
+                append2(&b, IR_STORE, TYPE_VOID, slot(&b, sym->offset), param(&b, i));
+        }
+    }
+
+    lower(&b, decl->body);
+
+    // falling off the end returns whatever happens to be in rax, any value will do
+    if (!is_terminated(b.current)) {
+        TypeKind type = sig->returntype.kind;
+        IrValue *ret = append(&b, IR_RET, TYPE_VOID);
+        if (type != TYPE_VOID)
+            add_arg(&b, ret, undefined(&b, type));
+    }
+
+    layout(&b);
+    remove_trivial_phis(&b);
+    remove_unused_constants(proc);
+    number_values(proc);
+
+    for (size_t i=0; i < b.blocks_len; ++i) {
+        free(b.infos[i].defs);
+        free(b.infos[i].incomplete);
+    }
+    free(b.blocks);
+    free(b.infos);
+    free(b.addressed.items);
+
+    return proc;
+}
+
+IrProgram *ir_build(AstNode *root, Arena *arena) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    const AstNodeList *list = &root->block.stmts;
+
+    IrProgram *ir = NON_NULL(arena_alloc(arena, sizeof(IrProgram)));
+    ir->procs = NON_NULL(arena_alloc(arena, (list->size + 1) * sizeof(IrProc*)));
+    ir->procs_len = 0;
+
+    for (size_t i=0; i < list->size; ++i) {
+        const AstNode *node = list->items[i];
+        if (node->kind == ASTNODE_PROC && node->stmt_proc.body != NULL)
+            ir->procs[ir->procs_len++] = build_proc(arena, &node->stmt_proc);
+    }
+
+    return ir;
+}
+
+
+
+typedef struct {
+    const IrProc *proc;
+    IrBlock **idom;    // immediate dominator of every block, the entry block is its own
+    const IrBlock **def_block; // block and position of every value, by id
+    size_t *def_index;
+    int errors;
+} Verifier;
+
+static void fail(Verifier *v, const IrBlock *block, const IrValue *value, const char *fmt, ...) {
+    char msg[256];
+
+    va_list va;
+    va_start(va, fmt);
+    vsnprintf(msg, ARRAY_LEN(msg), fmt, va);
+    va_end(va);
+
+    if (value != NULL)
+        diagnostic(DIAG_ERROR, "Invalid IR in `%s`, %%%d in block%d: %s", v->proc->decl->ident.value, value->id, block->id, msg);
+    else
+        diagnostic(DIAG_ERROR, "Invalid IR in `%s`, block%d: %s", v->proc->decl->ident.value, block->id, msg);
+
+    v->errors++;
+}
+
+// blocks are in reverse postorder, so the dominators can be computed in a single
+// pass per iteration, see "A Simple, Fast Dominance Algorithm" by Cooper et al.
+static void dominators(Verifier *v) {
+    const IrProc *proc = v->proc;
+    v->idom[0] = proc->blocks[0];
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+
+        for (size_t i=1; i < proc->blocks_len; ++i) {
+            IrBlock *block = proc->blocks[i];
+            IrBlock *idom = NULL;
+
+            for (size_t j=0; j < block->preds_len; ++j) {
+                IrBlock *pred = block->preds[j];
+                if (v->idom[pred->id] == NULL) continue;
+
+                if (idom == NULL) {
+                    idom = pred;
+                    continue;
+                }
+
+                IrBlock *a = pred, *b = idom;
+                while (a != b) {
+                    while (a->id > b->id) a = v->idom[a->id];
+                    while (b->id > a->id) b = v->idom[b->id];
+                }
+                idom = a;
+            }
+
+            if (idom != v->idom[i]) {
+                v->idom[i] = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+NO_DISCARD static bool dominates(const Verifier *v, const IrBlock *a, const IrBlock *b) {
+    while (b != a && b->id != 0)
+        b = v->idom[b->id];
+    return a == b;
+}
+
+NO_DISCARD static bool has_edge(const IrBlock *from, const IrBlock *to) {
+    if (from->values_len == 0) return false;
+
+    const IrValue *last = from->values[from->values_len - 1];
+    return last->targets[0] == to || last->targets[1] == to;
+}
+
+NO_DISCARD static bool is_pred(const IrBlock *block, const IrBlock *pred) {
+    for (size_t i=0; i < block->preds_len; ++i)
+        if (block->preds[i] == pred)
+            return true;
+    return false;
+}
+
+// the argument has to be computed before it is used, on every path
+static void verify_use(Verifier *v, const IrBlock *block, size_t index, const IrValue *value, const IrValue *arg, size_t i) {
+
+    if (arg->id < 0 || arg->id >= v->proc->values_count || v->def_block[arg->id] == NULL) {
+        fail(v, block, value, "argument %zu is not part of the procedure", i);
+        return;
+    }
+
+    if (arg->type == TYPE_VOID) {
+        fail(v, block, value, "argument %zu has no value", i);
+        return;
+    }
+
+    const IrBlock *def = v->def_block[arg->id];
+
+    if (value->op == IR_PHI) {
+        if (i >= block->preds_len) return;
+        if (!dominates(v, def, block->preds[i]))
+            fail(v, block, value, "%%%d does not dominate predecessor block%d", arg->id, block->preds[i]->id);
+        return;
+    }
+
+    if (def == block ? v->def_index[arg->id] >= index : !dominates(v, def, block))
+        fail(v, block, value, "%%%d does not dominate its use", arg->id);
+}
+
+static void verify_types(Verifier *v, const IrBlock *block, const IrValue *value) {
+    size_t n = value->args_len;
+    IrValue **args = value->args;
+
+    switch (value->op) {
+        case IR_CONST:
+        case IR_PARAM:
+        case IR_SLOT:
+        case IR_STRING:
+        case IR_SYMBOL:
+        case IR_JMP:
+            if (n != 0) fail(v, block, value, "takes no arguments");
+            if (value->op == IR_PARAM && block->id != 0) fail(v, block, value, "parameter outside of the entry block");
+            break;
+
+        case IR_ADD:
+        case IR_SUB:
+        case IR_MUL:
+        case IR_DIV:
+        case IR_AND:
+        case IR_OR:
+            if (n != 2) fail(v, block, value, "takes two arguments");
+            else if (args[0]->type != value->type || args[1]->type != value->type) fail(v, block, value, "mixes types");
+            break;
+
+        case IR_CMP:
+            if (n != 2) fail(v, block, value, "takes two arguments");
+            else if (args[0]->type != args[1]->type) fail(v, block, value, "compares different types");
+            break;
+
+        case IR_NEG:
+        case IR_NOT:
+            if (n != 1) fail(v, block, value, "takes one argument");
+            else if (args[0]->type != value->type) fail(v, block, value, "mixes types");
+            break;
+
+        case IR_LOAD:
+            if (n != 1) fail(v, block, value, "takes one argument");
+            else if (!is_pointer(args[0]->type)) fail(v, block, value, "loads from a non-pointer");
+            break;
+
+        case IR_STORE:
+            if (n != 2) fail(v, block, value, "takes two arguments");
+            else if (!is_pointer(args[0]->type)) fail(v, block, value, "stores to a non-pointer");
+            break;
+
+        case IR_PTRADD:
+            if (n != 2) fail(v, block, value, "takes two arguments");
+            else if (!is_pointer(args[0]->type) || !ast_is_integer(args[1]->type)) fail(v, block, value, "needs a pointer and an integer");
+            break;
+
+        case IR_CALL:
+            if (value->name == NULL && (n == 0 || !is_pointer(args[0]->type))) fail(v, block, value, "has no callee");
+            break;
+
+        case IR_PHI:
+            if (n != block->preds_len) fail(v, block, value, "has %zu arguments for %zu predecessors", n, block->preds_len);
+            for (size_t i=0; i < n; ++i)
+                if (args[i]->type != value->type) fail(v, block, value, "selects a value of another type");
+            break;
+
+        case IR_BR:
+            if (n != 1) fail(v, block, value, "takes one argument");
+            break;
+
+        case IR_RET:
+            // the type of the returned value is not checked against the signature
+            if (n > 1) fail(v, block, value, "returns more than one value");
+            break;
+    }
+
+    bool result = value->op != IR_STORE && value->op != IR_CALL && !ir_is_terminator(value->op);
+    if (result && value->type == TYPE_VOID)
+        fail(v, block, value, "has no type");
+}
+
+static void verify_block(Verifier *v, const IrBlock *block) {
+
+    if (block->values_len == 0) {
+        fail(v, block, NULL, "is empty");
+        return;
+    }
+
+    bool phis = true;
+
+    for (size_t i=0; i < block->values_len; ++i) {
+        const IrValue *value = block->values[i];
+        bool last = i + 1 == block->values_len;
+
+        if (value->block != block)
+            fail(v, block, value, "belongs to block%d", value->block->id);
+        if (ir_is_terminator(value->op) != last)
+            fail(v, block, value, last ? "block does not end with a terminator" : "terminator in the middle of the block");
+        if (value->op == IR_PHI && !phis)
+            fail(v, block, value, "phi after other instructions");
+        if (value->replaced != NULL)
+            fail(v, block, value, "phi has been replaced");
+
+        phis &= value->op == IR_PHI;
+        verify_types(v, block, value);
+
+        for (size_t j=0; j < value->args_len; ++j)
+            verify_use(v, block, i, value, value->args[j], j);
+    }
+
+    const IrValue *last = block->values[block->values_len - 1];
+    if (!ir_is_terminator(last->op)) return;
+
+    for (size_t i=0; i < ARRAY_LEN(last->targets); ++i) {
+        const IrBlock *target = last->targets[i];
+        bool expected = last->op == IR_BR || (last->op == IR_JMP && i == 0);
+
+        if ((target != NULL) != expected)
+            fail(v, block, last, "has the wrong number of targets");
+        else if (target != NULL && (target->id >= (int) v->proc->blocks_len || v->proc->blocks[target->id] != target))
+            fail(v, block, last, "jumps outside of the procedure");
+        else if (target != NULL && !is_pred(target, block))
+            fail(v, block, last, "is not a predecessor of block%d", target->id);
+    }
+
+    for (size_t i=0; i < block->preds_len; ++i)
+        if (!has_edge(block->preds[i], block))
+            fail(v, block, NULL, "block%d does not jump to it", block->preds[i]->id);
+}
+
+static int verify_proc(const IrProc *proc) {
+    size_t n = proc->blocks_len;
+    size_t values = proc->values_count;
+
+    Verifier v = {
+        .proc      = proc,
+        .idom      = NON_NULL(calloc(n + 1, sizeof(IrBlock*))),
+        .def_block = NON_NULL(calloc(values + 1, sizeof(IrBlock*))),
+        .def_index = NON_NULL(calloc(values + 1, sizeof(size_t))),
+    };
+
+    if (n == 0 || proc->blocks[0]->preds_len != 0) {
+        diagnostic(DIAG_ERROR, "Invalid IR in `%s`: the entry block must not have predecessors", proc->decl->ident.value);
+        v.errors++;
+    }
+
+    for (size_t i=0; i < n; ++i) {
+        const IrBlock *block = proc->blocks[i];
+        if (block->id != (int) i)
+            fail(&v, block, NULL, "is numbered out of order");
+
+        for (size_t j=0; j < block->values_len; ++j) {
+            const IrValue *value = block->values[j];
+
+            if (value->id < 0 || value->id >= (int) values || v.def_block[value->id] != NULL) {
+                fail(&v, block, value, "id is not unique");
+                continue;
+            }
+
+            v.def_block[value->id] = block;
+            v.def_index[value->id] = j;
+        }
+    }
+
+    if (v.errors == 0) {
+        dominators(&v);
+
+        for (size_t i=0; i < n; ++i) {
+            if (i != 0 && v.idom[i] == NULL)
+                fail(&v, proc->blocks[i], NULL, "can not be reached");
+            verify_block(&v, proc->blocks[i]);
+        }
+    }
+
+    free(v.idom);
+    free(v.def_block);
+    free(v.def_index);
+    return v.errors;
+}
+
+bool ir_verify(const IrProgram *ir) {
+    int errors = 0;
+
+    for (size_t i=0; i < ir->procs_len; ++i)
+        errors += verify_proc(ir->procs[i]);
+
+    return errors == 0;
+}
+
+
+
+NO_DISCARD static const char *type_name(TypeKind type) {
+    switch (type) {
+        case TYPE_CHAR:      return "i8";
+        case TYPE_INT:       return "i32";
+        case TYPE_LONG:      return "i64";
+        case TYPE_POINTER:
+        case TYPE_PROCEDURE: return "ptr";
+        case TYPE_VOID:      return "void";
+        default:             return stringify_typekind(type);
+    }
+}
+
+NO_DISCARD static const char *op_name(IrOp op) {
+    switch (op) {
+        case IR_CONST:  return "const";
+        case IR_PARAM:  return "param";
+        case IR_SLOT:   return "slot";
+        case IR_STRING: return "string";
+        case IR_SYMBOL: return "symbol";
+        case IR_LOAD:   return "load";
+        case IR_STORE:  return "store";
+        case IR_ADD:    return "add";
+        case IR_SUB:    return "sub";
+        case IR_MUL:    return "mul";
+        case IR_DIV:    return "div";
+        case IR_AND:    return "and";
+        case IR_OR:     return "or";
+        case IR_PTRADD: return "ptradd";
+        case IR_NEG:    return "neg";
+        case IR_NOT:    return "not";
+        case IR_CMP:    return "cmp";
+        case IR_CALL:   return "call";
+        case IR_PHI:    return "phi";
+        case IR_JMP:    return "jmp";
+        case IR_BR:     return "br";
+        case IR_RET:    return "ret";
+    }
+    UNREACHABLE();
+}
+
+NO_DISCARD static const char *cmp_name(BinOpKind kind) {
+    switch (kind) {
+        case BINOP_EQ:    return "eq";
+        case BINOP_NEQ:   return "ne";
+        case BINOP_GT:    return "gt";
+        case BINOP_GT_EQ: return "ge";
+        case BINOP_LT:    return "lt";
+        case BINOP_LT_EQ: return "le";
+        default: PANIC("not a comparison");
+    }
+}
+
+static void print_value(const IrValue *value) {
+    printf("    ");
+    if (value->type != TYPE_VOID)
+        printf("%%%d = ", value->id);
+
+    printf("%s", op_name(value->op));
+    if (value->op == IR_CMP)
+        printf(" %s", cmp_name(value->cmp));
+    if (value->type != TYPE_VOID)
+        printf(" %s", type_name(value->type));
+
+    switch (value->op) {
+        case IR_CONST:
+        case IR_PARAM:
+        case IR_SLOT:
+            printf(" %ld", value->imm);
+            break;
+
+        case IR_STRING:
+            printf(" \"%s\"", value->name);
+            break;
+
+        case IR_SYMBOL:
+            printf(" @%s", value->name);
+            break;
+
+        case IR_PTRADD:
+            printf(" %%%d, %%%d x %ld", value->args[0]->id, value->args[1]->id, value->imm);
+            break;
+
+        case IR_CALL: {
+            size_t first = value->name == NULL ? 1 : 0;
+
+            if (value->name != NULL)
+                printf(" @%s(", value->name);
+            else
+                printf(" %%%d(", value->args[0]->id);
+
+            for (size_t i=first; i < value->args_len; ++i)
+                printf("%s%%%d", i == first ? "" : ", ", value->args[i]->id);
+            printf(")");
+        } break;
+
+        case IR_PHI:
+            for (size_t i=0; i < value->args_len; ++i)
+                printf("%s [%%%d, block%d]", i == 0 ? "" : ",", value->args[i]->id, value->block->preds[i]->id);
+            break;
+
+        case IR_JMP:
+            printf(" block%d", value->targets[0]->id);
+            break;
+
+        case IR_BR:
+            printf(" %%%d, block%d, block%d", value->args[0]->id, value->targets[0]->id, value->targets[1]->id);
+            break;
+
+        default:
+            for (size_t i=0; i < value->args_len; ++i)
+                printf("%s %%%d", i == 0 ? "" : ",", value->args[i]->id);
+            break;
+    }
+
+    printf("\n");
+}
+
+void ir_print(const IrProgram *ir) {
+
+    for (size_t i=0; i < ir->procs_len; ++i) {
+        const IrProc *proc = ir->procs[i];
+        const ProcSignature *sig = proc->decl->type.signature;
+
+        printf("proc %s(", proc->decl->ident.value);
+        for (size_t j=0; j < sig->params_count; ++j)
+            printf("%s%s", j == 0 ? "" : ", ", type_name(sig->params[j].type.kind));
+        printf(") %s {\n", type_name(sig->returntype.kind));
+
+        for (size_t j=0; j < proc->blocks_len; ++j) {
+            const IrBlock *block = proc->blocks[j];
+
+            printf("block%d:", block->id);
+            for (size_t k=0; k < block->preds_len; ++k)
+                printf("%s block%d", k == 0 ? " # preds" : ",", block->preds[k]->id);
+            printf("\n");
+
+            for (size_t k=0; k < block->values_len; ++k)
+                print_value(block->values[k]);
+        }
+
+        printf("}\n\n");
+    }
+
+}
@@ -0,0 +1,93 @@
+#ifndef _IR_H
+#define _IR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <arena.h>
+
+#include "parser.h"
+
+// mid-level IR in SSA form: every procedure is a control flow graph of basic
+// blocks, each holding a list of values. every value is computed exactly once,
+// by a single instruction, and variables only exist as the values assigned to
+// them. where paths with different values of a variable meet, a phi selects the
+// one of the predecessor that has been taken. variables whose address is taken
+// live in stack slots instead, and are accessed through explicit loads and stores
+
+typedef enum {
+    IR_CONST,  // imm
+    IR_PARAM,  // imm: index of the parameter
+    IR_SLOT,   // address of the stack slot at [rbp - imm]
+    IR_STRING, // address of a string literal, name: its contents
+    IR_SYMBOL, // address of the procedure `name`
+    IR_LOAD,   // *args[0]
+    IR_STORE,  // *args[0] = args[1]
+    IR_ADD,
+    IR_SUB,
+    IR_MUL,
+    IR_DIV,
+    IR_AND,
+    IR_OR,
+    IR_PTRADD, // args[0] + args[1] * imm, the index is sign extended first
+    IR_NEG,    // -args[0]
+    IR_NOT,    // args[0] == 0
+    IR_CMP,    // args[0] <cmp> args[1], which is 1 or 0
+    IR_CALL,   // `name` if it is called directly, otherwise args[0], with the arguments after it
+    IR_PHI,    // args[i] if the block has been entered from preds[i]
+    // terminators, the last value of every block, and nowhere else
+    IR_JMP,    // to targets[0]
+    IR_BR,     // to targets[0] if args[0] is not zero, to targets[1] otherwise
+    IR_RET,    // returns args[0], if there is one
+} IrOp;
+
+typedef struct IrBlock IrBlock;
+typedef struct IrValue IrValue;
+
+struct IrValue {
+    IrOp op;
+    TypeKind type;       // TYPE_VOID if the instruction has no result
+    int id;              // numbers the values of a procedure, printed as %<id>
+    IrBlock *block;
+    IrValue **args;
+    size_t args_len, args_cap;
+    int64_t imm;
+    BinOpKind cmp;       // comparison of IR_CMP
+    const char *name;
+    IrBlock *targets[2]; // successors of terminators
+    IrValue *replaced;   // set on phis that turned out to be redundant, NULL otherwise
+};
+
+struct IrBlock {
+    int id;              // position in the layout, printed as block<id>
+    IrValue **values;    // phis first, terminator last
+    size_t values_len, values_cap;
+    IrBlock **preds;     // in the order of the arguments of phis
+    size_t preds_len, preds_cap;
+};
+
+typedef struct {
+    const DeclProc *decl;
+    IrBlock **blocks;    // in layout order, reverse postorder of the CFG, the entry block first
+    size_t blocks_len;
+    int values_count;    // every id is below it
+} IrProc;
+
+typedef struct {
+    IrProc **procs;      // every procedure with a body, in the order of the program
+    size_t procs_len;
+} IrProgram;
+
+// lowers every procedure of the tree, which must have been type checked,
+// variables are turned into SSA values as their blocks are visited
+NO_DISCARD IrProgram *ir_build(AstNode *root, Arena *arena);
+// checks the invariants of the IR, and reports every violation
+// returns false if there have been any
+NO_DISCARD bool ir_verify(const IrProgram *ir);
+// prints the program in textual form, for --dump-ir
+void ir_print(const IrProgram *ir);
+// whether the instruction ends a block
+NO_DISCARD bool ir_is_terminator(IrOp op);
+
+#endif // _IR_H
@@ -22,6 +22,7 @@ const char *stringify_tokenkind(TokenKind tok) {
         case TOK_SENTINEL:       return "sentinel";
         case TOK_EOF:            return "eof";
         case TOK_KW_FOR:         return "for";
+        case TOK_HINT_UNROLL:    return "unroll";
         case TOK_LITERAL_NUMBER: return "num";
         case TOK_PIPE:           return "pipe";
         case TOK_LITERAL_STRING: return "string";
@@ -201,6 +202,36 @@ static void tokenize_number(Lexer *lex) {
 
 }
 
+// `#unroll(<n>)`
+static void tokenize_hint(Lexer *lex) {
+
+    Token *tok = &lex->tok;
+    const char *start = lex->src;
+
+    tok->kind = TOK_HINT_UNROLL;
+    lex->src += strlen("#unroll(");
+
+    if (!isdigit(*lex->src)) {
+        diagnostic_loc(DIAG_ERROR, tok, "Expected the unroll factor after `#unroll(`");
+        exit(EXIT_FAILURE);
+    }
+
+    tok->number = strtoull(lex->src, (char**) &lex->src, 10);
+
+    if (*lex->src != ')') {
+        diagnostic_loc(DIAG_ERROR, tok, "Expected `)` after the unroll factor");
+        exit(EXIT_FAILURE);
+    }
+
+    lex->src++;
+    tok->len = lex->src - start;
+
+    if (tok->number > MAX_UNROLL_FACTOR) {
+        diagnostic_loc(DIAG_ERROR, tok, "Unroll factors may not be larger than %d", MAX_UNROLL_FACTOR);
+        exit(EXIT_FAILURE);
+    }
+}
+
 static void tokenize_ident(Lexer *lex) {
 
     Token *tok = &lex->tok;
@@ -278,6 +309,12 @@ Token lexer_next(Lexer *lex) {
             break;
 
         case '#':
+            // a comment, unless it is a hint
+            if (!strncmp(lex->src, "#unroll(", strlen("#unroll("))) {
+                tokenize_hint(lex);
+                break;
+            }
+
             while (*++lex->src != '\n');
             lex->src++;
             return lexer_next(lex);
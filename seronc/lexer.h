@@ -9,6 +9,7 @@
 
 #define MAX_IDENT_LEN 64
 #define MAX_NUMBER_LITERAL_LEN 64
+#define MAX_UNROLL_FACTOR 64
 
 typedef enum {
     TOK_INVALID,  // invalid token, should never appear, but can be used for enforcing invariants
@@ -62,6 +63,8 @@ typedef enum {
     TOK_KW_TYPE_CHAR,
     TOK_KW_TYPE_INT,
     TOK_KW_TYPE_LONG,
+
+    TOK_HINT_UNROLL, // `#unroll(<n>)`, n is held as a number
 } TokenKind;
 
 const char *stringify_tokenkind(TokenKind tok);
@@ -0,0 +1,539 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+
+#include "loop.h"
+
+// loops are visited innermost first, after `for` loops have become while loops.
+// a variable is invariant in a loop, if it is neither declared nor assigned to
+// anywhere in it, and its address is never taken in the whole procedure, so
+// no store through a pointer and no call can change it either.
+//
+// pure expressions made up of invariant variables and constants are computed
+// once in front of the loop, into a new variable:
+//
+// while <cond> {          { # Block
+//     <body>                  let t: <type> = <invariant>;
+// }                           while <cond> {
+//                                 <body>
+//                             }
+//                         }
+//
+// a basic induction variable is incremented by a constant exactly once per
+// iteration, by an assignment right in the body of the loop, and not written
+// anywhere else in it. `i * c` and `p + i` of such a variable `i` get a variable
+// of their own, which is initialized in front of the loop, and incremented by
+// `step * c` and `step` right after `i`, so it holds the same value as the
+// expression at any point in the loop.
+//
+// the new variables get slots at the end of the frame of the procedure
+
+static struct {
+    int hoisted, reduced;
+} stats = { 0 };
+
+// derived induction variable, `acc` follows `iv * factor`, or `iv + base`
+typedef struct {
+    Symbol *iv;
+    AstNode *decl; // declaration of acc, in front of the loop
+    int64_t factor;
+    bool pointer;
+} Derived;
+
+typedef struct {
+    Arena *arena;
+    DeclProc *proc;
+    SymbolSet addressed; // variables of the procedure whose address is taken
+    SymbolSet written;   // variables written in the current loop
+    SymbolSet declared;  // variables declared in the current loop
+    SymbolSet ivs;       // basic induction variables of the current loop
+    AstNodeList hoisted; // declarations in front of the current loop
+    Derived *derived;
+    size_t derived_len, derived_cap;
+    int temp_count;
+} Loops;
+
+
+
+NO_DISCARD static bool same_expr(const AstNode *a, const AstNode *b) {
+
+    if (a->kind != b->kind || a->type.kind != b->type.kind) return false;
+
+    switch (a->kind) {
+        case ASTNODE_LITERAL:
+            if (ast_is_constant(a)) return ast_is_constant(b) && ast_constant(a) == ast_constant(b);
+            return ast_variable(a) != NULL && ast_variable(a) == ast_variable(b);
+
+        case ASTNODE_GROUPING:
+            return same_expr(a->expr_grouping.expr, b->expr_grouping.expr);
+
+        case ASTNODE_UNARYOP:
+            return a->expr_unaryop.kind == b->expr_unaryop.kind
+                && same_expr(a->expr_unaryop.node, b->expr_unaryop.node);
+
+        case ASTNODE_BINOP:
+            return a->expr_binop.kind == b->expr_binop.kind
+                && same_expr(a->expr_binop.lhs, b->expr_binop.lhs)
+                && same_expr(a->expr_binop.rhs, b->expr_binop.rhs);
+
+        default:
+            return false;
+    }
+}
+
+
+
+// moves the expression into a new variable, which is declared in front of the
+// loop, and replaces it by a reference to that variable
+static AstNode *new_temporary(Loops *l, AstNode *expr) {
+
+    Type type = expr->type;
+    int offset = symboltable_new_slot(l->proc, type_primitive_size(type.kind));
+
+    Symbol *sym = arena_alloc(l->arena, sizeof(Symbol));
+    *sym = (Symbol) {
+        .kind   = SYMBOL_VARIABLE,
+        .type   = type,
+        .offset = offset,
+    };
+
+    Token op = { 0 };
+    op.kind = TOK_LITERAL_IDENT;
+    snprintf(op.value, ARRAY_LEN(op.value), "loop%d", l->temp_count++);
+
+    AstNode *init = ast_new_node(l->arena, expr->kind, type);
+    *init = *expr;
+
+    AstNode *decl = ast_new_node(l->arena, ASTNODE_VARDECL, type);
+    decl->stmt_vardecl = (StmtVarDecl) {
+        .op     = op,
+        .ident  = op,
+        .init   = init,
+        .type   = type,
+        .offset = offset,
+        .sym    = sym,
+    };
+    astnodelist_append(&l->hoisted, decl);
+
+    *expr = *ast_new_ident(l->arena, sym, op);
+    return decl;
+}
+
+
+
+static void addressed(AstNode *node, UNUSED int _depth, void *args) {
+    Loops *l = args;
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+    Symbol *sym = ast_variable(unaryop->node);
+    if (unaryop->kind == UNARYOP_ADDROF && sym != NULL)
+        symbolset_add(&l->addressed, sym);
+}
+
+static void written_assign(AstNode *node, UNUSED int _depth, void *args) {
+    Loops *l = args;
+
+    Symbol *sym = ast_variable(node->expr_assign.target);
+    if (sym != NULL)
+        symbolset_add(&l->written, sym);
+}
+
+static void written_vardecl(AstNode *node, UNUSED int _depth, void *args) {
+    Loops *l = args;
+    symbolset_add(&l->written, node->stmt_vardecl.sym);
+    symbolset_add(&l->declared, node->stmt_vardecl.sym);
+}
+
+// `i = i + c`, `i = c + i` or `i = i - c`, returns the variable, or NULL
+NO_DISCARD static Symbol *increment(const AstNode *node, int64_t *step) {
+    if (node->kind != ASTNODE_ASSIGN) return NULL;
+
+    Symbol *sym = ast_variable(node->expr_assign.target);
+    const AstNode *value = node->expr_assign.value;
+
+    if (sym == NULL || !ast_is_integer(sym->type.kind) || value->kind != ASTNODE_BINOP) return NULL;
+
+    const ExprBinOp *binop = &value->expr_binop;
+
+    if (binop->kind == BINOP_ADD && ast_variable(binop->lhs) == sym && ast_is_constant(binop->rhs)) {
+        *step = ast_constant(binop->rhs);
+        return sym;
+    }
+
+    if (binop->kind == BINOP_ADD && ast_variable(binop->rhs) == sym && ast_is_constant(binop->lhs)) {
+        *step = ast_constant(binop->lhs);
+        return sym;
+    }
+
+    if (binop->kind == BINOP_SUB && ast_variable(binop->lhs) == sym && ast_is_constant(binop->rhs)) {
+        *step = -(uint64_t) ast_constant(binop->rhs);
+        return sym;
+    }
+
+    return NULL;
+}
+
+static void count_assign(AstNode *node, UNUSED int _depth, void *args) {
+    const Symbol *sym = ((void**) args)[0];
+    int *count = ((void**) args)[1];
+
+    if (ast_variable(node->expr_assign.target) == sym)
+        (*count)++;
+}
+
+NO_DISCARD static int count_writes(AstNode *loop, const Symbol *sym) {
+    int count = 0;
+    void *args[] = { (void*) sym, &count };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_ASSIGN, count_assign, NULL },
+    };
+
+    parser_dispatch_ast(loop, table, ARRAY_LEN(table), args);
+    return count;
+}
+
+// unrolled loops increment their variables once per copy of the body, which
+// is fine as long as every write is such an increment at the top level
+NO_DISCARD static int count_increments(const AstNodeList *stmts, const Symbol *sym) {
+    int count = 0;
+
+    for (size_t i=0; i < stmts->size; ++i) {
+        int64_t step;
+        count += increment(stmts->items[i], &step) == sym;
+    }
+
+    return count;
+}
+
+static void find_ivs(Loops *l, AstNode *loop) {
+    AstNodeList *stmts = &loop->stmt_while.body->block.stmts;
+
+    for (size_t i=0; i < stmts->size; ++i) {
+        int64_t step;
+        Symbol *sym = increment(stmts->items[i], &step);
+
+        // variables declared in the loop start over in every iteration
+        if (sym == NULL || symbolset_contains(&l->addressed, sym) || symbolset_contains(&l->declared, sym)) continue;
+        if (symbolset_contains(&l->ivs, sym) || count_writes(loop, sym) != count_increments(stmts, sym)) continue;
+
+        symbolset_add(&l->ivs, sym);
+    }
+}
+
+
+
+NO_DISCARD static bool is_invariant(const Loops *l, const AstNode *node) {
+
+    switch (node->kind) {
+        case ASTNODE_LITERAL: {
+            if (ast_is_constant(node)) return true;
+
+            Symbol *sym = ast_variable(node);
+            return sym != NULL
+                && !symbolset_contains(&l->written, sym)
+                && !symbolset_contains(&l->addressed, sym);
+        }
+
+        case ASTNODE_GROUPING:
+            return is_invariant(l, node->expr_grouping.expr);
+
+        case ASTNODE_UNARYOP:
+            return (node->expr_unaryop.kind == UNARYOP_MINUS || node->expr_unaryop.kind == UNARYOP_NEG)
+                && is_invariant(l, node->expr_unaryop.node);
+
+        case ASTNODE_BINOP:
+            // divisions may trap, and must not be executed when the loop is not
+            // the operands of short-circuiting operators are left alone as well
+            switch (node->expr_binop.kind) {
+                case BINOP_DIV:
+                case BINOP_LOG_OR:
+                case BINOP_LOG_AND:
+                    return false;
+                default:
+                    return is_invariant(l, node->expr_binop.lhs) && is_invariant(l, node->expr_binop.rhs);
+            }
+
+        default:
+            return false;
+    }
+}
+
+// `iv * c`, `c * iv`, `p + iv` or `iv + p`
+NO_DISCARD static bool is_derived(const Loops *l, const AstNode *node, Symbol **iv, int64_t *factor, bool *pointer) {
+    if (node->kind != ASTNODE_BINOP) return false;
+
+    const ExprBinOp *binop = &node->expr_binop;
+    Symbol *lhs = ast_variable(binop->lhs);
+    Symbol *rhs = ast_variable(binop->rhs);
+    bool lhs_iv = lhs != NULL && symbolset_contains(&l->ivs, lhs);
+    bool rhs_iv = rhs != NULL && symbolset_contains(&l->ivs, rhs);
+
+    if (binop->kind == BINOP_MUL && (lhs_iv || rhs_iv)) {
+        const AstNode *c = lhs_iv ? binop->rhs : binop->lhs;
+        if (!ast_is_constant(c)) return false;
+
+        *iv      = lhs_iv ? lhs : rhs;
+        *factor  = ast_constant(c);
+        *pointer = false;
+        return true;
+    }
+
+    if (binop->kind == BINOP_ADD && node->type.kind == TYPE_POINTER && (lhs_iv || rhs_iv)) {
+        const AstNode *p = lhs_iv ? binop->rhs : binop->lhs;
+        if (p->type.kind != TYPE_POINTER || ast_variable(p) == NULL || !is_invariant(l, p)) return false;
+
+        *iv      = lhs_iv ? lhs : rhs;
+        *factor  = 1;
+        *pointer = true;
+        return true;
+    }
+
+    return false;
+}
+
+static void reduce(Loops *l, AstNode *node) {
+
+    Symbol *iv;
+    int64_t factor;
+    bool pointer;
+    if (!is_derived(l, node, &iv, &factor, &pointer)) return;
+
+    for (size_t i=0; i < l->derived_len; ++i) {
+        AstNode *decl = l->derived[i].decl;
+        if (!same_expr(decl->stmt_vardecl.init, node)) continue;
+
+        *node = *ast_new_ident(l->arena, decl->stmt_vardecl.sym, decl->stmt_vardecl.ident);
+        stats.reduced++;
+        return;
+    }
+
+    if (l->derived_len == l->derived_cap) {
+        l->derived_cap = l->derived_cap == 0 ? 8 : l->derived_cap * 2;
+        l->derived = NON_NULL(realloc(l->derived, l->derived_cap * sizeof(Derived)));
+    }
+
+    l->derived[l->derived_len++] = (Derived) {
+        .iv      = iv,
+        .decl    = new_temporary(l, node),
+        .factor  = factor,
+        .pointer = pointer,
+    };
+    stats.reduced++;
+}
+
+// replaces every maximal invariant expression, and every derived induction
+// variable in the tree by a variable
+static void rewrite(Loops *l, AstNode *node) {
+
+    switch (node->kind) {
+        case ASTNODE_BINOP:
+        case ASTNODE_UNARYOP:
+            if (is_invariant(l, node)) {
+
+                for (size_t i=0; i < l->hoisted.size; ++i) {
+                    AstNode *decl = l->hoisted.items[i];
+                    if (!same_expr(decl->stmt_vardecl.init, node)) continue;
+
+                    *node = *ast_new_ident(l->arena, decl->stmt_vardecl.sym, decl->stmt_vardecl.ident);
+                    stats.hoisted++;
+                    return;
+                }
+
+                new_temporary(l, node);
+                stats.hoisted++;
+                return;
+            }
+
+            reduce(l, node);
+            if (node->kind == ASTNODE_LITERAL) return;
+            break;
+
+        default:
+            NOP() break;
+    }
+
+    switch (node->kind) {
+        case ASTNODE_BINOP:
+            rewrite(l, node->expr_binop.lhs);
+            rewrite(l, node->expr_binop.rhs);
+            break;
+
+        case ASTNODE_UNARYOP:  rewrite(l, node->expr_unaryop.node);  break;
+        case ASTNODE_GROUPING: rewrite(l, node->expr_grouping.expr); break;
+
+        case ASTNODE_CALL:
+            // the callee is left alone, calls are direct whenever it is a name
+            for (size_t i=0; i < node->expr_call.args.size; ++i)
+                rewrite(l, node->expr_call.args.items[i]);
+            break;
+
+        case ASTNODE_ASSIGN:
+            // variables are assigned to directly, only the address of a deref is computed
+            if (ast_variable(node->expr_assign.target) == NULL)
+                rewrite(l, node->expr_assign.target);
+            rewrite(l, node->expr_assign.value);
+            break;
+
+        case ASTNODE_BLOCK:
+            for (size_t i=0; i < node->block.stmts.size; ++i)
+                rewrite(l, node->block.stmts.items[i]);
+            break;
+
+        case ASTNODE_VARDECL:
+            if (node->stmt_vardecl.init != NULL)
+                rewrite(l, node->stmt_vardecl.init);
+            break;
+
+        case ASTNODE_IF:
+            rewrite(l, node->stmt_if.condition);
+            rewrite(l, node->stmt_if.then_body);
+            if (node->stmt_if.else_body != NULL)
+                rewrite(l, node->stmt_if.else_body);
+            break;
+
+        case ASTNODE_WHILE:
+            if (node->stmt_while.vector != NULL) break;
+            rewrite(l, node->stmt_while.condition);
+            rewrite(l, node->stmt_while.body);
+            break;
+
+        case ASTNODE_RETURN:
+            if (node->stmt_return.expr != NULL)
+                rewrite(l, node->stmt_return.expr);
+            break;
+
+        case ASTNODE_ARRAY:
+            for (size_t i=0; i < node->expr_array.values.size; ++i)
+                rewrite(l, node->expr_array.values.items[i]);
+            break;
+
+        default:
+            NOP() break;
+    }
+}
+
+// `acc = acc + step * factor`, right behind the increment of the induction variable
+static void increment_derived(Loops *l, AstNode *loop) {
+    Block *body = &loop->stmt_while.body->block;
+
+    AstNodeList stmts;
+    astnodelist_init(&stmts, l->arena);
+
+    for (size_t i=0; i < body->stmts.size; ++i) {
+        AstNode *stmt = body->stmts.items[i];
+        astnodelist_append(&stmts, stmt);
+
+        int64_t step;
+        Symbol *sym = increment(stmt, &step);
+        if (sym == NULL || !symbolset_contains(&l->ivs, sym)) continue;
+
+        for (size_t d=0; d < l->derived_len; ++d) {
+            const Derived *derived = &l->derived[d];
+            if (derived->iv != sym) continue;
+
+            StmtVarDecl *decl = &derived->decl->stmt_vardecl;
+            Token op = decl->ident;
+
+            // pointer arithmetic scales the step by itself
+            Type step_type = derived->pointer ? sym->type : decl->type;
+            int64_t value = ast_wrap((uint64_t) step * (uint64_t) derived->factor, step_type.kind);
+
+            AstNode *add = ast_new_node(l->arena, ASTNODE_BINOP, decl->type);
+            add->expr_binop = (ExprBinOp) {
+                .kind = BINOP_ADD,
+                .op   = op,
+                .lhs  = ast_new_ident(l->arena, decl->sym, op),
+                .rhs  = ast_new_number(l->arena, value, step_type, op),
+            };
+
+            AstNode *assign = ast_new_node(l->arena, ASTNODE_ASSIGN, decl->type);
+            assign->expr_assign = (ExprAssign) {
+                .op     = op,
+                .target = ast_new_ident(l->arena, decl->sym, op),
+                .value  = add,
+            };
+
+            astnodelist_append(&stmts, assign);
+        }
+    }
+
+    body->stmts = stmts;
+}
+
+static void while_(AstNode *node, UNUSED int _depth, void *args) {
+    Loops *l = args;
+    StmtWhile *loop = &node->stmt_while;
+
+    // vectorized loops are generated from the nodes as they are
+    if (loop->body->kind != ASTNODE_BLOCK || loop->vector != NULL) return;
+
+    l->written.len = 0;
+    l->declared.len = 0;
+    l->ivs.len = 0;
+    l->derived_len = 0;
+    astnodelist_init(&l->hoisted, l->arena);
+
+    AstDispatchEntry writes[] = {
+        { ASTNODE_ASSIGN,  written_assign,  NULL },
+        { ASTNODE_VARDECL, written_vardecl, NULL },
+    };
+    parser_dispatch_ast(node, writes, ARRAY_LEN(writes), l);
+
+    find_ivs(l, node);
+
+    rewrite(l, loop->condition);
+    rewrite(l, loop->body);
+    increment_derived(l, node);
+
+    if (l->hoisted.size == 0) return;
+
+    // the loop moves into a block, behind the declarations
+    AstNode *inner = ast_new_node(l->arena, ASTNODE_WHILE, node->type);
+    inner->stmt_while = *loop;
+
+    node->kind = ASTNODE_BLOCK;
+    node->block.stmts = l->hoisted;
+    astnodelist_append(&node->block.stmts, inner);
+}
+
+void optimize_loops(AstNode *root, Arena *arena) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    Loops l = { .arena = arena };
+    const AstNodeList *list = &root->block.stmts;
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL) continue;
+
+        l.proc = &node->stmt_proc;
+        l.addressed.len = 0;
+
+        AstDispatchEntry addrs[] = {
+            { ASTNODE_UNARYOP, addressed, NULL },
+        };
+        parser_dispatch_ast(l.proc->body, addrs, ARRAY_LEN(addrs), &l);
+
+        AstDispatchEntry loops[] = {
+            { ASTNODE_WHILE, NULL, while_ },
+        };
+        parser_dispatch_ast(l.proc->body, loops, ARRAY_LEN(loops), &l);
+    }
+
+    free(l.addressed.items);
+    free(l.written.items);
+    free(l.declared.items);
+    free(l.ivs.items);
+    free(l.derived);
+}
+
+void loop_print_stats(void) {
+    printf("LOOP %-18s %d\n", "hoisted", stats.hoisted);
+    printf("LOOP %-18s %d\n", "reduced", stats.reduced);
+}
@@ -0,0 +1,14 @@
+#ifndef _LOOP_H
+#define _LOOP_H
+
+#include <arena.h>
+#include "parser.h"
+
+// hoists invariant expressions out of while loops, and replaces multiples of
+// induction variables by variables that are incremented along with them
+// must be called after fold(), and before inline_calls() looks at the size of bodies
+void optimize_loops(AstNode *root, Arena *arena);
+// prints how many expressions have been hoisted and reduced so far
+void loop_print_stats(void);
+
+#endif // _LOOP_H
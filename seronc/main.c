@@ -4,6 +4,8 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <limits.h>
@@ -22,6 +24,9 @@
 #include "codegen.h"
 #include "symboltable.h"
 #include "expand.h"
+#include "typecheck.h"
+#include "ir.h"
+#include "pass.h"
 #include "main.h"
 
 
@@ -31,6 +36,9 @@
 
 #define FILE_EXTENSION "sn"
 #define TEMP_DIR "/tmp/seron/" // trailing slash is very important
+#define INLINE_LIMIT 40 // default for -finline-limit, in AST nodes, doubled at -O2
+#define INLINE_LIMIT_SIZE 12 // default for -finline-limit at -Os, calls of smaller bodies take more code than the body itself
+#define UNROLL_FACTOR 4 // default for -funroll-factor
 
 
 struct CompilerContext compiler_ctx = { 0 };
@@ -52,12 +60,20 @@ typedef struct {
         int dump_ast;
         int dump_tokens;
         int dump_symboltable;
+        int dump_ir;
+        int check;
+        int stats;
+        int time_passes;
     } opts;
+    unsigned passes_on, passes_off; // -f<pass> and -fno-<pass>, applied over the optimization level
+    int inline_limit, unroll_factor; // -1 unless given explicitly
 } CompilerOptions;
 
 static CompilerOptions compiler_opts_default(void) {
     return (CompilerOptions) {
-        .target = TARGET_RUN,
+        .target        = TARGET_RUN,
+        .inline_limit  = -1,
+        .unroll_factor = -1,
     };
 }
 
@@ -170,6 +186,22 @@ static void run(const char *bin) {
 
 }
 
+// value of `-f<option>=<n>`, which has to be a number from 0 up to max
+NO_DISCARD static int option_value(const char *option, size_t prefix, long max) {
+
+    const char *value = option + prefix;
+    char *end;
+    errno = 0;
+    long n = strtol(value, &end, 10);
+
+    if (!isdigit((unsigned char) *value) || *end != '\0' || errno == ERANGE || n > max) {
+        diagnostic(DIAG_ERROR, "Invalid value in `-f%s`, expected a number from 0 to %ld", option, max);
+        exit(EXIT_FAILURE);
+    }
+
+    return n;
+}
+
 static void print_usage(char *argv[]) {
     fprintf(stderr, "Usage: %s [options] file...\n", argv[0]);
     fprintf(stderr, "Options:\n");
@@ -179,6 +211,22 @@ static void print_usage(char *argv[]) {
             "\t--dump-ast\n"
             "\t--dump-tokens\n"
             "\t--dump-symboltable\n"
+            "\t--dump-ir                       print the SSA IR of every procedure\n"
+            "\t-O<level>                       select optimization level\n"
+            "\t\t0, 1, 2, s\n"
+            "\t-f<pass>, -fno-<pass>           enable or disable a single optimization\n"
+            "\t\tfold, dce, vectorize, unroll, loop, cse, inline,\n"
+            "\t\ttail-calls, addressing, const-arith, peephole, regalloc\n"
+            "\t-fomit-frame-pointer            address the stack frame through rsp, and use rbp as a general register\n"
+            "\t-finline-limit=<size>           inline procedures of up to <size> AST nodes at -O1\n"
+            "\t-funroll-factor=<n>             unroll small loops <n> times at -O2, 1 disables unrolling\n"
+            "\t-fwhole-program                 remove procedures that can not be reached from main at -O1\n"
+            "\t-fssa                           generate code from the SSA IR instead of the syntax tree\n"
+            "\t-m<target>                      select the instruction set of vectorized loops\n"
+            "\t\tsse2, avx2\n"
+            "\t--check                         only check the program, without generating code\n"
+            "\t--stats                         print optimization statistics\n"
+            "\t--time-passes                   print the time and memory spent in every pass\n"
             );
     exit(EXIT_FAILURE);
 }
@@ -193,13 +241,17 @@ static CompilerOptions parse_args(int argc, char **argv) {
         { "dump-ast",         no_argument,       &opts.opts.dump_ast,         1 },
         { "dump-tokens",      no_argument,       &opts.opts.dump_tokens,      1 },
         { "dump-symboltable", no_argument,       &opts.opts.dump_symboltable, 1 },
+        { "dump-ir",          no_argument,       &opts.opts.dump_ir,          1 },
+        { "check",            no_argument,       &opts.opts.check,            1 },
+        { "stats",            no_argument,       &opts.opts.stats,            1 },
+        { "time-passes",      no_argument,       &opts.opts.time_passes,      1 },
         // TODO:
         // { "target",           required_argument, &compiler_ctx.opts.dump_symboltable, 1 },
         { NULL, 0, NULL, 0 },
     };
 
     while (1) {
-        int c = getopt_long(argc, argv, "t:", options, &opt_index);
+        int c = getopt_long(argc, argv, "t:O:f:m:", options, &opt_index);
 
         if (c == -1)
             break;
@@ -230,6 +282,77 @@ static CompilerOptions parse_args(int argc, char **argv) {
 
                 break;
 
+            case 'O':
+
+                if (!strcmp(optarg, "0")) {
+                    compiler_ctx.opt_level = 0;
+
+                } else if (!strcmp(optarg, "1")) {
+                    compiler_ctx.opt_level = 1;
+
+                } else if (!strcmp(optarg, "2")) {
+                    compiler_ctx.opt_level = 2;
+
+                } else if (!strcmp(optarg, "s")) {
+                    compiler_ctx.opt_level = 2;
+                    compiler_ctx.optimize_size = true;
+
+                } else {
+                    diagnostic(DIAG_ERROR, "Unknown optimization level");
+                    exit(EXIT_FAILURE);
+                }
+
+                break;
+
+            case 'f': {
+
+                Pass pass;
+
+                if (!strcmp(optarg, "omit-frame-pointer")) {
+                    compiler_ctx.omit_frame_pointer = true;
+
+                } else if (!strcmp(optarg, "whole-program")) {
+                    compiler_ctx.whole_program = true;
+
+                } else if (!strcmp(optarg, "ssa")) {
+                    compiler_ctx.ssa = true;
+
+                } else if (!strncmp(optarg, "inline-limit=", strlen("inline-limit="))) {
+                    opts.inline_limit = option_value(optarg, strlen("inline-limit="), INT_MAX);
+
+                } else if (!strncmp(optarg, "unroll-factor=", strlen("unroll-factor="))) {
+                    opts.unroll_factor = option_value(optarg, strlen("unroll-factor="), MAX_UNROLL_FACTOR);
+
+                } else if (!strncmp(optarg, "no-", strlen("no-")) && pass_lookup(optarg + strlen("no-"), &pass)) {
+                    opts.passes_off |= 1u << pass;
+                    opts.passes_on  &= ~(1u << pass);
+
+                } else if (pass_lookup(optarg, &pass)) {
+                    opts.passes_on  |= 1u << pass;
+                    opts.passes_off &= ~(1u << pass);
+
+                } else {
+                    diagnostic(DIAG_ERROR, "Unknown option `-f%s`", optarg);
+                    exit(EXIT_FAILURE);
+                }
+
+            } break;
+
+            case 'm':
+
+                if (!strcmp(optarg, "sse2")) {
+                    compiler_ctx.avx2 = false;
+
+                } else if (!strcmp(optarg, "avx2")) {
+                    compiler_ctx.avx2 = true;
+
+                } else {
+                    diagnostic(DIAG_ERROR, "Unknown target `-m%s`", optarg);
+                    exit(EXIT_FAILURE);
+                }
+
+                break;
+
             default:
                 diagnostic(DIAG_ERROR, "Unknown option");
                 exit(EXIT_FAILURE);
@@ -243,11 +366,22 @@ static CompilerOptions parse_args(int argc, char **argv) {
     const char *filename = argv[optind];
     check_fileextension(filename);
     compiler_ctx.filename = filename;
+    compiler_ctx.stats = opts.opts.stats;
+    compiler_ctx.time_passes = opts.opts.time_passes;
+
+    // toggles and limits win over the level, no matter which comes first
+    int level = compiler_ctx.opt_level;
+    bool size = compiler_ctx.optimize_size;
+    compiler_ctx.passes = (pass_level(level, size) | opts.passes_on) & ~opts.passes_off;
+
+    int inline_limit = size ? INLINE_LIMIT_SIZE : level >= 2 ? 2 * INLINE_LIMIT : INLINE_LIMIT;
+    compiler_ctx.inline_limit  = opts.inline_limit  != -1 ? opts.inline_limit  : inline_limit;
+    compiler_ctx.unroll_factor = opts.unroll_factor != -1 ? opts.unroll_factor : UNROLL_FACTOR;
 
     return opts;
 }
 
-static void dispatch(AstNode *root, CompilerOptions opts) {
+static void dispatch(AstNode *root, const IrProgram *ir, CompilerOptions opts) {
 
     const char *filename = compiler_ctx.filename;
 
@@ -294,22 +428,22 @@ static void dispatch(AstNode *root, CompilerOptions opts) {
 
     switch (opts.target) {
         case TARGET_BINARY:
-            codegen(root, tmp_asm);
+            codegen(root, ir, tmp_asm);
             assemble(tmp_asm, tmp_obj);
             link_cc(tmp_obj, rel_bin);
             break;
 
         case TARGET_OBJECT:
-            codegen(root, tmp_asm);
+            codegen(root, ir, tmp_asm);
             assemble(tmp_asm, rel_obj);
             break;
 
         case TARGET_ASSEMBLY:
-            codegen(root, rel_asm);
+            codegen(root, ir, rel_asm);
             break;
 
         case TARGET_RUN:
-            codegen(root, tmp_asm);
+            codegen(root, ir, tmp_asm);
             assemble(tmp_asm, tmp_obj);
             link_cc(tmp_obj, tmp_bin);
             run(tmp_bin);
@@ -332,15 +466,55 @@ int main(int argc, char **argv) {
     Arena arena = { 0 };
     arena_init(&arena);
 
+    pass_start(PASS_PARSE, &arena);
     AstNode *root = parse(file, &arena);
+    pass_stop(PASS_PARSE, &arena);
+
+    pass_start(PASS_EXPAND, &arena);
     expand_ast(root, &arena);
+    pass_stop(PASS_EXPAND, &arena);
 
     if (opts.opts.dump_ast)
         parser_print_ast(root, 2);
 
+    pass_start(PASS_SYMBOLS, &arena);
     symboltable_build(root, &arena);
+    pass_stop(PASS_SYMBOLS, &arena);
+
+    pass_start(PASS_TYPECHECK, &arena);
+    typecheck(root);
+    pass_stop(PASS_TYPECHECK, &arena);
+
+    // the program is valid once it type checks, neither optimizations nor the IR are needed
+    if (opts.opts.check) {
+        if (compiler_ctx.time_passes)
+            passes_print_times();
+
+        arena_free(&arena);
+        free(file);
+        return EXIT_SUCCESS;
+    }
+
+    passes_run(root, &arena);
+
+    // lowered after the optimizations of the tree, which carry over into the IR
+    IrProgram *ir = NULL;
+    if (opts.opts.dump_ir || compiler_ctx.ssa) {
+        pass_start(PASS_IR, &arena);
+        ir = ir_build(root, &arena);
+        pass_stop(PASS_IR, &arena);
+
+        if (!ir_verify(ir))
+            exit(EXIT_FAILURE);
+
+        if (opts.opts.dump_ir)
+            ir_print(ir);
+    }
+
+    dispatch(root, compiler_ctx.ssa ? ir : NULL, opts);
 
-    dispatch(root, opts);
+    if (compiler_ctx.time_passes)
+        passes_print_times();
 
     arena_free(&arena);
     free(file);
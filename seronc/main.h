@@ -16,6 +16,17 @@ hence using a global variable makes code cleaner (imo)
 struct CompilerContext {
     const char *src;
     const char *filename;
+    int opt_level;           // -O<level>, -Os is level 2
+    bool optimize_size;      // -Os
+    unsigned passes;         // optimizations that are enabled, a bit for every Pass
+    bool stats;              // --stats
+    bool time_passes;        // --time-passes
+    bool omit_frame_pointer; // -fomit-frame-pointer
+    int inline_limit;        // -finline-limit=<size>
+    int unroll_factor;       // -funroll-factor=<n>
+    bool whole_program;      // -fwhole-program, main is the only procedure called from outside
+    bool ssa;                // -fssa, code is generated from the SSA IR
+    bool avx2;               // -mavx2, vectorized loops use 256 bit registers instead of SSE2
 };
 
 extern struct CompilerContext compiler_ctx;
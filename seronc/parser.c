@@ -303,6 +303,7 @@ void parser_traverse_ast(AstNode *root, AstCallback fn_pre, AstCallback fn_post,
 
         case ASTNODE_ASSIGN: {
             depth++;
+            parser_traverse_ast(root->expr_assign.target, fn_pre, fn_post, args);
             parser_traverse_ast(root->expr_assign.value, fn_pre, fn_post, args);
             depth--;
         } break;
@@ -1193,6 +1194,16 @@ static AstNode *rule_stmt_for(Parser *p) {
     return node;
 }
 
+static AstNode *rule_stmt_unroll(Parser *p) {
+    // <unroll> ::= "#unroll(" NUMBER ")" <for>
+
+    Token hint = parser_consume(p, TOK_HINT_UNROLL);
+    AstNode *node = rule_stmt_for(p);
+    node->stmt_for.unroll = hint.number;
+
+    return node;
+}
+
 static AstNode *rule_stmt_while(Parser *p) {
     // <while> ::= "while" <expression> <block>
 
@@ -1267,18 +1278,20 @@ static AstNode *rule_stmt(Parser *p) {
     //             | <if>
     //             | <while>
     //             | <for>
+    //             | <unroll>
     //             | <return>
     //             | <exprstmt>
 
     p->ctx = CONTEXT_STMT;
 
     return
-        parser_match_token(p, TOK_LBRACE)     ? rule_stmt_block  (p) :
-        parser_match_token(p, TOK_KW_VARDECL) ? rule_stmt_vardecl(p) :
-        parser_match_token(p, TOK_KW_IF)      ? rule_stmt_if     (p) :
-        parser_match_token(p, TOK_KW_WHILE)   ? rule_stmt_while  (p) :
-        parser_match_token(p, TOK_KW_FOR)     ? rule_stmt_for    (p) :
-        parser_match_token(p, TOK_KW_RETURN)  ? rule_stmt_return (p) :
+        parser_match_token(p, TOK_LBRACE)      ? rule_stmt_block  (p) :
+        parser_match_token(p, TOK_KW_VARDECL)  ? rule_stmt_vardecl(p) :
+        parser_match_token(p, TOK_KW_IF)       ? rule_stmt_if     (p) :
+        parser_match_token(p, TOK_KW_WHILE)    ? rule_stmt_while  (p) :
+        parser_match_token(p, TOK_KW_FOR)      ? rule_stmt_for    (p) :
+        parser_match_token(p, TOK_HINT_UNROLL) ? rule_stmt_unroll (p) :
+        parser_match_token(p, TOK_KW_RETURN)   ? rule_stmt_return (p) :
     rule_exprstmt(p);
 }
 
@@ -32,6 +32,7 @@ typedef enum {
 typedef struct {
     Token op;
     LiteralKind kind;
+    Symbol *sym; // set by symboltable_build() for identifiers
 } ExprLiteral;
 
 typedef struct {
@@ -78,6 +79,7 @@ typedef struct {
     Token op;
     AstNode *callee;
     AstNodeList args;
+    AstNode *inlined; // procedure expanded in place of the call, set by inline_calls()
 } ExprCall;
 
 typedef struct {
@@ -99,7 +101,6 @@ typedef struct {
 
 typedef struct {
     AstNodeList stmts;
-    Hashtable *symboltable;
 } Block;
 
 typedef struct {
@@ -111,7 +112,6 @@ typedef struct {
     Token op, ident;
     AstNode *body;          // NULL if declaration
     Type type;              // type is holding function signature
-    Hashtable *symboltable; // for convenience
     int stack_size;
 } DeclProc;
 
@@ -123,6 +123,8 @@ typedef struct {
 typedef struct {
     Token op;
     AstNode *condition, *body;
+    int unroll; // hint of the for loop it was expanded from, 0 if there is none
+    const struct VectorLoop *vector; // set by vectorize_loops(), NULL if the loop stays scalar
 } StmtWhile;
 
 typedef struct {
@@ -131,6 +133,7 @@ typedef struct {
     Type var_type;
     Token var_ident;
     AstNode *var_expr;
+    int unroll; // factor of an `#unroll(<n>)` hint, 0 if there is none
 } StmtFor;
 
 typedef struct {
@@ -143,6 +146,7 @@ typedef struct {
     AstNode *init; // NULL if declaration
     Type type;
     int offset; // rbp offset
+    Symbol *sym; // set by symboltable_build()
 } StmtVarDecl;
 
 typedef enum {
@@ -166,6 +170,7 @@ typedef enum {
 
 struct AstNode {
     AstNodeKind kind;
+    Type type; // type of expressions, set by typecheck()
     union {
         ExprLiteral  expr_literal;
         ExprGrouping expr_grouping;
@@ -0,0 +1,230 @@
+#define _DEFAULT_SOURCE // clock_gettime()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include <sys/resource.h>
+
+#include "fold.h"
+#include "dce.h"
+#include "vector.h"
+#include "unroll.h"
+#include "loop.h"
+#include "cse.h"
+#include "inline.h"
+#include "main.h"
+
+#include "pass.h"
+
+#define BIT(pass) (1u << (pass))
+
+// names are used by -f<name> and --time-passes. phases without a level
+// always run, and can not be toggled. -O1 cleans up the tree and generates
+// good code for it, the loop transformations are left to -O2
+static const struct {
+    const char *name;
+    int level;  // lowest -O<level> the optimization is enabled at, 0 for phases
+    bool grows; // trades code size for speed, left out by -Os
+} passes[PASS_COUNT] = {
+    [PASS_PARSE]       = { "parse",       0, false },
+    [PASS_EXPAND]      = { "expand",      0, false },
+    [PASS_SYMBOLS]     = { "symbols",     0, false },
+    [PASS_TYPECHECK]   = { "typecheck",   0, false },
+    [PASS_FOLD]        = { "fold",        1, false },
+    [PASS_DCE]         = { "dce",         1, false },
+    [PASS_VECTORIZE]   = { "vectorize",   2, true  },
+    [PASS_UNROLL]      = { "unroll",      2, true  },
+    [PASS_LOOP]        = { "loop",        2, false },
+    [PASS_CSE]         = { "cse",         1, false },
+    [PASS_INLINE]      = { "inline",      1, false },
+    [PASS_IR]          = { "ir",          0, false },
+    [PASS_CODEGEN]     = { "codegen",     0, false },
+    [PASS_TAIL_CALLS]  = { "tail-calls",  1, false },
+    [PASS_ADDRESSING]  = { "addressing",  1, false },
+    [PASS_CONST_ARITH] = { "const-arith", 1, false },
+    [PASS_PEEPHOLE]    = { "peephole",    1, false },
+    [PASS_REGALLOC]    = { "regalloc",    1, false },
+};
+
+static struct {
+    double seconds[PASS_COUNT];
+    size_t allocs[PASS_COUNT];
+    long rss[PASS_COUNT];   // growth of the peak resident set in KiB
+    int runs[PASS_COUNT];
+    Pass stack[PASS_COUNT]; // passes that are being timed, the innermost last
+    size_t depth;
+    // where the innermost pass has been started or resumed
+    double start;
+    size_t start_allocs;
+    long start_rss;
+} timers = { 0 };
+
+
+
+unsigned pass_level(int level, bool size) {
+    unsigned enabled = 0;
+
+    for (Pass p=0; p < PASS_COUNT; ++p) {
+        if (passes[p].level == 0 || passes[p].level > level) continue;
+        if (size && passes[p].grows) continue;
+        enabled |= BIT(p);
+    }
+
+    return enabled;
+}
+
+bool pass_lookup(const char *name, Pass *pass) {
+    for (Pass p=0; p < PASS_COUNT; ++p) {
+        if (passes[p].level == 0 || strcmp(passes[p].name, name)) continue;
+        *pass = p;
+        return true;
+    }
+    return false;
+}
+
+bool pass_enabled(Pass pass) {
+    return compiler_ctx.passes & BIT(pass);
+}
+
+
+
+static void run_fold(AstNode *root, Arena *arena) {
+    fold(root, arena);
+}
+
+// folded constants and branches leave variables and statements behind that are never used
+static void run_dce(AstNode *root, UNUSED Arena *arena) {
+    eliminate_dead_code(root);
+}
+
+// loops are vectorized before they are unrolled or rewritten in any way
+static void run_vectorize(AstNode *root, Arena *arena) {
+    vectorize_loops(root, arena);
+}
+
+// unrolled copies are folded again, with the values of the loop variable substituted
+static void run_unroll(AstNode *root, Arena *arena) {
+    if (unroll_loops(root, arena, compiler_ctx.unroll_factor) && pass_enabled(PASS_FOLD))
+        fold(root, arena);
+}
+
+static void run_loop(AstNode *root, Arena *arena) {
+    optimize_loops(root, arena);
+}
+
+// expressions are reused after loops have been rewritten, which hoists some of them already
+static void run_cse(AstNode *root, Arena *arena) {
+    eliminate_common_subexpressions(root, arena);
+}
+
+static void run_inline(AstNode *root, UNUSED Arena *arena) {
+    inline_calls(root, compiler_ctx.inline_limit);
+}
+
+// optimizations of the tree, in the order they run, each one is given what
+// the ones before it left behind
+static const struct {
+    Pass pass;
+    void (*run)(AstNode *root, Arena *arena);
+    void (*print_stats)(void);
+} pipeline[] = {
+    { PASS_FOLD,      run_fold,      fold_print_stats   },
+    { PASS_DCE,       run_dce,       dce_print_stats    },
+    { PASS_VECTORIZE, run_vectorize, vector_print_stats },
+    { PASS_UNROLL,    run_unroll,    unroll_print_stats },
+    { PASS_LOOP,      run_loop,      loop_print_stats   },
+    { PASS_CSE,       run_cse,       cse_print_stats    },
+    { PASS_INLINE,    run_inline,    inline_print_stats },
+};
+
+void passes_run(AstNode *root, Arena *arena) {
+
+    for (size_t i=0; i < ARRAY_LEN(pipeline); ++i) {
+        if (!pass_enabled(pipeline[i].pass)) continue;
+
+        pass_start(pipeline[i].pass, arena);
+        pipeline[i].run(root, arena);
+        pass_stop(pipeline[i].pass, arena);
+    }
+
+    if (!compiler_ctx.stats) return;
+
+    for (size_t i=0; i < ARRAY_LEN(pipeline); ++i) {
+        if (pass_enabled(pipeline[i].pass))
+            pipeline[i].print_stats();
+    }
+}
+
+
+
+NO_DISCARD static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+NO_DISCARD static long peak_rss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// adds everything since the innermost pass has been started or resumed to it
+static void charge(const Arena *arena) {
+    double time = now();
+    size_t allocs = arena != NULL ? arena->size : timers.start_allocs;
+    long rss = peak_rss();
+
+    if (timers.depth > 0) {
+        Pass top = timers.stack[timers.depth - 1];
+        timers.seconds[top] += time - timers.start;
+        timers.allocs[top]  += allocs - timers.start_allocs;
+        timers.rss[top]     += rss - timers.start_rss;
+    }
+
+    timers.start        = time;
+    timers.start_allocs = allocs;
+    timers.start_rss    = rss;
+}
+
+void pass_start(Pass pass, const Arena *arena) {
+    if (!compiler_ctx.time_passes) return;
+    assert(timers.depth < PASS_COUNT);
+
+    charge(arena);
+    timers.stack[timers.depth++] = pass;
+    timers.runs[pass]++;
+}
+
+void pass_stop(Pass pass, const Arena *arena) {
+    if (!compiler_ctx.time_passes) return;
+    assert(timers.depth > 0 && timers.stack[timers.depth - 1] == pass);
+
+    charge(arena);
+    timers.depth--;
+}
+
+void passes_print_times(void) {
+    double total = 0;
+    size_t allocs = 0;
+    long rss = 0;
+
+    for (Pass p=0; p < PASS_COUNT; ++p) {
+        total  += timers.seconds[p];
+        allocs += timers.allocs[p];
+        rss    += timers.rss[p];
+    }
+
+    printf("TIME %-12s %10s %6s %8s %8s\n", "pass", "ms", "%", "allocs", "rss KiB");
+
+    for (Pass p=0; p < PASS_COUNT; ++p) {
+        if (timers.runs[p] == 0) continue;
+
+        double share = total > 0 ? 100 * timers.seconds[p] / total : 0;
+        printf("TIME %-12s %10.3f %5.1f%% %8zu %8ld\n", passes[p].name, 1e3 * timers.seconds[p], share, timers.allocs[p], timers.rss[p]);
+    }
+
+    printf("TIME %-12s %10.3f %5.1f%% %8zu %8ld\n", "total", 1e3 * total, 100.0, allocs, rss);
+}
@@ -0,0 +1,55 @@
+#ifndef _PASS_H
+#define _PASS_H
+
+#include <stdbool.h>
+
+#include <arena.h>
+
+#include "parser.h"
+
+// every phase of the compiler, in the order they run
+// optimizations are enabled by the optimization level, and can be toggled
+// one by one with -f<name> and -fno-<name>
+typedef enum {
+    PASS_PARSE,
+    PASS_EXPAND,
+    PASS_SYMBOLS,
+    PASS_TYPECHECK,
+    // optimizations of the tree
+    PASS_FOLD,
+    PASS_DCE,
+    PASS_VECTORIZE,
+    PASS_UNROLL,
+    PASS_LOOP,
+    PASS_CSE,
+    PASS_INLINE,
+    PASS_IR,
+    PASS_CODEGEN,
+    // optimizations during code generation
+    PASS_TAIL_CALLS,
+    PASS_ADDRESSING,
+    PASS_CONST_ARITH,
+    PASS_PEEPHOLE,
+    PASS_REGALLOC,
+
+    PASS_COUNT,
+} Pass;
+
+// optimizations enabled by -O<level>, -Os is level 2 without the ones that grow the code
+NO_DISCARD unsigned pass_level(int level, bool size);
+// finds the optimization called `name`, returns false if there is none
+NO_DISCARD bool pass_lookup(const char *name, Pass *pass);
+NO_DISCARD bool pass_enabled(Pass pass);
+
+// runs the enabled optimizations of the tree, and prints their statistics with --stats
+void passes_run(AstNode *root, Arena *arena);
+
+// with --time-passes, the time between these calls is added to the pass, along
+// with the allocations from the arena and the growth of the resident set.
+// timers may be nested, the time of the inner pass is not added to the outer one
+void pass_start(Pass pass, const Arena *arena);
+void pass_stop(Pass pass, const Arena *arena);
+// prints the time and memory of every pass that has run
+void passes_print_times(void);
+
+#endif // _PASS_H
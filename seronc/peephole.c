@@ -0,0 +1,365 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ver.h>
+
+#include "instruction.h"
+#include "peephole.h"
+
+// every rule looks at a small window of instructions starting at the given
+// index, and rewrites it in place if it matches, which is repeated until no
+// rule matches anymore
+//
+// some rules rely on an invariant of the code generator: values never stay in
+// registers across statements, so rax is dead after a conditional branch
+
+#define PEEPHOLE_MAX_WINDOW 64
+
+typedef bool (*PeepholeRule)(InstructionList *list, size_t i);
+
+typedef struct {
+    const char *name;
+    PeepholeRule fn;
+    int hits;
+} PeepholeEntry;
+
+static struct {
+    size_t ins_before, ins_after;
+} stats = { 0 };
+
+
+
+NO_DISCARD static inline Instruction *at(InstructionList *list, size_t i) {
+    return i < list->len ? &list->items[i] : NULL;
+}
+
+NO_DISCARD static inline bool is_reg(const Operand *op, Register reg) {
+    return op->kind == OPERAND_REG && op->reg == reg;
+}
+
+NO_DISCARD static inline bool is_ins(const Instruction *ins, Opcode op) {
+    return ins != NULL && ins->op == op;
+}
+
+NO_DISCARD static bool operand_equal(const Operand *a, const Operand *b) {
+    if (a->kind != b->kind) return false;
+
+    switch (a->kind) {
+        case OPERAND_NONE:   return true;
+        case OPERAND_REG:    return a->reg == b->reg && a->size == b->size;
+        case OPERAND_IMM:    return a->imm == b->imm;
+        case OPERAND_MEM:    return a->reg == b->reg && a->index == b->index && a->scale == b->scale
+                                 && a->imm == b->imm && a->size == b->size;
+        case OPERAND_LABEL:  return a->label == b->label && a->id == b->id;
+        case OPERAND_SYMBOL: return !strcmp(a->symbol, b->symbol);
+    }
+    UNREACHABLE();
+}
+
+NO_DISCARD static bool is_control_flow(const Instruction *ins) {
+    switch (ins->op) {
+        case OP_LABEL:
+        case OP_CALL:
+        case OP_JMP:
+        case OP_JE:
+        case OP_JNE:
+        case OP_JG:
+        case OP_JGE:
+        case OP_JL:
+        case OP_JLE:
+        case OP_RET:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline Instruction ins2(Opcode op, Operand dst, Operand src) {
+    return (Instruction) { .op = op, .dst = dst, .src = src };
+}
+
+
+
+// push r1
+// pop r2
+// =>
+// mov r2, r1
+static bool rule_push_pop(InstructionList *list, size_t i) {
+    Instruction *push = at(list, i);
+    Instruction *pop  = at(list, i+1);
+
+    if (!is_ins(push, OP_PUSH) || !is_ins(pop, OP_POP)) return false;
+    if (push->dst.kind != OPERAND_REG) return false;
+
+    if (push->dst.reg == pop->dst.reg) {
+        instructionlist_remove(list, i, 2);
+    } else {
+        *push = ins2(OP_MOV, pop->dst, push->dst);
+        instructionlist_remove(list, i+1, 1);
+    }
+
+    return true;
+}
+
+// push r1
+// <ins>
+// pop r2
+// =>
+// mov r2, r1
+// <ins>
+static bool rule_push_ins_pop(InstructionList *list, size_t i) {
+    Instruction *push = at(list, i);
+    Instruction *ins  = at(list, i+1);
+    Instruction *pop  = at(list, i+2);
+
+    if (!is_ins(push, OP_PUSH) || ins == NULL || !is_ins(pop, OP_POP)) return false;
+    if (push->dst.kind != OPERAND_REG) return false;
+
+    Register r1 = push->dst.reg;
+    Register r2 = pop->dst.reg;
+
+    if (r1 == r2 || is_control_flow(ins)) return false;
+    if (instruction_mentions(ins, r2) || instruction_mentions(ins, REG_RSP)) return false;
+
+    *push = ins2(OP_MOV, pop->dst, push->dst);
+    instructionlist_remove(list, i+2, 1);
+    return true;
+}
+
+// mov <mem>, r1
+// mov r2, <mem>
+// =>
+// mov <mem>, r1
+// mov r2, r1 (omitted if r1 == r2)
+static bool rule_store_load(InstructionList *list, size_t i) {
+    Instruction *store = at(list, i);
+    Instruction *load  = at(list, i+1);
+
+    if (!is_ins(store, OP_MOV) || !is_ins(load, OP_MOV)) return false;
+    if (store->dst.kind != OPERAND_MEM || store->src.kind != OPERAND_REG) return false;
+    if (load->dst.kind != OPERAND_REG || !operand_equal(&store->dst, &load->src)) return false;
+    if (load->dst.size != store->src.size) return false;
+
+    if (load->dst.reg == store->src.reg)
+        instructionlist_remove(list, i+1, 1);
+    else
+        load->src = store->src;
+
+    return true;
+}
+
+// mov r1, <src>       (32 or 64 bit, or lea)
+// mov r2, r1          (64 bit)
+// mov r1, <src2>      (32 or 64 bit, not reading r1)
+// =>
+// mov r2, <src>
+// mov r1, <src2>
+static bool rule_forward_load(InstructionList *list, size_t i) {
+    Instruction *load = at(list, i);
+    Instruction *copy = at(list, i+1);
+    Instruction *kill = at(list, i+2);
+
+    if (load == NULL || copy == NULL || kill == NULL) return false;
+    if (!is_ins(load, OP_MOV) && !is_ins(load, OP_LEA)) return false;
+    if (!is_ins(copy, OP_MOV) || !is_ins(kill, OP_MOV)) return false;
+
+    if (load->dst.kind != OPERAND_REG || load->dst.size < 4) return false;
+    Register r1 = load->dst.reg;
+
+    if (copy->dst.kind != OPERAND_REG || copy->dst.size != 8) return false;
+    if (!is_reg(&copy->src, r1) || copy->src.size != 8 || copy->dst.reg == r1) return false;
+
+    // both 32 and 64 bit writes define the whole register
+    if (!is_reg(&kill->dst, r1) || kill->dst.size < 4) return false;
+    if (operand_mentions(&kill->src, r1)) return false;
+
+    load->dst.reg = copy->dst.reg;
+    instructionlist_remove(list, i+1, 1);
+    return true;
+}
+
+// mov rax, rax
+// =>
+// (nothing)
+static bool rule_self_move(InstructionList *list, size_t i) {
+    Instruction *mov = at(list, i);
+
+    if (!is_ins(mov, OP_MOV)) return false;
+    if (mov->dst.kind != OPERAND_REG || !operand_equal(&mov->dst, &mov->src)) return false;
+    // a 32 bit move clears the upper half of the register
+    if (mov->dst.size == 4) return false;
+
+    instructionlist_remove(list, i, 1);
+    return true;
+}
+
+// imul r, -1
+// =>
+// neg r
+static bool rule_mul_neg(InstructionList *list, size_t i) {
+    Instruction *mul = at(list, i);
+
+    if (!is_ins(mul, OP_IMUL)) return false;
+    if (mul->dst.kind != OPERAND_REG || mul->src.kind != OPERAND_IMM || mul->src.imm != -1) return false;
+
+    *mul = (Instruction) { .op = OP_NEG, .dst = mul->dst, .src = operand_none() };
+    return true;
+}
+
+NO_DISCARD static Opcode setcc_to_jcc(Opcode op, bool invert) {
+    switch (op) {
+        case OP_SETE:  return invert ? OP_JNE : OP_JE;
+        case OP_SETNE: return invert ? OP_JE  : OP_JNE;
+        case OP_SETG:  return invert ? OP_JLE : OP_JG;
+        case OP_SETGE: return invert ? OP_JL  : OP_JGE;
+        case OP_SETL:  return invert ? OP_JGE : OP_JL;
+        case OP_SETLE: return invert ? OP_JG  : OP_JLE;
+        default:       return OP_COUNT;
+    }
+}
+
+// setcc al
+// cmp al, 0
+// je <label>
+// =>
+// jncc <label>
+static bool rule_setcc_branch(InstructionList *list, size_t i) {
+    Instruction *set    = at(list, i);
+    Instruction *cmp    = at(list, i+1);
+    Instruction *branch = at(list, i+2);
+
+    if (set == NULL || cmp == NULL || branch == NULL) return false;
+    if (setcc_to_jcc(set->op, false) == OP_COUNT) return false;
+    if (!is_reg(&set->dst, REG_RAX)) return false;
+
+    if (!is_ins(cmp, OP_CMP) || !operand_equal(&cmp->dst, &set->dst)) return false;
+    if (cmp->src.kind != OPERAND_IMM || cmp->src.imm != 0) return false;
+
+    if (!is_ins(branch, OP_JE) && !is_ins(branch, OP_JNE)) return false;
+
+    // rax holds the condition, which is dead after the branch
+    *set = (Instruction) {
+        .op  = setcc_to_jcc(set->op, branch->op == OP_JE),
+        .dst = branch->dst,
+        .src = operand_none(),
+    };
+    instructionlist_remove(list, i+1, 2);
+    return true;
+}
+
+// jmp <label>
+// <label>:
+// =>
+// <label>:
+static bool rule_jump_next(InstructionList *list, size_t i) {
+    Instruction *jmp = at(list, i);
+
+    if (!is_ins(jmp, OP_JMP) || jmp->dst.kind != OPERAND_LABEL) return false;
+
+    // the jump may skip over multiple labels, that all refer to the next instruction
+    for (size_t j=i+1; is_ins(at(list, j), OP_LABEL); ++j) {
+        if (operand_equal(&list->items[j].dst, &jmp->dst)) {
+            instructionlist_remove(list, i, 1);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// mov rax, <symbol>
+// push rax
+// <args>
+// pop rax
+// call rax
+// =>
+// <args>
+// call <symbol>
+static bool rule_direct_call(InstructionList *list, size_t i) {
+    Instruction *mov  = at(list, i);
+    Instruction *push = at(list, i+1);
+
+    if (!is_ins(mov, OP_MOV) || !is_reg(&mov->dst, REG_RAX)) return false;
+    if (mov->src.kind != OPERAND_SYMBOL) return false;
+    if (!is_ins(push, OP_PUSH) || !is_reg(&push->dst, REG_RAX)) return false;
+
+    int depth = 0;
+
+    for (size_t j=i+2; j < list->len && j < i + PEEPHOLE_MAX_WINDOW; ++j) {
+        Instruction *ins = &list->items[j];
+
+        switch (ins->op) {
+            case OP_PUSH:
+                depth++;
+                break;
+
+            case OP_POP:
+                if (depth-- > 0) break;
+
+                Instruction *call = at(list, j+1);
+                if (!is_reg(&ins->dst, REG_RAX) || !is_ins(call, OP_CALL)) return false;
+                if (!is_reg(&call->dst, REG_RAX)) return false;
+
+                *call = (Instruction) { .op = OP_CALL, .dst = mov->src, .src = operand_none() };
+                instructionlist_remove(list, j, 1);
+                instructionlist_remove(list, i, 2);
+                return true;
+
+            case OP_CALL:
+                // nested calls don't change the stack depth
+                break;
+
+            default:
+                if (is_control_flow(ins)) return false;
+                // the arguments must not depend on the exact stack layout
+                if (instruction_mentions(ins, REG_RSP)) return false;
+                break;
+        }
+    }
+
+    return false;
+}
+
+static PeepholeEntry rules[] = {
+    { "push-pop",      rule_push_pop,      0 },
+    { "push-ins-pop",  rule_push_ins_pop,  0 },
+    { "store-load",    rule_store_load,    0 },
+    { "forward-load",  rule_forward_load,  0 },
+    { "self-move",     rule_self_move,     0 },
+    { "mul-neg",       rule_mul_neg,       0 },
+    { "setcc-branch",  rule_setcc_branch,  0 },
+    { "jump-next",     rule_jump_next,     0 },
+    { "direct-call",   rule_direct_call,   0 },
+};
+
+void peephole(InstructionList *list) {
+
+    stats.ins_before += list->len;
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (size_t i=0; i < list->len; ++i) {
+            for (size_t r=0; r < ARRAY_LEN(rules); ++r) {
+                if (rules[r].fn(list, i)) {
+                    rules[r].hits++;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    stats.ins_after += list->len;
+}
+
+void peephole_print_stats(void) {
+    for (size_t r=0; r < ARRAY_LEN(rules); ++r)
+        printf("PEEPHOLE %-14s %d\n", rules[r].name, rules[r].hits);
+
+    printf("PEEPHOLE instructions   %lu -> %lu\n", stats.ins_before, stats.ins_after);
+}
@@ -0,0 +1,11 @@
+#ifndef _PEEPHOLE_H
+#define _PEEPHOLE_H
+
+#include "instruction.h"
+
+// rewrites redundant instruction sequences of a single procedure
+void peephole(InstructionList *list);
+// prints how often every rule has fired so far
+void peephole_print_stats(void);
+
+#endif // _PEEPHOLE_H
@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ver.h>
+
+#include "instruction.h"
+#include "regalloc.h"
+#include "main.h"
+
+// linear scan register allocation
+//
+// every variable slot and every matching push/pop pair gets a live interval,
+// spanning the indices of the first and last instruction accessing it. intervals
+// of variables are extended over every loop they overlap, as their value may flow
+// along the back edge.
+//
+// the intervals are visited in order of their start, each one gets a register
+// that is neither held by an overlapping interval, nor mentioned by any
+// instruction inside of it. the code generator uses rax, rdi and the argument
+// registers explicitly, so these are only handed out where they are unused.
+// if no register is left, the interval ending last is spilled and stays on the stack
+
+typedef enum {
+    INTERVAL_VARIABLE,  // stack slot of a variable
+    INTERVAL_TEMPORARY, // value that is pushed onto the stack, and popped again later
+} IntervalKind;
+
+typedef struct {
+    IntervalKind kind;
+    size_t start, end; // instruction indices, inclusive
+    int offset;        // variable: offset of the slot
+    Register hint;     // preferred register, REG_INVALID if none
+    Register reg;      // REG_INVALID if spilled
+} Interval;
+
+typedef struct {
+    size_t len, cap;
+    Interval *items;
+} IntervalList;
+
+// instruction index of a loop header, and of the jump back to it
+typedef struct {
+    size_t head, tail;
+} Loop;
+
+typedef struct {
+    size_t len, cap;
+    Loop *items;
+} LoopList;
+
+// caller-saved registers come first, as they don't have to be preserved
+// rax is left out, as nearly every instruction sequence of the code generator uses it
+static const Register pool[] = {
+    REG_R10,
+    REG_R11,
+    REG_R9,
+    REG_R8,
+    REG_RCX,
+    REG_RSI,
+    REG_RDX,
+    REG_RDI,
+    REG_RBX,
+    REG_R12,
+    REG_R13,
+    REG_R14,
+    REG_R15,
+    // only with -fomit-frame-pointer
+    REG_RBP,
+};
+
+static struct {
+    int vars, vars_allocated;
+    int temps, temps_allocated;
+    int saved;
+} stats = { 0 };
+
+
+
+NO_DISCARD static bool is_callee_saved(Register reg) {
+    return reg == REG_RBX || reg == REG_R12 || reg == REG_R13
+        || reg == REG_R14 || reg == REG_R15 || reg == REG_RBP;
+}
+
+NO_DISCARD static bool is_slot(const Operand *op, int offset) {
+    return op->kind == OPERAND_MEM && op->reg == REG_RBP && op->index == REG_INVALID && op->imm == -offset;
+}
+
+NO_DISCARD static bool is_jump(Opcode op) {
+    switch (op) {
+        case OP_JMP:
+        case OP_JE:
+        case OP_JNE:
+        case OP_JG:
+        case OP_JGE:
+        case OP_JL:
+        case OP_JLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void intervallist_append(IntervalList *list, Interval iv) {
+
+    if (list->len == list->cap) {
+        list->cap = list->cap == 0 ? 32 : list->cap * 2;
+        list->items = NON_NULL(realloc(list->items, list->cap * sizeof(Interval)));
+    }
+
+    list->items[list->len++] = iv;
+}
+
+static void looplist_append(LoopList *list, Loop loop) {
+
+    if (list->len == list->cap) {
+        list->cap = list->cap == 0 ? 8 : list->cap * 2;
+        list->items = NON_NULL(realloc(list->items, list->cap * sizeof(Loop)));
+    }
+
+    list->items[list->len++] = loop;
+}
+
+
+
+static void collect_variables(IntervalList *intervals, const InstructionList *list, const int *vars, size_t vars_count) {
+
+    for (size_t v=0; v < vars_count; ++v) {
+        int offset = vars[v];
+
+        bool duplicate = false;
+        for (size_t w=0; w < v; ++w)
+            duplicate |= vars[w] == offset;
+        if (duplicate) continue;
+
+        Interval iv = {
+            .kind   = INTERVAL_VARIABLE,
+            .offset = offset,
+            .hint   = REG_INVALID,
+            .reg    = REG_INVALID,
+        };
+
+        bool used = false, addr_taken = false;
+
+        for (size_t i=0; i < list->len && !addr_taken; ++i) {
+            const Instruction *ins = &list->items[i];
+            if (!is_slot(&ins->dst, offset) && !is_slot(&ins->src, offset)) continue;
+
+            addr_taken = ins->op == OP_LEA;
+            if (!used) iv.start = i;
+            iv.end = i;
+            used = true;
+        }
+
+        stats.vars += used;
+        if (used && !addr_taken)
+            intervallist_append(intervals, iv);
+    }
+
+}
+
+// the adjustments around calls and the stores of stack arguments are placed
+// below all pushed values by the code generator, no matter which pushes remain
+NO_DISCARD static bool is_call_setup(const Instruction *ins) {
+    bool adjust = (ins->op == OP_SUB || ins->op == OP_ADD)
+        && ins->dst.kind == OPERAND_REG && ins->dst.reg == REG_RSP && ins->src.kind == OPERAND_IMM;
+    bool store  = ins->op == OP_MOV && ins->dst.kind == OPERAND_MEM && ins->dst.reg == REG_RSP
+        && !operand_mentions(&ins->src, REG_RSP);
+
+    return adjust || store;
+}
+
+// the value must not be read through rsp while it is on the stack
+NO_DISCARD static bool stack_independent(const InstructionList *list, size_t start, size_t end) {
+    for (size_t i=start+1; i < end; ++i) {
+        const Instruction *ins = &list->items[i];
+
+        if (ins->op == OP_PUSH || ins->op == OP_POP || ins->op == OP_CALL || is_call_setup(ins))
+            continue;
+        if (instruction_mentions(ins, REG_RSP))
+            return false;
+    }
+
+    return true;
+}
+
+static void collect_temporaries(IntervalList *intervals, const InstructionList *list) {
+
+    // indices of pushes that have not been popped yet
+    size_t *pushes = NON_NULL(malloc((list->len + 1) * sizeof(size_t)));
+    size_t depth = 0;
+
+    for (size_t i=0; i < list->len; ++i) {
+        const Instruction *ins = &list->items[i];
+
+        if (ins->op == OP_PUSH) {
+            pushes[depth++] = i;
+            continue;
+        }
+
+        if (ins->op != OP_POP || depth == 0) continue;
+
+        size_t start = pushes[--depth];
+        const Instruction *push = &list->items[start];
+
+        if (push->dst.kind != OPERAND_REG || ins->dst.kind != OPERAND_REG) continue;
+        if (!stack_independent(list, start, i)) continue;
+
+        stats.temps++;
+        intervallist_append(intervals, (Interval) {
+            .kind  = INTERVAL_TEMPORARY,
+            .start = start,
+            .end   = i,
+            // popping straight into the target register saves a move
+            .hint  = ins->dst.reg,
+            .reg   = REG_INVALID,
+        });
+    }
+
+    free(pushes);
+}
+
+// every jump to a label defined before it closes a loop
+static void collect_loops(LoopList *loops, const InstructionList *list) {
+
+    for (size_t i=0; i < list->len; ++i) {
+        const Instruction *jmp = &list->items[i];
+        if (!is_jump(jmp->op) || jmp->dst.kind != OPERAND_LABEL) continue;
+
+        for (size_t j=i; j-- > 0;) {
+            const Instruction *lbl = &list->items[j];
+
+            if (lbl->op == OP_LABEL && lbl->dst.label == jmp->dst.label && lbl->dst.id == jmp->dst.id) {
+                looplist_append(loops, (Loop) { .head = j, .tail = i });
+                break;
+            }
+        }
+    }
+
+}
+
+static void extend_over_loops(IntervalList *intervals, const LoopList *loops) {
+
+    for (size_t i=0; i < intervals->len; ++i) {
+        Interval *iv = &intervals->items[i];
+
+        // temporaries never outlive the expression they belong to
+        if (iv->kind != INTERVAL_VARIABLE) continue;
+
+        // extending over one loop may make the interval overlap an enclosing one
+        bool changed = true;
+        while (changed) {
+            changed = false;
+
+            for (size_t l=0; l < loops->len; ++l) {
+                const Loop *loop = &loops->items[l];
+
+                if (iv->start > loop->tail || iv->end < loop->head) continue;
+                if (iv->start <= loop->head && iv->end >= loop->tail) continue;
+
+                if (iv->start > loop->head) iv->start = loop->head;
+                if (iv->end < loop->tail)   iv->end   = loop->tail;
+                changed = true;
+            }
+        }
+    }
+
+}
+
+
+
+// counts[i * REG_COUNT + reg] is the number of instructions before index i, that mention reg
+NO_DISCARD static unsigned *count_mentions(const InstructionList *list) {
+    unsigned *counts = NON_NULL(calloc((list->len + 1) * REG_COUNT, sizeof(unsigned)));
+
+    for (size_t i=0; i < list->len; ++i) {
+        for (int reg=0; reg < REG_COUNT; ++reg) {
+            // without a frame pointer, the slots are addressed through rsp in
+            // the end, so their rbp base does not occupy the register
+            bool mentioned = reg == REG_RBP && compiler_ctx.omit_frame_pointer
+                ? false
+                : instruction_mentions(&list->items[i], reg);
+            counts[(i+1) * REG_COUNT + reg] = counts[i * REG_COUNT + reg] + mentioned;
+        }
+    }
+
+    return counts;
+}
+
+// whether reg can hold the value of the interval
+NO_DISCARD static bool is_usable(const Interval *iv, Register reg, const unsigned *counts) {
+
+    // the push and pop of a temporary are replaced by moves from and to the
+    // register, so only the instructions in between have to leave it alone
+    size_t from = iv->kind == INTERVAL_TEMPORARY ? iv->start + 1 : iv->start;
+    size_t to   = iv->kind == INTERVAL_TEMPORARY ? iv->end       : iv->end + 1;
+
+    return counts[to * REG_COUNT + reg] == counts[from * REG_COUNT + reg];
+}
+
+NO_DISCARD static Register pick_register(const Interval *iv, RegisterSet taken, const unsigned *counts) {
+
+    if (iv->hint != REG_INVALID && !(taken & (1u << iv->hint)) && is_usable(iv, iv->hint, counts))
+        return iv->hint;
+
+    for (size_t i=0; i < ARRAY_LEN(pool); ++i) {
+        Register reg = pool[i];
+        if (reg == REG_RBP && !compiler_ctx.omit_frame_pointer) continue;
+        if (!(taken & (1u << reg)) && is_usable(iv, reg, counts))
+            return reg;
+    }
+
+    return REG_INVALID;
+}
+
+static int compare_start(const void *a, const void *b) {
+    const Interval *x = a, *y = b;
+    if (x->start != y->start) return x->start < y->start ? -1 : 1;
+    return x->end < y->end ? -1 : x->end > y->end;
+}
+
+static void linear_scan(IntervalList *intervals, const unsigned *counts) {
+
+    if (intervals->len == 0) return;
+    qsort(intervals->items, intervals->len, sizeof(Interval), compare_start);
+
+    // every active interval holds a distinct register
+    Interval *active[ARRAY_LEN(pool)];
+    size_t active_len = 0;
+
+    for (size_t i=0; i < intervals->len; ++i) {
+        Interval *cur = &intervals->items[i];
+
+        // expire intervals that have ended
+        RegisterSet taken = 0;
+        size_t kept = 0;
+
+        for (size_t a=0; a < active_len; ++a) {
+            if (active[a]->end < cur->start) continue;
+            active[kept++] = active[a];
+            taken |= 1u << active[a]->reg;
+        }
+
+        active_len = kept;
+
+        cur->reg = pick_register(cur, taken, counts);
+
+        if (cur->reg != REG_INVALID) {
+            assert(active_len < ARRAY_LEN(pool));
+            active[active_len++] = cur;
+            continue;
+        }
+
+        // under pressure, the interval that is live the longest gives up its register
+        size_t victim = active_len;
+
+        for (size_t a=0; a < active_len; ++a) {
+            if (!is_usable(cur, active[a]->reg, counts)) continue;
+            if (victim == active_len || active[a]->end > active[victim]->end)
+                victim = a;
+        }
+
+        if (victim == active_len || active[victim]->end <= cur->end) continue;
+
+        cur->reg = active[victim]->reg;
+        active[victim]->reg = REG_INVALID;
+        active[victim] = cur;
+    }
+
+}
+
+
+
+static void rewrite(InstructionList *list, const IntervalList *intervals) {
+
+    bool *removed = NON_NULL(calloc(list->len + 1, sizeof(bool)));
+
+    for (size_t i=0; i < intervals->len; ++i) {
+        const Interval *iv = &intervals->items[i];
+        if (iv->reg == REG_INVALID) continue;
+
+        if (iv->kind == INTERVAL_VARIABLE) {
+            for (size_t j=iv->start; j <= iv->end; ++j) {
+                Instruction *ins = &list->items[j];
+
+                if (is_slot(&ins->dst, iv->offset)) ins->dst = operand_reg(iv->reg, ins->dst.size);
+                if (is_slot(&ins->src, iv->offset)) ins->src = operand_reg(iv->reg, ins->src.size);
+            }
+
+            continue;
+        }
+
+        Instruction *push = &list->items[iv->start];
+        Instruction *pop  = &list->items[iv->end];
+        Operand reg = operand_reg(iv->reg, 8);
+
+        if (push->dst.reg == iv->reg)
+            removed[iv->start] = true;
+        else
+            *push = (Instruction) { .op = OP_MOV, .dst = reg, .src = push->dst };
+
+        if (pop->dst.reg == iv->reg)
+            removed[iv->end] = true;
+        else
+            *pop = (Instruction) { .op = OP_MOV, .dst = pop->dst, .src = reg };
+    }
+
+    size_t len = 0;
+    for (size_t i=0; i < list->len; ++i) {
+        if (!removed[i])
+            list->items[len++] = list->items[i];
+    }
+
+    list->len = len;
+    free(removed);
+}
+
+RegisterSet regalloc(InstructionList *list, const int *vars, size_t vars_count) {
+
+    IntervalList intervals = { 0 };
+    LoopList loops = { 0 };
+
+    collect_variables(&intervals, list, vars, vars_count);
+    collect_temporaries(&intervals, list);
+    collect_loops(&loops, list);
+    extend_over_loops(&intervals, &loops);
+
+    unsigned *counts = count_mentions(list);
+    linear_scan(&intervals, counts);
+    rewrite(list, &intervals);
+
+    RegisterSet saved = 0;
+
+    for (size_t i=0; i < intervals.len; ++i) {
+        const Interval *iv = &intervals.items[i];
+        if (iv->reg == REG_INVALID) continue;
+
+        if (iv->kind == INTERVAL_VARIABLE)
+            stats.vars_allocated++;
+        else
+            stats.temps_allocated++;
+
+        if (is_callee_saved(iv->reg))
+            saved |= 1u << iv->reg;
+    }
+
+    stats.saved += __builtin_popcount(saved);
+
+    free(counts);
+    free(loops.items);
+    free(intervals.items);
+
+    return saved;
+}
+
+void regalloc_print_stats(void) {
+    printf("REGALLOC variables      %d / %d\n", stats.vars_allocated, stats.vars);
+    printf("REGALLOC temporaries    %d / %d\n", stats.temps_allocated, stats.temps);
+    printf("REGALLOC callee-saved   %d\n", stats.saved);
+}
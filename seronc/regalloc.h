@@ -0,0 +1,16 @@
+#ifndef _REGALLOC_H
+#define _REGALLOC_H
+
+#include <stddef.h>
+
+#include "instruction.h"
+
+// keeps variables and temporaries of a single procedure in registers
+// `vars` are the stack offsets of all variables and parameters of the procedure,
+// variables whose address is taken are left on the stack
+// returns the callee-saved registers that have been used, which the caller has to preserve
+RegisterSet regalloc(InstructionList *list, const int *vars, size_t vars_count);
+// prints how many values have been kept in registers so far
+void regalloc_print_stats(void);
+
+#endif // _REGALLOC_H
@@ -1,59 +1,106 @@
 #include "symboltable.h"
 #include "diagnostics.h"
 
+#define SYMBOLTABLE_SIZE 512
+
 void symboltable_init(Symboltable *st, Arena *arena) {
     *st = (Symboltable) {
-        .head  = NULL,
-        .arena = arena,
+        .undo   = NULL,
+        .scopes = NULL,
+        .arena  = arena,
     };
-}
 
-NO_DISCARD Symbol *symboltable_lookup(const Hashtable *scope, const char *key) {
+    hashtable_init(&st->names, SYMBOLTABLE_SIZE, arena);
+}
 
-    NON_NULL(scope);
+void symboltable_destroy(Symboltable *st) {
+    free(st->undo);
+    free(st->scopes);
+    free(st->slots);
+    free(st->blocks);
+    st->undo   = NULL;
+    st->scopes = NULL;
+    st->slots  = NULL;
+    st->blocks = NULL;
+}
 
-    while (scope != NULL) {
-        Symbol *sym = hashtable_get(scope, key);
-        if (sym != NULL) return sym;
-        scope = scope->parent;
-    }
+NO_DISCARD Symbol *symboltable_lookup(const Symboltable *st, const char *key) {
 
-    return NULL;
+    HashtableEntry *entry = hashtable_get(&st->names, key);
+    return entry == NULL ? NULL : entry->value;
 }
 
-// returns the newly allocated hashtable
-NO_DISCARD Hashtable *symboltable_push(Symboltable *st) {
+void symboltable_push(Symboltable *st) {
 
-    Hashtable *ht = NON_NULL(arena_alloc(st->arena, sizeof(Hashtable)));
-    hashtable_init(ht, 50, st->arena); // TODO: get rid of magic
-    ht->parent = st->head;
-    st->head = ht;
+    if (st->scopes_len == st->scopes_cap) {
+        st->scopes_cap = st->scopes_cap == 0 ? 16 : st->scopes_cap * 2;
+        st->scopes = NON_NULL(realloc(st->scopes, st->scopes_cap * sizeof(size_t)));
+    }
 
-    return ht;
+    st->scopes[st->scopes_len++] = st->undo_len;
 }
 
 void symboltable_pop(Symboltable *st) {
-    st->head = st->head->parent;
+    assert(st->scopes_len > 0);
+    size_t start = st->scopes[--st->scopes_len];
+
+    // unbind in reverse order, so names bound twice in one scope are restored correctly
+    while (st->undo_len > start) {
+        HashtableEntry *entry = st->undo[--st->undo_len];
+        entry->value = entry->value->shadowed;
+    }
 }
 
+Symbol *symboltable_insert(Symboltable *st, const char *key, Symbol sym) {
+    assert(st->scopes_len > 0);
+
+    HashtableEntry *entry = hashtable_intern(&st->names, key);
 
+    Symbol *new = NON_NULL(arena_alloc(st->arena, sizeof(Symbol)));
+    *new = sym;
+    new->shadowed = entry->value;
+    entry->value = new;
 
-static void block_pre(AstNode *node, UNUSED int _depth, void *args) {
+    if (st->undo_len == st->undo_cap) {
+        st->undo_cap = st->undo_cap == 0 ? 64 : st->undo_cap * 2;
+        st->undo = NON_NULL(realloc(st->undo, st->undo_cap * sizeof(HashtableEntry*)));
+    }
+
+    st->undo[st->undo_len++] = entry;
+    return new;
+}
+
+
+
+// blocks of a procedure form a tree, whose root is the scope of the parameters
+static void frame_block(Symboltable *st, size_t parent) {
+
+    if (st->blocks_len == st->blocks_cap) {
+        st->blocks_cap = st->blocks_cap == 0 ? 16 : st->blocks_cap * 2;
+        st->blocks = NON_NULL(realloc(st->blocks, st->blocks_cap * sizeof(size_t)));
+    }
+
+    st->block = st->blocks_len;
+    st->blocks[st->blocks_len++] = parent;
+}
+
+static void block_pre(UNUSED AstNode *_node, UNUSED int _depth, void *args) {
     Symboltable *st = args;
-    Block *block = &node->block;
-    block->symboltable = symboltable_push(st);
+    symboltable_push(st);
+    frame_block(st, st->block);
 }
 
 static void block_post(UNUSED AstNode *_node, UNUSED int _depth, void *args) {
     Symboltable *st = args;
     symboltable_pop(st);
+    st->block = st->blocks[st->block];
 }
 
-static int type_complex_size(const Type *type, const Hashtable *ht) {
+static int type_complex_size(const Type *type, const Symboltable *st) {
     int size = 0;
 
     if (type->kind == TYPE_OBJECT) {
-        Symbol *sym = NON_NULL(symboltable_lookup(ht, type->object_name));
+        Symbol *sym = NON_NULL(symboltable_lookup(st, type->object_name));
         Table *table = sym->type.table;
 
         for (size_t i=0; i < table->field_count; ++i)
@@ -66,14 +113,104 @@ static int type_complex_size(const Type *type, const Hashtable *ht) {
     return size;
 }
 
+static void frame_slot(Symboltable *st, FrameSlot slot) {
+
+    if (st->slots_len == st->slots_cap) {
+        st->slots_cap = st->slots_cap == 0 ? 16 : st->slots_cap * 2;
+        st->slots = NON_NULL(realloc(st->slots, st->slots_cap * sizeof(FrameSlot)));
+    }
+
+    slot.index = st->slots_len;
+    st->slots[st->slots_len++] = slot;
+}
+
+static int compare_slots(const void *a, const void *b) {
+    const FrameSlot *x = a, *y = b;
+    if (x->align != y->align) return x->align > y->align ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+NO_DISCARD static inline int align_up(int value, int align) {
+    return (value + align - 1) / align * align;
+}
+
+// whether the slots of both blocks can be live at the same time, which is
+// the case if one of them is nested in the other
+NO_DISCARD static bool blocks_overlap(const Symboltable *st, size_t a, size_t b) {
+    if (a > b) { size_t tmp = a; a = b; b = tmp; }
+
+    // blocks are numbered in the order they are opened, so `b` can only be nested in `a`
+    while (b > a)
+        b = st->blocks[b];
+
+    return a == b;
+}
+
+// packs the slots by natural alignment, largest alignment first, so no
+// padding is needed in between. rbp is 16 byte aligned, so a slot is aligned
+// if its offset is. every slot takes the lowest offset that is not used by a
+// slot live at the same time, so sibling blocks share their slots.
+// returns the size of the frame, which only has to hold the slots that are live at once
+static int layout_frame(Symboltable *st) {
+
+    qsort(st->slots, st->slots_len, sizeof(FrameSlot), compare_slots);
+    int *tops = NON_NULL(calloc(st->slots_len + 1, sizeof(int)));
+    int size = 0;
+
+    for (size_t i=0; i < st->slots_len; ++i) {
+        const FrameSlot *slot = &st->slots[i];
+        int top = align_up(slot->size, slot->align);
+
+        // the slot occupies the offsets (top - size, top], moving it below
+        // one slot may make it collide with another one
+        bool moved = true;
+        while (moved) {
+            moved = false;
+
+            for (size_t j=0; j < i; ++j) {
+                const FrameSlot *other = &st->slots[j];
+
+                if (!blocks_overlap(st, slot->scope, other->scope)) continue;
+                if (top - slot->size >= tops[j] || tops[j] - other->size >= top) continue;
+
+                top = align_up(tops[j] + slot->size, slot->align);
+                moved = true;
+            }
+        }
+
+        tops[i] = top;
+
+        *slot->offset = top - slot->bias;
+        if (slot->sym_offset != NULL)
+            *slot->sym_offset = top;
+        if (top > size)
+            size = top;
+    }
+
+    free(tops);
+    st->slots_len  = 0;
+    st->blocks_len = 0;
+
+    // callee-saved registers are preserved right below the slots
+    return (size + 7) & ~7;
+}
+
 static void array_pre(AstNode *node, UNUSED int _depth, void *args) {
     Symboltable *st = args;
     ExprArray *array = &node->expr_array;
 
+    // elements are addressed upwards from the start of the array
     int elem_size = type_primitive_size(array->type.kind);
-    align_16(&elem_size);
-    array->offset = st->stack_size + elem_size;
-    st->stack_size += elem_size * array->values.size + elem_size;
+    int size = elem_size * array->values.size;
+
+    // a pointer to the array may outlive the block, so it is never shared
+    frame_slot(st, (FrameSlot) {
+        .size   = size,
+        .align  = elem_size,
+        .offset = &array->offset,
+        .bias   = size,
+        .scope  = 0,
+    });
 
 }
 
@@ -82,34 +219,58 @@ static void vardecl(AstNode *node, UNUSED int _depth, void *args) {
     StmtVarDecl *vardecl = &node->stmt_vardecl;
 
     int size = type_primitive_size(vardecl->type.kind);
-    align_16(&size);
-    st->stack_size += size;
-
-    vardecl->offset = st->stack_size;
 
     Symbol sym = {
         .kind   = SYMBOL_VARIABLE,
         .type   = vardecl->type,
-        .offset = st->stack_size,
     };
 
     // shadowing is a feature, not a bug
-    hashtable_insert(st->head, vardecl->ident.value, sym);
+    // bound after the initializer has been visited, so it may refer to an outer `ident`
+    vardecl->sym = symboltable_insert(st, vardecl->ident.value, sym);
+
+    frame_slot(st, (FrameSlot) {
+        .size       = size,
+        .align      = size,
+        .offset     = &vardecl->offset,
+        .sym_offset = &vardecl->sym->offset,
+        .scope      = st->block,
+    });
 }
 
 static void proc_pre(AstNode *node, UNUSED int _depth, void *args) {
     Symboltable *st = args;
     DeclProc *proc = &node->stmt_proc;
 
-    Symbol sym = {
-        .kind = SYMBOL_PROCEDURE,
-        .type = proc->type,
-    };
+    if (proc->body == NULL) return;
+
+    st->slots_len  = 0;
+    st->blocks_len = 0;
+
+    // parameters live in their own scope surrounding the body
+    symboltable_push(st);
+    frame_block(st, 0);
+
+    ProcSignature *sig = proc->type.signature;
 
-    hashtable_insert(st->head, proc->ident.value, sym);
+    for (size_t i=0; i < sig->params_count; ++i) {
+        Param *param = &sig->params[i];
+        int size = type_primitive_size(param->type.kind);
 
-    if (proc->body != NULL) {
-        st->stack_size = 0;
+        Symbol sym = {
+            .kind   = SYMBOL_PARAMETER,
+            .type   = param->type,
+        };
+
+        Symbol *bound = symboltable_insert(st, param->ident, sym);
+
+        frame_slot(st, (FrameSlot) {
+            .size       = size,
+            .align      = size,
+            .offset     = &param->offset,
+            .sym_offset = &bound->offset,
+            .scope      = 0,
+        });
     }
 
 }
@@ -121,40 +282,65 @@ static void proc_post(AstNode *node, UNUSED int _depth, void *args) {
 
     if (proc->body == NULL) return;
 
-    assert(proc->body->kind == ASTNODE_BLOCK);
-    proc->symboltable = proc->body->block.symboltable;
+    symboltable_pop(st);
 
-    ProcSignature *sig = proc->type.signature;
+    // offsets are only known once every slot of the procedure has been seen
+    proc->stack_size = layout_frame(st);
 
-    for (size_t i=0; i < sig->params_count; ++i) {
-        Param *param = &sig->params[i];
+}
 
-        st->stack_size += type_primitive_size(param->type.kind);
-        param->offset = st->stack_size;
+static void literal(AstNode *node, UNUSED int _depth, void *args) {
+    Symboltable *st = args;
+    ExprLiteral *literal = &node->expr_literal;
 
-        Symbol sym = {
-            .kind   = SYMBOL_PARAMETER,
-            .type   = param->type,
-            .offset = st->stack_size,
-        };
+    if (literal->kind != LITERAL_IDENT) return;
+
+    const char *ident = literal->op.value;
+    Symbol *sym = symboltable_lookup(st, ident);
 
-        hashtable_insert(proc->symboltable, param->ident, sym);
+    if (sym == NULL) {
+        diagnostic_loc(DIAG_ERROR, &literal->op, "Symbol `%s` does not exist in the current scope", ident);
+        st->errcount++;
+        return;
     }
 
-    proc->stack_size = st->stack_size;
+    if (sym->kind == SYMBOL_TABLE) {
+        diagnostic_loc(DIAG_ERROR, &literal->op, "Symbol `%s` is a type, not a variable", ident);
+        st->errcount++;
+        return;
+    }
 
+    literal->sym = sym;
 }
 
-static void table_pre(AstNode *node, UNUSED int _depth, void *args) {
-    Symboltable *st = args;
-    DeclTable *table = &node->table;
-
-    Symbol sym = {
-        .kind = SYMBOL_TABLE,
-        .type = table->type,
-    };
-
-    hashtable_insert(st->head, table->ident.value, sym);
+// procedures and tables may be referred to before they are declared
+static void declare_globals(Symboltable *st, const AstNode *root) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    const AstNodeList *list = &root->block.stmts;
+    for (size_t i=0; i < list->size; ++i) {
+        const AstNode *node = list->items[i];
+
+        switch (node->kind) {
+            case ASTNODE_PROC: {
+                Symbol sym = {
+                    .kind = SYMBOL_PROCEDURE,
+                    .type = node->stmt_proc.type,
+                };
+                symboltable_insert(st, node->stmt_proc.ident.value, sym);
+            } break;
+
+            case ASTNODE_TABLE: {
+                Symbol sym = {
+                    .kind = SYMBOL_TABLE,
+                    .type = node->table.type,
+                };
+                symboltable_insert(st, node->table.ident.value, sym);
+            } break;
+
+            default: NOP() break;
+        }
+    }
 }
 
 void symboltable_build(AstNode *root, Arena *arena) {
@@ -162,13 +348,31 @@ void symboltable_build(AstNode *root, Arena *arena) {
     Symboltable st = { 0 };
     symboltable_init(&st, arena);
 
+    symboltable_push(&st);
+    declare_globals(&st, root);
+
     AstDispatchEntry table[] = {
         { ASTNODE_BLOCK,   block_pre, block_post },
-        { ASTNODE_VARDECL, vardecl,   NULL       },
+        { ASTNODE_VARDECL, NULL,      vardecl    },
         { ASTNODE_PROC,    proc_pre,  proc_post  },
-        { ASTNODE_TABLE,   table_pre, NULL       },
         { ASTNODE_ARRAY,   array_pre, NULL       },
+        { ASTNODE_LITERAL, literal,   NULL       },
     };
 
     parser_dispatch_ast(root, table, ARRAY_LEN(table), &st);
+
+    symboltable_pop(&st);
+    symboltable_destroy(&st);
+
+    if (st.errcount) {
+        diagnostic(DIAG_ERROR, "Name resolution failed with %d errors", st.errcount);
+        exit(EXIT_FAILURE);
+    }
+
+}
+
+int symboltable_new_slot(DeclProc *proc, int size) {
+    int offset = align_up(proc->stack_size + size, size);
+    proc->stack_size = (offset + 7) & ~7;
+    return offset;
 }
@@ -9,20 +9,49 @@
 
 
 
-// symboltable is a linked list of hashtables
+// stack slot of a local, parameter or array literal of the procedure being laid out
 typedef struct {
-    Hashtable *head;
+    int size, align;
+    int *offset;     // written once the frame is laid out
+    int *sym_offset; // offset of the symbol bound to the slot, NULL if none
+    int bias;        // subtracted from the offset, array literals are addressed from their top
+    size_t scope;    // block the slot is live in
+    size_t index;    // declaration order, to keep the layout deterministic
+} FrameSlot;
+
+// symboltable is a single hashtable mapping every name to a stack of bindings
+// names bound by a scope are recorded in an undo log, which is replayed when
+// the scope is popped, so lookups cost one probe no matter how deep the nesting is
+typedef struct {
+    Hashtable names;
+    HashtableEntry **undo; // names bound by all open scopes, innermost last
+    size_t undo_len, undo_cap;
+    size_t *scopes;        // start of every open scope in the undo log
+    size_t scopes_len, scopes_cap;
     Arena *arena;
-    int stack_size;
+    FrameSlot *slots;      // slots of the current procedure
+    size_t slots_len, slots_cap;
+    size_t *blocks;        // enclosing block of every block of the current procedure
+    size_t blocks_len, blocks_cap;
+    size_t block;          // innermost open block, 0 is the parameter scope
+    int errcount;
 } Symboltable;
 
 void symboltable_init(Symboltable *st, Arena *arena);
-// returns the newly allocated hashtable
-Hashtable *symboltable_push(Symboltable *st);
+void symboltable_destroy(Symboltable *st);
+void symboltable_push(Symboltable *st);
 void symboltable_pop(Symboltable *st);
+// binds key in the current scope, shadowing outer bindings of the same name
+// returns the newly allocated symbol
+Symbol *symboltable_insert(Symboltable *st, const char *key, Symbol sym);
 // returns NULL if key was not found
-NO_DISCARD Symbol *symboltable_lookup(const Hashtable *scope, const char *key);
+NO_DISCARD Symbol *symboltable_lookup(const Symboltable *st, const char *key);
+// assigns stack offsets and binds every identifier literal to its symbol
+// all unresolved identifiers are reported at once, before exiting
 void symboltable_build(AstNode *root, Arena *arena);
+// adds a slot of `size` bytes, aligned to its size, below every other slot of the
+// frame of a procedure that has already been laid out, and returns its offset
+NO_DISCARD int symboltable_new_slot(DeclProc *proc, int size);
 
 
 
@@ -34,9 +34,18 @@ bool test_log_or(bool, bool);
 bool test_log_and(bool, bool);
 
 int test_add_many(int, int, int, int, int, int, int, int, int);
+int test_call_many(int);
+int test_call_nested(int, int);
+int test_call_swap(int, int);
+int test_aligned_calls(int);
+int rsp_aligned(void) { return (uintptr_t) __builtin_frame_address(0) % 16 == 0; }
 
 int test_index(int*, size_t);
 int test_index_reverse(int*, size_t);
+int test_index_sum(int*, int);
+void test_index_shift(long*, int);
+signed char test_index_char(signed char*, int);
+int test_index_negative(int*, int);
 int test_deref(int*);
 int *test_deref_double(int**);
 void test_deref_write(int*, int);
@@ -52,6 +61,106 @@ static int fptr(void) { return 45; }
 int test_fptr_args(int(*)(int, int), int, int);
 static int fptr_add(int a, int b) { return a + b; }
 
+int test_short_circuit(int*);
+int test_or_chain(int, int, int);
+int test_cmp_value(int, int);
+
+int test_fold_arith(void);
+signed char test_fold_wrap_char(void);
+int test_fold_wrap_int(void);
+int test_fold_propagate(int);
+int test_fold_branches(int);
+int test_fold_written(int);
+
+int test_mul_const(int);
+long test_mul_const_long(long);
+int test_div_const(int);
+long test_div_const_long(long);
+signed char test_div_const_char(signed char);
+
+int test_pressure(int);
+int test_across_calls(int, int);
+int test_addr_local(int);
+int test_frame_layout(int);
+int test_frame_sharing(int);
+
+int test_inline(int, int);
+int test_inline_recursive(int);
+int test_inline_order(int);
+
+int test_tail_sum(int, int);
+int test_tail_gcd(int, int);
+int test_tail_rotate(int, int, int, int, int, int, int, int);
+int test_tail_order(int, int);
+int test_tail_sibling(int);
+
+int test_loop_nested(int, int, int);
+int test_loop_written(int, int);
+void test_loop_pointer(int*, int);
+
+int test_unroll_hint(int*, int);
+int test_unroll_full(int);
+long test_unroll_sum(long*, int);
+int test_unroll_down(int, int);
+int test_unroll_bound(int);
+int test_unroll_bound_call(int);
+void unroll_set(int *p, int value) { *p = value; }
+
+void test_vec_add(int*, int*, int*, int, int);
+void test_vec_fill(signed char*, int, signed char);
+void test_vec_cmp(int*, int*, int, int);
+int test_vec_and(int*, int);
+signed char test_vec_sub(signed char*, int);
+
+int test_dce_return(int);
+int test_dce_store(int*, int);
+int bump(int *counter) { return ++*counter; }
+
+int test_ssa_swap(int, int, int);
+int test_ssa_addr(int, int);
+int test_ssa_logical(int, int);
+int ssa_order(int a, int b, int c) { return a * 1000000 + b * 1000 + c; }
+int test_ssa_call_addr(int);
+int test_ssa_call_assign(int);
+int test_cse_args(int, int);
+int test_cse_load(int*, int, int*);
+int test_cse_kill(int, int, int);
+
+static int loop_nested(int rows, int cols, int k) {
+    int sum = 0;
+    for (int i=0; i < rows; ++i)
+        for (int j=0; j < cols; ++j)
+            sum += i * 100 + j * 3 + k * k;
+    return sum;
+}
+
+static int loop_written(int n, int a) {
+    int sum = 0;
+    for (int i=0; i < n; ++i, ++a) {
+        sum += a * 2 + i * 4;
+        if (sum > 100) ++i;
+    }
+    return sum;
+}
+
+static int unroll_down(int n, int stop) {
+    int sum = 0;
+    for (int i=n; i >= stop; i -= 2)
+        sum = (int) ((unsigned) sum * 3 + (unsigned) i);
+    return sum;
+}
+
+static bool vec_add(int *dst, int *a, int *b, int n, int k) {
+    int expected[64];
+    for (int i=0; i < n; ++i)
+        expected[i] = dst == a + 1 ? (i == 0 ? a[0] : expected[i-1]) + b[i] - k : a[i] + b[i] - k;
+
+    test_vec_add(dst, a, b, n, k);
+    for (int i=0; i < n; ++i)
+        if (dst[i] != expected[i]) return false;
+    return true;
+}
+
 
 
 int main(void) {
@@ -63,6 +172,10 @@ int main(void) {
     test(test_div(10, 2), 5);
 
     test(test_add_many(1, 2, 3, 4, 5, 6, 7, 8, 9), 45);
+    test(test_call_many(10), 10 - 11 - 2 - 13 - 40 - 5 - 4 - 17);
+    test(test_call_nested(3, 4), 7 - ((4 - 6) + 7));
+    test(test_call_swap(3, 4), 1);
+    test(test_aligned_calls(2), 1 + 2 + 1 + 37);
 
     test(test_id(1), 1);
 
@@ -118,6 +231,18 @@ int main(void) {
     test(test_index_reverse(xs, 1), 2);
     test(test_index_reverse(xs, 2), 3);
 
+    int ys[] = { 10, -20, 30, 40, 50, 60 };
+    test(test_index_sum(ys, 6), 170);
+    test(test_index_negative(ys, -4), 10 + 40);
+    test(test_index_negative(ys, 1), 60 + 40);
+
+    long ls[] = { 1, 2, 3, 4 };
+    test_index_shift(ls, 4);
+    test(ls[0] == 1 && ls[1] == 1 && ls[2] == 2 && ls[3] == 3, true);
+
+    signed char cs[] = { 1, 2, 3, 4 };
+    test(test_index_char(cs, 1), 2 + 3 + 3);
+
     int a = 45;
     test(test_deref(&a), a);
 
@@ -137,6 +262,133 @@ int main(void) {
     test(test_fptr(fptr), 45);
     test(test_fptr_args(fptr_add, 1, 2), 3);
 
+    int c = 5;
+    test(test_short_circuit(NULL), 0);
+    test(test_short_circuit(&c), 1);
+    test(test_or_chain(5, 3, 9), 2);
+    test(test_or_chain(1, 3, 0), 10);
+    test(test_cmp_value(1000, 2000), 1);
+    test(test_cmp_value(2000, 1000), 1);
+    test(test_cmp_value(1000, 1000), 1);
+
+    test(test_fold_arith(), 9);
+    test(test_fold_wrap_char(), -128);
+    test(test_fold_wrap_int(), -2147483647 - 1);
+    test(test_fold_propagate(1), 43);
+    test(test_fold_branches(4), 8);
+    test(test_fold_written(5), 8);
+
+    int values[] = { 0, 1, -1, 7, -7, 100, -1001, 123456, -2147483647, 2147483647 };
+    for (size_t i=0; i < sizeof(values) / sizeof(*values); ++i) {
+        int x = values[i];
+        long l = x * 3L;
+        signed char c = (signed char) x;
+        test(test_mul_const(x), (int) ((unsigned) x * (3 + 8 + 7 + 36 - 5 + 1000 + 17)));
+        test(test_mul_const_long(l) == (long) ((unsigned long) l * 24 - (unsigned long) l * 4294967296), true);
+        test(test_div_const(x), x / 7 + x / -10 + x / 8 + x / -4 + x / 641 + x);
+        test(test_div_const_long(l) == l / 1000L + l / 2L, true);
+        test(test_div_const_char(c), c / 3);
+    }
+
+    test(test_pressure(1), 16 + 136);
+    test(test_across_calls(3, 4), 7 - 12 + 3);
+    test(test_addr_local(41), 42);
+    test(test_frame_layout(4), 5 + 21);
+    test(test_frame_sharing(5), 10 + 5 + 10);
+
+    test(test_inline(4, 2), 4 + 6 + 8 + 100);
+    test(test_inline(-3, -9), 0 - 10 + 0 + 100);
+    test(test_inline(42, 4), 10 + 10 + 20 + 100);
+    test(test_inline_recursive(10), 55);
+    test(test_inline_order(100), 101100);
+
+    test(test_tail_sum(50000, 0), 1250025000);
+    test(test_tail_gcd(1071, 462), 21);
+    test(test_tail_rotate(3, 1, 2, 3, 4, 5, 6, 7), 4567123);
+    test(test_tail_order(3, 100), 1);
+    test(test_tail_sibling(10), 56);
+
+    test(test_loop_nested(4, 5, 3), loop_nested(4, 5, 3));
+    test(test_loop_nested(0, 5, 3), 0);
+    test(test_loop_written(20, 3), loop_written(20, 3));
+
+    int zs[] = { 1, 1, 1, 1, 1 };
+    test_loop_pointer(zs, 5);
+    test(zs[0] == 1 && zs[1] == 6 && zs[2] == 11 && zs[3] == 16 && zs[4] == 21, true);
+
+    int us[] = { 3, 1, 4, 1, 5, 9, 2 };
+    test(test_unroll_hint(us, 7), 3 + 2 + 12 + 4 + 25 + 54 + 14);
+    test(test_unroll_hint(us, 6), 3 + 2 + 12 + 4 + 25 + 54);
+    test(test_unroll_hint(us, 2), 3 + 2);
+    test(test_unroll_hint(us, 0), 0);
+    test(test_unroll_full(5), 5 * 6 + 14);
+
+    long vs[] = { 1, 20, 300, 4000, 50000, 600000, 7000000, 80000000, 900000000 };
+    test(test_unroll_sum(vs, 9) == 987654321, true);
+    test(test_unroll_sum(vs, 3) == 321, true);
+    test(test_unroll_sum(vs, -1) == 0, true);
+    test(test_unroll_down(15, 0), unroll_down(15, 0));
+    test(test_unroll_down(4, 3), unroll_down(4, 3));
+    test(test_unroll_down(-2147483640, -2147483645), unroll_down(-2147483640, -2147483645));
+    test(test_unroll_bound(10), 3);
+    test(test_unroll_bound_call(10), 2);
+
+    int as[36], bs[36], ds[36];
+    for (int i=0; i < 36; ++i) {
+        as[i] = i * 7 - 50;
+        bs[i] = 1000 - i * i;
+    }
+    test(vec_add(ds, as, bs, 35, 3), true);
+    test(vec_add(ds, as, bs, 3, -3), true);
+    test(vec_add(ds, as, bs, 0, 0), true);
+    test(vec_add(as + 1, as, bs, 17, 1), true);
+    test(vec_add(bs, as, bs, 35, 2), true);
+
+    signed char fs[40] = { 0 };
+    test_vec_fill(fs, 34, -5);
+    test(fs[0] == -5 && fs[15] == -5 && fs[16] == -5 && fs[34] == -5 && fs[35] == 0, true);
+    test_vec_fill(fs, 2, 9);
+    test(fs[0] == 9 && fs[2] == 9 && fs[3] == -5, true);
+
+    int cmp[9];
+    int limits[] = { 3, -7, 9, 3, 0, 12, 3, 2, 4 };
+    test_vec_cmp(cmp, limits, 9, 3);
+    test(cmp[0] == 2 && cmp[1] == 0 && cmp[2] == 1 && cmp[4] == 0 && cmp[5] == 1 && cmp[8] == 1, true);
+
+    int masks[] = { 0x7f, 0x3e, 0x2b, 0x6f, 0x3b, 0xff };
+    test(test_vec_and(masks, 6), 0x2b);
+    test(test_vec_and(masks, 5), 0x2b);
+    test(test_vec_and(masks, 0), -1);
+
+    signed char ss[35];
+    for (int i=0; i < 35; ++i)
+        ss[i] = (signed char) (i * 9);
+    test(test_vec_sub(ss, 35), (signed char) (-(35 * 34 / 2 * 9)));
+    test(test_vec_sub(ss, 15), (signed char) (-(15 * 14 / 2 * 9)));
+
+    test(test_dce_return(3), 1);
+    test(test_dce_return(-3), 2);
+    int counter = 0;
+    test(test_dce_store(&counter, 4), 7);
+    test(counter, 1);
+
+    test(test_ssa_swap(1, 2, 0), 12);
+    test(test_ssa_swap(1, 2, 3), 21);
+    test(test_ssa_swap(1, 2, 4), 12);
+    test(test_ssa_addr(5, 4), 15);
+    test(test_ssa_logical(1, 1), 3);
+    test(test_ssa_logical(1, 0), 1);
+    test(test_ssa_logical(0, 0), 0);
+    test(test_ssa_call_addr(10), 11010005);
+    test(test_ssa_call_assign(10), 20005010);
+
+    test(test_cse_args(3, 4), 12013 + 12);
+    int cells[] = { 1, 2, 3 };
+    counter = 2;
+    test(test_cse_load(cells, 1, &counter), 400 + 14 + 21);
+    test(cells[1], 7);
+    test(test_cse_kill(2, 3, 4), (2 * 4 + 3 * 4) * 100 + 5 * 4 + 4 * 4);
+
     printf("\n%d out of %d tests passed\n", passcount, testcount);
     return passcount != testcount;
 }
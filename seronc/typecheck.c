@@ -0,0 +1,315 @@
+#include "diagnostics.h"
+#include "parser.h"
+#include "symboltable.h"
+
+#include "typecheck.h"
+
+// every callback runs after the children of its node have been checked, so
+// the operand types are always known. a node with an invalid operand is
+// marked invalid as well, without reporting anything, to avoid error cascades
+
+typedef struct {
+    int errcount;
+} Checker;
+
+static Type type_char = { .kind = TYPE_CHAR };
+
+static inline Type type_invalid(void) {
+    return (Type) { .kind = TYPE_INVALID };
+}
+
+static inline bool is_invalid(const AstNode *node) {
+    return node->type.kind == TYPE_INVALID;
+}
+
+static TypeKind type_from_token_literal(NumberLiteralType type) {
+    switch (type) {
+        case NUMBER_CHAR: return TYPE_CHAR;
+        case NUMBER_LONG: return TYPE_LONG;
+        case NUMBER_ANY:
+        case NUMBER_INT:  return TYPE_INT;
+    }
+    UNREACHABLE();
+}
+
+static bool is_lvalue(const AstNode *node) {
+    switch (node->kind) {
+        case ASTNODE_LITERAL:
+            return node->expr_literal.kind == LITERAL_IDENT
+                && node->expr_literal.sym->kind != SYMBOL_PROCEDURE;
+
+        case ASTNODE_UNARYOP:
+            return node->expr_unaryop.kind == UNARYOP_DEREF;
+
+        default:
+            return false;
+    }
+}
+
+static void literal(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    ExprLiteral *literal = &node->expr_literal;
+
+    switch (literal->kind) {
+        case LITERAL_STRING:
+            node->type = (Type) { .kind = TYPE_POINTER, .pointee = &type_char };
+            break;
+
+        case LITERAL_NUMBER:
+            node->type = (Type) { .kind = type_from_token_literal(literal->op.number_type) };
+            break;
+
+        case LITERAL_IDENT:
+            node->type = literal->sym->type;
+            break;
+    }
+
+}
+
+static void grouping(AstNode *node, UNUSED int _depth, UNUSED void *args) {
+    node->type = node->expr_grouping.expr->type;
+}
+
+static void binop(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    ExprBinOp *binop = &node->expr_binop;
+    Type lhs = binop->lhs->type;
+    Type rhs = binop->rhs->type;
+
+    if (is_invalid(binop->lhs) || is_invalid(binop->rhs)) {
+        node->type = type_invalid();
+        return;
+    }
+
+    // pointer arithmetic: the integer operand gets scaled by the size of the pointee
+    if (lhs.kind == TYPE_POINTER && rhs.kind != TYPE_POINTER) {
+        node->type = lhs;
+
+    } else if (lhs.kind != TYPE_POINTER && rhs.kind == TYPE_POINTER) {
+        node->type = rhs;
+
+    } else if (rhs.kind != lhs.kind) {
+        diagnostic_loc(
+            DIAG_ERROR,
+            &binop->op,
+            "Invalid types (%s, %s)",
+            stringify_typekind(rhs.kind),
+            stringify_typekind(lhs.kind)
+        );
+        c->errcount++;
+        node->type = type_invalid();
+
+    } else {
+        node->type = lhs;
+    }
+
+}
+
+static void unaryop(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+    AstNode *operand = unaryop->node;
+
+    if (is_invalid(operand)) {
+        node->type = type_invalid();
+        return;
+    }
+
+    switch (unaryop->kind) {
+        case UNARYOP_NEG:
+        case UNARYOP_MINUS:
+            node->type = operand->type;
+            break;
+
+        case UNARYOP_DEREF:
+            if (operand->type.kind != TYPE_POINTER || operand->type.pointee == NULL) {
+                diagnostic_loc(
+                    DIAG_ERROR,
+                    &unaryop->op,
+                    "Cannot dereference value of type %s",
+                    stringify_typekind(operand->type.kind)
+                );
+                c->errcount++;
+                node->type = type_invalid();
+                return;
+            }
+            node->type = *operand->type.pointee;
+            break;
+
+        case UNARYOP_ADDROF:
+            if (!is_lvalue(operand)) {
+                diagnostic_loc(DIAG_ERROR, &unaryop->op, "Cannot take the address of an rvalue");
+                c->errcount++;
+                node->type = type_invalid();
+                return;
+            }
+            node->type = (Type) { .kind = TYPE_POINTER, .pointee = &operand->type };
+            break;
+    }
+
+}
+
+static void call(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    ExprCall *call = &node->expr_call;
+    Type callee = call->callee->type;
+
+    node->type = type_invalid();
+
+    if (is_invalid(call->callee))
+        return;
+
+    if (callee.kind != TYPE_PROCEDURE) {
+        diagnostic_loc(
+            DIAG_ERROR,
+            &call->op,
+            "Cannot call value of type %s",
+            stringify_typekind(callee.kind)
+        );
+        c->errcount++;
+        return;
+    }
+
+    const ProcSignature *sig = callee.signature;
+    const AstNodeList *list = &call->args;
+
+    if (list->size != sig->params_count) {
+        diagnostic_loc(
+            DIAG_ERROR,
+            &call->op,
+            "Expected %lu arguments, got %lu",
+            sig->params_count,
+            list->size
+        );
+        c->errcount++;
+        return;
+    }
+
+    bool ok = true;
+
+    for (size_t i=0; i < list->size; ++i) {
+        const AstNode *arg = list->items[i];
+        TypeKind param = sig->params[i].type.kind;
+
+        if (is_invalid(arg)) {
+            ok = false;
+
+        } else if (arg->type.kind != param) {
+            diagnostic_loc(
+                DIAG_ERROR,
+                &call->op,
+                "Invalid type for argument %lu (%s, %s)",
+                i+1,
+                stringify_typekind(param),
+                stringify_typekind(arg->type.kind)
+            );
+            c->errcount++;
+            ok = false;
+        }
+    }
+
+    if (ok)
+        node->type = sig->returntype;
+
+}
+
+static void assign(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    ExprAssign *assign = &node->expr_assign;
+    AstNode *target = assign->target;
+    AstNode *value  = assign->value;
+
+    node->type = type_invalid();
+
+    if (is_invalid(target) || is_invalid(value))
+        return;
+
+    if (!is_lvalue(target)) {
+        diagnostic_loc(DIAG_ERROR, &assign->op, "Cannot assign to an rvalue");
+        c->errcount++;
+        return;
+    }
+
+    if (target->type.kind != value->type.kind) {
+        diagnostic_loc(
+            DIAG_ERROR,
+            &assign->op,
+            "Invalid type (%s, %s)",
+            stringify_typekind(target->type.kind),
+            stringify_typekind(value->type.kind)
+        );
+        c->errcount++;
+        return;
+    }
+
+    node->type = value->type;
+
+}
+
+static void array(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    ExprArray *array = &node->expr_array;
+
+    AstNodeList list = array->values;
+    for (size_t i=0; i < list.size; ++i) {
+        const AstNode *value = list.items[i];
+
+        if (!is_invalid(value) && value->type.kind != array->type.kind) {
+            diagnostic_loc(
+                DIAG_ERROR,
+                &array->op,
+                "Invalid type for array element %lu (%s, %s)",
+                i+1,
+                stringify_typekind(array->type.kind),
+                stringify_typekind(value->type.kind)
+            );
+            c->errcount++;
+        }
+    }
+
+    node->type = (Type) { .kind = TYPE_POINTER, .pointee = &array->type };
+
+}
+
+static void vardecl(AstNode *node, UNUSED int _depth, void *args) {
+    Checker *c = args;
+    StmtVarDecl *decl = &node->stmt_vardecl;
+
+    if (decl->init == NULL || is_invalid(decl->init))
+        return;
+
+    if (decl->type.kind != decl->init->type.kind) {
+        diagnostic_loc(
+            DIAG_ERROR,
+            &decl->op,
+            "Invalid type (%s, %s)",
+            stringify_typekind(decl->type.kind),
+            stringify_typekind(decl->init->type.kind)
+        );
+        c->errcount++;
+    }
+
+}
+
+void typecheck(AstNode *root) {
+
+    Checker c = { 0 };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_LITERAL,  NULL, literal  },
+        { ASTNODE_GROUPING, NULL, grouping },
+        { ASTNODE_BINOP,    NULL, binop    },
+        { ASTNODE_UNARYOP,  NULL, unaryop  },
+        { ASTNODE_CALL,     NULL, call     },
+        { ASTNODE_ASSIGN,   NULL, assign   },
+        { ASTNODE_ARRAY,    NULL, array    },
+        { ASTNODE_VARDECL,  NULL, vardecl  },
+    };
+
+    parser_dispatch_ast(root, table, ARRAY_LEN(table), &c);
+
+    if (c.errcount) {
+        diagnostic(DIAG_ERROR, "Type checking failed with %d errors", c.errcount);
+        exit(EXIT_FAILURE);
+    }
+
+}
@@ -0,0 +1,11 @@
+#ifndef _TYPECHECK_H
+#define _TYPECHECK_H
+
+#include "parser.h"
+
+// annotates every expression node with its type
+// all type errors are reported at once, before exiting
+// must be called after symboltable_build()
+void typecheck(AstNode *root);
+
+#endif // _TYPECHECK_H
@@ -17,7 +17,6 @@ NO_DISCARD int type_primitive_size(TypeKind type) {
 }
 
 void align_16(int *i) {
-    // calculate padding for aligning stack, according to sysv abi
-    int padding = 16 - (*i % 16);
-    *i += padding;
+    // round up to the stack alignment of the sysv abi, values that are already aligned are kept
+    *i = (*i + 15) & ~15;
 }
@@ -0,0 +1,470 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+
+#include "unroll.h"
+
+// only loops that come from `for` are unrolled, which expand_ast() has turned into
+//
+// { # Block
+//     let i: <type> = <init>;
+//     while i <op> <bound> {
+//         <body>
+//         i = i + <step>;
+//     }
+// }
+//
+// where i is neither written in the body, nor has its address taken, and the
+// bound is a constant or a variable that the loop does not write. a variable
+// bound must not have its address taken anywhere in the procedure, and the body
+// must neither call nor store through a pointer, which could change it anyway.
+//
+// if init and bound are constants, the number of iterations is known. short
+// loops are replaced by a copy of the body per iteration, with i substituted
+// by its value in that iteration, so fold() can simplify each copy on its own.
+//
+// otherwise small bodies are unrolled by a factor k, the loop runs k copies of
+// the body and the increment per iteration, for as long as all of them would
+// have been entered. the original loop is kept behind it for the remainder:
+//
+// { # Block
+//     let i: <type> = <init>;
+//     while <bound> >= MIN + d && i <op> <bound> - d { # d = (k-1) * step
+//         <body> i = i + <step>;
+//         ...
+//     }
+//     while i <op> <bound> {
+//         <body>
+//         i = i + <step>;
+//     }
+// }
+//
+// the first condition keeps `bound - d` from wrapping around, it is left out
+// for constant bounds. for decreasing loops it is `bound <= MAX + d` instead.
+// an `#unroll(<n>)` hint overrides the factor, and the size limits of both.
+
+#define FULL_UNROLL_TRIPS 8  // iterations of loops that are unrolled completely
+#define FULL_UNROLL_SIZE  96 // AST nodes of completely unrolled loops, all copies together
+#define UNROLL_BODY_SIZE  32 // AST nodes of bodies that are unrolled partially
+
+static struct {
+    int full, partial;
+} stats = { 0 };
+
+typedef struct {
+    Arena *arena;
+    AstNode *proc; // body of the current procedure
+    int factor;
+} Unroller;
+
+
+
+NO_DISCARD static int64_t type_min(TypeKind type) {
+    return ast_wrap((uint64_t) 1 << (8 * type_primitive_size(type) - 1), type);
+}
+
+NO_DISCARD static int64_t type_max(TypeKind type) {
+    return ast_wrap(type_min(type) - (uint64_t) 1, type);
+}
+
+// whether the node writes sym, or takes its address
+static void writes_node(AstNode *node, UNUSED int _depth, void *args) {
+    const Symbol *sym = ((void**) args)[0];
+    bool *writes = ((void**) args)[1];
+
+    switch (node->kind) {
+        case ASTNODE_ASSIGN:
+            *writes |= ast_variable(node->expr_assign.target) == sym;
+            break;
+
+        case ASTNODE_UNARYOP:
+            *writes |= node->expr_unaryop.kind == UNARYOP_ADDROF && ast_variable(node->expr_unaryop.node) == sym;
+            break;
+
+        case ASTNODE_VARDECL:
+            *writes |= node->stmt_vardecl.sym == sym;
+            break;
+
+        default:
+            NOP() break;
+    }
+}
+
+static void vector_node(AstNode *node, UNUSED int _depth, void *args) {
+    bool *vectorized = args;
+    *vectorized |= node->stmt_while.vector != NULL;
+}
+
+// copies would share the plan of the vectorized loop, which refers to the original nodes
+NO_DISCARD static bool contains_vector(AstNode *node) {
+    bool vectorized = false;
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_WHILE, vector_node, NULL },
+    };
+
+    parser_dispatch_ast(node, table, ARRAY_LEN(table), &vectorized);
+    return vectorized;
+}
+
+static void addressed_node(AstNode *node, UNUSED int _depth, void *args) {
+    const Symbol *sym = ((void**) args)[0];
+    bool *addressed = ((void**) args)[1];
+
+    *addressed |= node->expr_unaryop.kind == UNARYOP_ADDROF && ast_variable(node->expr_unaryop.node) == sym;
+}
+
+NO_DISCARD static bool addressed(AstNode *node, const Symbol *sym) {
+    bool addressed = false;
+    void *args[] = { (void*) sym, &addressed };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_UNARYOP, addressed_node, NULL },
+    };
+
+    parser_dispatch_ast(node, table, ARRAY_LEN(table), args);
+    return addressed;
+}
+
+// calls and stores through a pointer, either may write any variable whose address is taken
+static void memory_node(AstNode *node, UNUSED int _depth, void *args) {
+    bool *memory = args;
+
+    if (node->kind == ASTNODE_CALL)
+        *memory = true;
+    else if (ast_variable(node->expr_assign.target) == NULL)
+        *memory = true;
+}
+
+NO_DISCARD static bool writes_memory(AstNode *node) {
+    bool memory = false;
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_CALL,   memory_node, NULL },
+        { ASTNODE_ASSIGN, memory_node, NULL },
+    };
+
+    parser_dispatch_ast(node, table, ARRAY_LEN(table), &memory);
+    return memory;
+}
+
+NO_DISCARD static bool writes(AstNode *node, const Symbol *sym) {
+    bool writes = false;
+    void *args[] = { (void*) sym, &writes };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_ASSIGN,  writes_node, NULL },
+        { ASTNODE_UNARYOP, writes_node, NULL },
+        { ASTNODE_VARDECL, writes_node, NULL },
+    };
+
+    parser_dispatch_ast(node, table, ARRAY_LEN(table), args);
+    return writes;
+}
+
+
+
+static AstNode *new_binop(Unroller *u, BinOpKind kind, AstNode *lhs, AstNode *rhs, Token op) {
+    AstNode *node = ast_new_node(u->arena, ASTNODE_BINOP, lhs->type);
+    node->expr_binop = (ExprBinOp) {
+        .kind = kind,
+        .op   = op,
+        .lhs  = lhs,
+        .rhs  = rhs,
+    };
+    return node;
+}
+
+static AstNodeList clone_list(Unroller *u, const AstNodeList *list, const Symbol *var, const AstNode *value);
+
+// deep copy of the tree, references to var are replaced by copies of value, if var is not NULL
+// symbols are shared with the original, so the copies use the same slots
+static AstNode *clone(Unroller *u, const AstNode *node, const Symbol *var, const AstNode *value) {
+
+    if (node == NULL) return NULL;
+
+    AstNode *copy = ast_new_node(u->arena, node->kind, node->type);
+    *copy = *node;
+
+    switch (node->kind) {
+        case ASTNODE_LITERAL:
+            if (var != NULL && ast_variable(node) == var)
+                *copy = *value;
+            break;
+
+        case ASTNODE_GROUPING:
+            copy->expr_grouping.expr = clone(u, node->expr_grouping.expr, var, value);
+            break;
+
+        case ASTNODE_BINOP:
+            copy->expr_binop.lhs = clone(u, node->expr_binop.lhs, var, value);
+            copy->expr_binop.rhs = clone(u, node->expr_binop.rhs, var, value);
+            break;
+
+        case ASTNODE_UNARYOP:
+            copy->expr_unaryop.node = clone(u, node->expr_unaryop.node, var, value);
+            break;
+
+        case ASTNODE_CALL:
+            copy->expr_call.callee = clone(u, node->expr_call.callee, var, value);
+            copy->expr_call.args   = clone_list(u, &node->expr_call.args, var, value);
+            break;
+
+        case ASTNODE_ASSIGN:
+            copy->expr_assign.target = clone(u, node->expr_assign.target, var, value);
+            copy->expr_assign.value  = clone(u, node->expr_assign.value, var, value);
+            break;
+
+        case ASTNODE_ARRAY:
+            copy->expr_array.values = clone_list(u, &node->expr_array.values, var, value);
+            break;
+
+        case ASTNODE_BLOCK:
+            copy->block.stmts = clone_list(u, &node->block.stmts, var, value);
+            break;
+
+        case ASTNODE_VARDECL:
+            copy->stmt_vardecl.init = clone(u, node->stmt_vardecl.init, var, value);
+            break;
+
+        case ASTNODE_IF:
+            copy->stmt_if.condition = clone(u, node->stmt_if.condition, var, value);
+            copy->stmt_if.then_body = clone(u, node->stmt_if.then_body, var, value);
+            copy->stmt_if.else_body = clone(u, node->stmt_if.else_body, var, value);
+            break;
+
+        case ASTNODE_WHILE:
+            copy->stmt_while.condition = clone(u, node->stmt_while.condition, var, value);
+            copy->stmt_while.body      = clone(u, node->stmt_while.body, var, value);
+            break;
+
+        case ASTNODE_RETURN:
+            copy->stmt_return.expr = clone(u, node->stmt_return.expr, var, value);
+            break;
+
+        case ASTNODE_PROC:
+        case ASTNODE_TABLE:
+        case ASTNODE_FOR:
+        case ASTNODE_INDEX:
+            PANIC("unexpected node in a loop body");
+    }
+
+    return copy;
+}
+
+static AstNodeList clone_list(Unroller *u, const AstNodeList *list, const Symbol *var, const AstNode *value) {
+    AstNodeList copy;
+    astnodelist_init(&copy, u->arena);
+
+    for (size_t i=0; i < list->size; ++i)
+        astnodelist_append(&copy, clone(u, list->items[i], var, value));
+
+    return copy;
+}
+
+
+
+NO_DISCARD static bool compare(BinOpKind kind, int64_t a, int64_t b) {
+    switch (kind) {
+        case BINOP_LT:    return a <  b;
+        case BINOP_LT_EQ: return a <= b;
+        case BINOP_GT:    return a >  b;
+        case BINOP_GT_EQ: return a >= b;
+        case BINOP_NEQ:   return a != b;
+        default: UNREACHABLE();
+    }
+}
+
+// number of iterations, or -1 if there are more than `max`
+NO_DISCARD static int trip_count(BinOpKind kind, int64_t init, int64_t bound, int64_t step, TypeKind type, int max) {
+    int64_t i = init;
+
+    for (int count=0; count <= max; ++count) {
+        if (!compare(kind, i, bound)) return count;
+        i = ast_wrap((uint64_t) i + (uint64_t) step, type);
+    }
+
+    return -1;
+}
+
+// `i = i + c` or `i = i - c`
+NO_DISCARD static bool is_increment(const AstNode *node, const Symbol *sym, int64_t *step) {
+    if (node->kind != ASTNODE_ASSIGN || ast_variable(node->expr_assign.target) != sym) return false;
+
+    const AstNode *value = node->expr_assign.value;
+    if (value->kind != ASTNODE_BINOP) return false;
+
+    const ExprBinOp *binop = &value->expr_binop;
+    if (ast_variable(binop->lhs) != sym || !ast_is_constant(binop->rhs)) return false;
+
+    switch (binop->kind) {
+        case BINOP_ADD: *step = ast_constant(binop->rhs); return true;
+        case BINOP_SUB: *step = -(uint64_t) ast_constant(binop->rhs); return true;
+        default: return false;
+    }
+}
+
+static void unroll_fully(Unroller *u, AstNode *loop, const Symbol *var, int64_t init, int64_t step, int trips) {
+    const AstNodeList *stmts = &loop->stmt_while.body->block.stmts;
+    TypeKind type = var->type.kind;
+
+    AstNodeList copies;
+    astnodelist_init(&copies, u->arena);
+
+    for (int n=0; n < trips; ++n) {
+        int64_t value = ast_wrap((uint64_t) init + (uint64_t) n * (uint64_t) step, type);
+        AstNode *number = ast_new_number(u->arena, value, var->type, loop->stmt_while.op);
+
+        // the increment is left out, the next copy has the next value anyway
+        for (size_t i=0; i+1 < stmts->size; ++i)
+            astnodelist_append(&copies, clone(u, stmts->items[i], var, number));
+    }
+
+    // the variable is still declared, but nothing reads it anymore
+    loop->kind = ASTNODE_BLOCK;
+    loop->block.stmts = copies;
+    stats.full++;
+}
+
+static void unroll_partially(Unroller *u, AstNode *block, AstNode *loop, Symbol *var, int64_t step, int factor) {
+    StmtWhile *while_ = &loop->stmt_while;
+    ExprBinOp *cond = &while_->condition->expr_binop;
+    Type type = var->type;
+    Token op = while_->op;
+
+    int64_t distance = ast_wrap((uint64_t) (factor - 1) * (uint64_t) step, type.kind);
+
+    // the bound must not wrap around when the distance is subtracted
+    int64_t limit = step > 0 ? type_min(type.kind) + distance : type_max(type.kind) + distance;
+    if ((uint64_t) (factor - 1) * (uint64_t) (step > 0 ? step : -step) > (uint64_t) type_max(type.kind)) return;
+
+    AstNode *bound = cond->rhs;
+    if (ast_is_constant(bound) && (step > 0 ? ast_constant(bound) < limit : ast_constant(bound) > limit)) return;
+
+    AstNode *last = new_binop(u, cond->kind, clone(u, cond->lhs, NULL, NULL),
+        new_binop(u, BINOP_SUB, clone(u, bound, NULL, NULL), ast_new_number(u->arena, distance, type, op), op), op);
+
+    AstNode *condition = last;
+    if (!ast_is_constant(bound)) {
+        AstNode *guard = new_binop(u, step > 0 ? BINOP_GT_EQ : BINOP_LT_EQ,
+            clone(u, bound, NULL, NULL), ast_new_number(u->arena, limit, type, op), op);
+        condition = new_binop(u, BINOP_LOG_AND, guard, last, op);
+    }
+
+    AstNode *body = ast_new_node(u->arena, ASTNODE_BLOCK, while_->body->type);
+    astnodelist_init(&body->block.stmts, u->arena);
+
+    const AstNodeList *stmts = &while_->body->block.stmts;
+    for (int n=0; n < factor; ++n)
+        for (size_t i=0; i < stmts->size; ++i)
+            astnodelist_append(&body->block.stmts, clone(u, stmts->items[i], NULL, NULL));
+
+    AstNode *unrolled = ast_new_node(u->arena, ASTNODE_WHILE, loop->type);
+    unrolled->stmt_while = (StmtWhile) {
+        .op        = op,
+        .condition = condition,
+        .body      = body,
+    };
+
+    // the original loop stays behind the unrolled one, for the remaining iterations
+    AstNodeList *list = &block->block.stmts;
+    astnodelist_append(list, loop);
+    list->items[1] = unrolled;
+
+    stats.partial++;
+}
+
+static void block(AstNode *node, UNUSED int _depth, void *args) {
+    Unroller *u = args;
+    AstNodeList *stmts = &node->block.stmts;
+
+    if (stmts->size != 2) return;
+    if (stmts->items[0]->kind != ASTNODE_VARDECL || stmts->items[1]->kind != ASTNODE_WHILE) return;
+
+    StmtVarDecl *decl = &stmts->items[0]->stmt_vardecl;
+    AstNode *loop = stmts->items[1];
+    StmtWhile *while_ = &loop->stmt_while;
+    Symbol *var = decl->sym;
+
+    if (while_->unroll == 1 || !ast_is_integer(var->type.kind) || while_->body->kind != ASTNODE_BLOCK) return;
+    if (contains_vector(loop)) return;
+
+    const AstNode *cond = while_->condition;
+    if (cond->kind != ASTNODE_BINOP || ast_variable(cond->expr_binop.lhs) != var) return;
+
+    BinOpKind kind = cond->expr_binop.kind;
+    if (kind != BINOP_LT && kind != BINOP_LT_EQ && kind != BINOP_GT && kind != BINOP_GT_EQ && kind != BINOP_NEQ) return;
+
+    AstNode *bound = cond->expr_binop.rhs;
+    Symbol *bound_var = ast_variable(bound);
+    if (!ast_is_constant(bound) && (bound_var == NULL || writes(loop, bound_var))) return;
+    if (!ast_is_constant(bound) && (addressed(u->proc, bound_var) || writes_memory(while_->body))) return;
+
+    // the increment is the last statement, and the only write
+    const AstNodeList *body = &while_->body->block.stmts;
+    if (body->size == 0) return;
+
+    int64_t step;
+    if (!is_increment(body->items[body->size - 1], var, &step) || step == 0) return;
+
+    for (size_t i=0; i+1 < body->size; ++i)
+        if (writes(body->items[i], var)) return;
+
+    int size = ast_size(while_->body);
+    int hint = while_->unroll;
+
+    if (decl->init != NULL && ast_is_constant(decl->init) && ast_is_constant(bound)) {
+        int max = hint > 0 ? hint : FULL_UNROLL_TRIPS;
+        int trips = trip_count(kind, ast_constant(decl->init), ast_constant(bound), step, var->type.kind, max);
+
+        if (trips >= 0 && (hint > 0 || trips * size <= FULL_UNROLL_SIZE)) {
+            unroll_fully(u, loop, var, ast_constant(decl->init), step, trips);
+            return;
+        }
+    }
+
+    // the bound is only known to be reached exactly when it is one step away
+    if (kind == BINOP_NEQ) return;
+    if ((kind == BINOP_LT || kind == BINOP_LT_EQ) != (step > 0)) return;
+
+    int factor = hint > 0 ? hint : u->factor;
+    if (factor < 2 || (hint == 0 && size > UNROLL_BODY_SIZE)) return;
+
+    unroll_partially(u, node, loop, var, step, factor);
+}
+
+bool unroll_loops(AstNode *root, Arena *arena, int factor) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    int before = stats.full + stats.partial;
+
+    Unroller u = {
+        .arena  = arena,
+        .factor = factor,
+    };
+
+    AstDispatchEntry table[] = {
+        { ASTNODE_BLOCK, NULL, block },
+    };
+
+    const AstNodeList *list = &root->block.stmts;
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL) continue;
+
+        u.proc = node->stmt_proc.body;
+        parser_dispatch_ast(u.proc, table, ARRAY_LEN(table), &u);
+    }
+
+    return stats.full + stats.partial != before;
+}
+
+void unroll_print_stats(void) {
+    printf("UNROLL %-18s %d\n", "full",    stats.full);
+    printf("UNROLL %-18s %d\n", "partial", stats.partial);
+}
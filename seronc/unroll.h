@@ -0,0 +1,20 @@
+#ifndef _UNROLL_H
+#define _UNROLL_H
+
+#include <stdbool.h>
+
+#include <arena.h>
+
+#include "parser.h"
+
+// unrolls counted loops that come from `for` statements, loops with a small
+// constant trip count are replaced by a copy of the body per iteration, other
+// small loops run `factor` copies of the body per iteration, a factor below 2
+// disables it. `#unroll(<n>)` hints override the factor of their loop
+// must be called after fold(), returns whether any loop has been unrolled, so
+// the copies can be folded again
+bool unroll_loops(AstNode *root, Arena *arena, int factor);
+// prints how many loops have been unrolled fully, and partially
+void unroll_print_stats(void);
+
+#endif // _UNROLL_H
@@ -0,0 +1,395 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "parser.h"
+#include "symboltable.h"
+#include "ast.h"
+#include "main.h"
+
+#include "vector.h"
+
+// a loop is vectorized if it counts an index up by one, and does a single thing
+// per iteration with the elements at that index:
+//
+// while i < n {                      while i < n {
+//     xs[i] = ys[i] + zs[i] * c;         sum = sum + xs[i];
+//     i = i + 1;                         i = i + 1;
+// }                                  }
+//
+// where every value in the expression is either an element `ptr[i]` of the
+// type of the loop, or invariant. the index, the bound, the pointers and the
+// invariant variables must not have their address taken anywhere in the
+// procedure, so the store can not change any of them.
+//
+// a store may still overlap the elements that are loaded, which is checked
+// right in front of the loop by codegen(), which falls back to the scalar loop
+// if the target starts less than a vector behind one of the sources.
+//
+// SSE2 lacks 64 bit comparisons and 32 bit multiplication, these are only
+// vectorized with -mavx2
+
+static struct {
+    int vectorized, rejected;
+} stats = { 0 };
+
+typedef struct {
+    Arena *arena;
+    const DeclProc *proc;
+    SymbolSet addressed; // variables of the procedure whose address is taken
+} Vectorizer;
+
+
+
+NO_DISCARD static bool is_element(TypeKind type) {
+    return type == TYPE_CHAR || type == TYPE_INT || type == TYPE_LONG;
+}
+
+NO_DISCARD static bool is_number(const AstNode *node) {
+    return node->kind == ASTNODE_LITERAL && node->expr_literal.kind == LITERAL_NUMBER;
+}
+
+NO_DISCARD static const AstNode *strip(const AstNode *node) {
+    while (node->kind == ASTNODE_GROUPING)
+        node = node->expr_grouping.expr;
+    return node;
+}
+
+static void addressed(AstNode *node, UNUSED int _depth, void *args) {
+    Vectorizer *v = args;
+    ExprUnaryOp *unaryop = &node->expr_unaryop;
+
+    Symbol *sym = ast_variable(unaryop->node);
+    if (unaryop->kind == UNARYOP_ADDROF && sym != NULL)
+        symbolset_add(&v->addressed, sym);
+}
+
+// the pointer of `ptr[i]`, that is `*(ptr + i)` once expanded, NULL if it is something else
+NO_DISCARD static AstNode *load_pointer(const AstNode *node, const Symbol *index) {
+    node = strip(node);
+    if (node->kind != ASTNODE_UNARYOP || node->expr_unaryop.kind != UNARYOP_DEREF) return NULL;
+
+    const AstNode *addr = strip(node->expr_unaryop.node);
+    if (addr->kind != ASTNODE_BINOP || addr->expr_binop.kind != BINOP_ADD) return NULL;
+
+    AstNode *lhs = addr->expr_binop.lhs, *rhs = addr->expr_binop.rhs;
+    if (ast_variable(lhs) == index) {
+        AstNode *tmp = lhs;
+        lhs = rhs;
+        rhs = tmp;
+    }
+
+    if (ast_variable(rhs) != index || ast_variable(lhs) == NULL || lhs->type.kind != TYPE_POINTER) return NULL;
+    return lhs;
+}
+
+// both sides are the same constant or variable
+NO_DISCARD static bool same_leaf(const AstNode *a, const AstNode *b) {
+    a = strip(a);
+    b = strip(b);
+
+    if (is_number(a))
+        return is_number(b) && a->expr_literal.op.number == b->expr_literal.op.number;
+
+    return ast_variable(a) != NULL && ast_variable(a) == ast_variable(b);
+}
+
+NO_DISCARD static bool is_invariant(const AstNode *node) {
+    node = strip(node);
+    return is_number(node) || ast_variable(node) != NULL;
+}
+
+// comparisons that are computed with the operands swapped, `a < b` is `b > a`
+NO_DISCARD static bool is_swapped(BinOpKind kind) {
+    return kind == BINOP_LT || kind == BINOP_GT_EQ;
+}
+
+NO_DISCARD static bool is_comparison(BinOpKind kind) {
+    switch (kind) {
+        case BINOP_EQ:
+        case BINOP_NEQ:
+        case BINOP_GT:
+        case BINOP_GT_EQ:
+        case BINOP_LT:
+        case BINOP_LT_EQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// temporary registers needed to compute the node
+NO_DISCARD static int registers(const AstNode *node) {
+    node = strip(node);
+    if (node->kind != ASTNODE_BINOP) return 1;
+
+    const ExprBinOp *binop = &node->expr_binop;
+    const AstNode *first  = is_swapped(binop->kind) ? binop->rhs : binop->lhs;
+    const AstNode *second = is_swapped(binop->kind) ? binop->lhs : binop->rhs;
+
+    // invariants are used right from their register
+    int a = registers(first);
+    int b = is_invariant(second) ? 0 : registers(second);
+    return a > b + 1 ? a : b + 1;
+}
+
+// returns false if there is no register left for it
+NO_DISCARD static bool add_invariant(VectorLoop *vec, AstNode *node) {
+    if (vector_invariant(vec, node) != -1) return true;
+    if (vector_temporaries(vec) == VECTOR_REGISTERS) return false;
+
+    vec->invariants[vec->invariants_len++] = node;
+    return true;
+}
+
+// checks that the expression can be computed on vectors, returns the reason if it can not
+static const char *check_expr(const Vectorizer *v, VectorLoop *vec, AstNode *node) {
+
+    while (node->kind == ASTNODE_GROUPING)
+        node = node->expr_grouping.expr;
+
+    if (node->type.kind != vec->type) return "mixes types";
+
+    if (is_number(node))
+        return add_invariant(vec, node) ? NULL : "needs too many registers";
+
+    Symbol *sym = ast_variable(node);
+    if (sym != NULL) {
+        if (sym == vec->index) return "uses the index as a value";
+        if (sym == vec->acc)   return "reads the accumulator";
+        if (symbolset_contains(&v->addressed, sym)) return "reads a variable whose address is taken";
+        return add_invariant(vec, node) ? NULL : "needs too many registers";
+    }
+
+    AstNode *ptr = load_pointer(node, vec->index);
+    if (ptr != NULL) {
+        if (symbolset_contains(&v->addressed, ast_variable(ptr))) return "loads through a pointer whose address is taken";
+        if (vec->kind != VECTOR_MAP || ast_variable(ptr) == ast_variable(vec->target)) return NULL;
+
+        for (size_t i=0; i < vec->sources_len; ++i)
+            if (ast_variable(vec->sources[i]) == ast_variable(ptr))
+                return NULL;
+
+        if (vec->sources_len == ARRAY_LEN(vec->sources)) return "loads from too many arrays";
+        vec->sources[vec->sources_len++] = ptr;
+        return NULL;
+    }
+
+    if (node->kind != ASTNODE_BINOP) return "unsupported expression";
+    const ExprBinOp *binop = &node->expr_binop;
+
+    switch (binop->kind) {
+        case BINOP_ADD:
+        case BINOP_SUB:
+        case BINOP_BITWISE_AND:
+        case BINOP_BITWISE_OR:
+            break;
+
+        case BINOP_MUL:
+            if (vec->type != TYPE_INT || !compiler_ctx.avx2) return "multiplies, which is only vectorized for int with -mavx2";
+            break;
+
+        default:
+            if (!is_comparison(binop->kind)) return "unsupported operation";
+            if (vec->type == TYPE_LONG && !compiler_ctx.avx2) return "compares long, which needs -mavx2";
+
+            // masks of comparisons are turned into 1 or 0
+            if (vec->one == NULL) {
+                AstNode *one = ast_new_number(v->arena, 1, node->type, binop->op);
+
+                if (!add_invariant(vec, one)) return "needs too many registers";
+                vec->one = one;
+            }
+            break;
+    }
+
+    const char *reason = check_expr(v, vec, binop->lhs);
+    return reason != NULL ? reason : check_expr(v, vec, binop->rhs);
+}
+
+// `acc = acc <op> expr`, or `acc = expr <op> acc` if the operation is commutative
+NO_DISCARD static bool reduction(AstNode *assign, Symbol **acc, BinOpKind *kind, AstNode **expr) {
+    *acc = ast_variable(assign->expr_assign.target);
+    const AstNode *value = strip(assign->expr_assign.value);
+
+    if (*acc == NULL || value->kind != ASTNODE_BINOP) return false;
+    const ExprBinOp *binop = &value->expr_binop;
+
+    switch (binop->kind) {
+        case BINOP_ADD:
+        case BINOP_SUB:
+        case BINOP_BITWISE_OR:
+        case BINOP_BITWISE_AND:
+            break;
+        default:
+            return false;
+    }
+
+    *kind = binop->kind;
+
+    if (ast_variable(binop->lhs) == *acc) {
+        *expr = binop->rhs;
+        return true;
+    }
+
+    if (ast_variable(binop->rhs) == *acc && binop->kind != BINOP_SUB) {
+        *expr = binop->lhs;
+        return true;
+    }
+
+    return false;
+}
+
+// returns the reason if the loop can not be vectorized
+static const char *plan(const Vectorizer *v, VectorLoop *vec, StmtWhile *loop) {
+
+    const AstNodeList *stmts = &loop->body->block.stmts;
+
+    if (loop->unroll != 0) return "has an unroll hint";
+    if (vec->index->type.kind != TYPE_INT && vec->index->type.kind != TYPE_LONG) return "index is neither int nor long";
+    if (symbolset_contains(&v->addressed, vec->index)) return "address of the index is taken";
+    if (stmts->size != 2) return "body is not a single statement";
+
+    Symbol *bound = ast_variable(vec->bound);
+    if (!is_number(vec->bound) && (bound == NULL || bound == vec->index || symbolset_contains(&v->addressed, bound)))
+        return "bound is not invariant";
+
+    AstNode *stmt = stmts->items[0];
+    if (stmt->kind != ASTNODE_ASSIGN) return "body is not an assignment";
+
+    AstNode *target = load_pointer(stmt->expr_assign.target, vec->index);
+
+    if (target != NULL) {
+        vec->kind   = VECTOR_MAP;
+        vec->target = target;
+        vec->expr   = stmt->expr_assign.value;
+
+        if (symbolset_contains(&v->addressed, ast_variable(target))) return "stores through a pointer whose address is taken";
+
+    } else if (reduction(stmt, &vec->acc, &vec->reduce, &vec->expr)) {
+        vec->kind = VECTOR_REDUCE;
+
+        if (vec->acc == vec->index || vec->acc == bound) return "reduces into the index or the bound";
+        if (symbolset_contains(&v->addressed, vec->acc)) return "address of the accumulator is taken";
+
+    } else {
+        return "neither stores to an array, nor reduces into a variable";
+    }
+
+    vec->type  = stmt->expr_assign.value->type.kind;
+    vec->width = compiler_ctx.avx2 ? 32 : 16;
+    if (!is_element(vec->type)) return "elements are neither char, int nor long";
+    vec->lanes = vec->width / type_primitive_size(vec->type);
+
+    const char *reason = check_expr(v, vec, vec->expr);
+    if (reason != NULL) return reason;
+
+    int temps = is_invariant(vec->expr) ? 0 : registers(vec->expr);
+    if (vector_temporaries(vec) + temps > VECTOR_REGISTERS) return "needs too many registers";
+
+    return NULL;
+}
+
+static void while_(AstNode *node, UNUSED int _depth, void *args) {
+    Vectorizer *v = args;
+    StmtWhile *loop = &node->stmt_while;
+
+    // only counted loops are considered at all, `while i < n { ...; i = i + 1; }`
+    if (loop->body->kind != ASTNODE_BLOCK || loop->body->block.stmts.size == 0) return;
+
+    const AstNode *cond = strip(loop->condition);
+    if (cond->kind != ASTNODE_BINOP) return;
+    if (cond->expr_binop.kind != BINOP_LT && cond->expr_binop.kind != BINOP_LT_EQ) return;
+
+    Symbol *index = ast_variable(cond->expr_binop.lhs);
+    if (index == NULL) return;
+
+    const AstNodeList *stmts = &loop->body->block.stmts;
+    const AstNode *step = stmts->items[stmts->size - 1];
+    if (step->kind != ASTNODE_ASSIGN || ast_variable(step->expr_assign.target) != index) return;
+
+    const AstNode *value = strip(step->expr_assign.value);
+    if (value->kind != ASTNODE_BINOP || value->expr_binop.kind != BINOP_ADD) return;
+    if (ast_variable(value->expr_binop.lhs) != index || !is_number(value->expr_binop.rhs)) return;
+    if (value->expr_binop.rhs->expr_literal.op.number != 1) return;
+
+    VectorLoop *vec = arena_alloc(v->arena, sizeof(VectorLoop));
+    memset(vec, 0, sizeof(VectorLoop));
+    vec->index   = index;
+    vec->compare = cond->expr_binop.kind;
+    vec->bound   = cond->expr_binop.rhs;
+
+    const char *reason = plan(v, vec, loop);
+
+    if (reason == NULL) {
+        loop->vector = vec;
+        stats.vectorized++;
+    } else {
+        stats.rejected++;
+    }
+
+    if (!compiler_ctx.stats) return;
+
+    // the line is found by scanning the source up to the loop, so only for --stats
+    int line = get_token_location(&loop->op, compiler_ctx.src).line;
+
+    if (reason != NULL)
+        printf("VECTOR loop in %s at line %d: %s\n", v->proc->ident.value, line, reason);
+    else
+        printf("VECTOR loop in %s at line %d: %d x %s, %s\n", v->proc->ident.value, line,
+               vec->lanes, stringify_typekind(vec->type), vec->kind == VECTOR_MAP ? "map" : "reduction");
+}
+
+void vectorize_loops(AstNode *root, Arena *arena) {
+    assert(root->kind == ASTNODE_BLOCK);
+
+    Vectorizer v = {
+        .arena = arena,
+    };
+
+    const AstNodeList *list = &root->block.stmts;
+
+    for (size_t i=0; i < list->size; ++i) {
+        AstNode *node = list->items[i];
+        if (node->kind != ASTNODE_PROC || node->stmt_proc.body == NULL) continue;
+
+        v.proc = &node->stmt_proc;
+        v.addressed.len = 0;
+
+        AstDispatchEntry addrs[] = {
+            { ASTNODE_UNARYOP, addressed, NULL },
+        };
+        parser_dispatch_ast(v.proc->body, addrs, ARRAY_LEN(addrs), &v);
+
+        AstDispatchEntry loops[] = {
+            { ASTNODE_WHILE, NULL, while_ },
+        };
+        parser_dispatch_ast(v.proc->body, loops, ARRAY_LEN(loops), &v);
+    }
+
+    free(v.addressed.items);
+}
+
+int vector_invariant(const VectorLoop *vec, const AstNode *node) {
+    int base = vec->kind == VECTOR_REDUCE;
+
+    for (size_t i=0; i < vec->invariants_len; ++i)
+        if (same_leaf(vec->invariants[i], node))
+            return base + i;
+
+    return -1;
+}
+
+AstNode *vector_pointer(const VectorLoop *vec, const AstNode *node) {
+    return load_pointer(node, vec->index);
+}
+
+int vector_temporaries(const VectorLoop *vec) {
+    return (vec->kind == VECTOR_REDUCE) + vec->invariants_len;
+}
+
+void vector_print_stats(void) {
+    printf("VECTOR %-18s %d\n", "vectorized", stats.vectorized);
+    printf("VECTOR %-18s %d\n", "rejected",   stats.rejected);
+}
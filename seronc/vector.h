@@ -0,0 +1,53 @@
+#ifndef _VECTOR_H
+#define _VECTOR_H
+
+#include <stdbool.h>
+
+#include <arena.h>
+
+#include "parser.h"
+
+// vector registers the generated loops may use, xmm0 to xmm3, or ymm0 to ymm3
+#define VECTOR_REGISTERS 4
+
+typedef enum {
+    VECTOR_MAP,    // `target[i] = expr`
+    VECTOR_REDUCE, // `acc = acc <reduce> expr`
+} VectorKind;
+
+// plan of a vectorized loop `while i < bound { <stmt> i = i + 1; }`, which codegen()
+// runs `lanes` iterations at a time, before the scalar loop does the remainder.
+// the nodes are those of the scalar loop, every one of them is either an
+// invariant, a load `ptr[i]`, or an operation on vectors
+typedef struct VectorLoop {
+    VectorKind kind;
+    TypeKind type;      // of the elements
+    int lanes, width;   // elements per vector, and its size in bytes
+    Symbol *index;
+    BinOpKind compare;  // BINOP_LT or BINOP_LT_EQ
+    AstNode *bound;
+    AstNode *expr;
+    AstNode *target;    // map: pointer that is stored to
+    Symbol *acc;        // reduce: accumulator, starts in register 0
+    BinOpKind reduce;   // reduce: BINOP_ADD, BINOP_SUB, BINOP_BITWISE_OR or BINOP_BITWISE_AND
+    AstNode *invariants[VECTOR_REGISTERS]; // broadcast into the registers after the accumulator
+    size_t invariants_len;
+    AstNode *one;       // invariant holding 1 in every lane, turns masks of comparisons into 0 or 1
+    AstNode *sources[VECTOR_REGISTERS * 2]; // pointers loaded from, that may overlap the target
+    size_t sources_len;
+} VectorLoop;
+
+// finds loops over arrays that can be vectorized, and attaches a plan to them
+// must be called after fold(), and before unroll_loops() and optimize_loops()
+// rewrite the loops, both of which leave vectorized loops alone
+void vectorize_loops(AstNode *root, Arena *arena);
+// vector register holding the invariant, -1 if the node is none
+NO_DISCARD int vector_invariant(const VectorLoop *vec, const AstNode *node);
+// pointer of the load `ptr[i]`, NULL if the node is none
+NO_DISCARD AstNode *vector_pointer(const VectorLoop *vec, const AstNode *node);
+// register of the first temporary, the ones below hold the accumulator and the invariants
+NO_DISCARD int vector_temporaries(const VectorLoop *vec);
+// prints how many loops have been vectorized, every loop is listed as it is visited
+void vector_print_stats(void);
+
+#endif // _VECTOR_H